@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "aio.h"
+#include "types.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define AIO_HAVE_URING 1
+#else
+#define AIO_HAVE_URING 0
+#endif
+
+typedef enum
+{
+    e_slot_idle,
+    e_slot_submitted,
+    e_slot_done
+} SlotState;
+
+typedef struct _AioSlot
+{
+    unsigned char *data;        // AIO_BLOCK bytes, page aligned
+    off_t offset;               // File offset of data[0]
+    size_t length;              // Bytes asked for (reader) or queued (writer)
+    ssize_t result;             // Bytes moved, or -errno
+    SlotState state;
+} AioSlot;
+
+#if AIO_HAVE_URING
+/* Submission and completion rings shared with the kernel */
+typedef struct _AioRing
+{
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+} AioRing;
+#endif
+
+typedef struct _AioStream
+{
+    FILE *base;                 // Owned, closed with the stream
+    int fd;
+    int writing;
+    AioSlot slots[AIO_SLOTS];   // Used in turn, so they stay in file order
+    unsigned head;              // Slot being consumed (reader) or filled (writer)
+    size_t used;                // Bytes of the head slot consumed or filled
+    off_t position;             // Stream position
+    off_t next_offset;          // reader: where the next prefetched block starts
+    off_t file_size;            // reader: prefetching stops here
+    int error;                  // errno of the first failed block
+    int use_ring;
+#if AIO_HAVE_URING
+    AioRing ring;
+#endif
+    // Thread engine: the I/O thread serves submitted slots in turn from cursor
+    pthread_t thread;
+    int thread_started;
+    pthread_mutex_t lock;       // Guards slot states, cursor and stopping
+    pthread_cond_t cond;
+    unsigned cursor;
+    int stopping;
+} AioStream;
+
+/* Engine */
+
+static int engine_uring;
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+
+/* io_uring is used when the kernel has it with plain reads and writes (5.6+) */
+static void probe_engine(void)
+{
+    const char *forced = getenv("STEG_AIO");
+    if (forced != NULL && strcmp(forced, "threads") == 0)
+        return;
+#if AIO_HAVE_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, 2, &params);
+    if (fd < 0)
+        return;
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if (probe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        probe->last_op >= IORING_OP_WRITE && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED))
+        engine_uring = 1;
+    free(probe);
+    close(fd);
+#endif
+}
+
+const char *aio_engine_name(void)
+{
+    pthread_once(&engine_once, probe_engine);
+    return engine_uring ? "io_uring" : "threads";
+}
+
+#if AIO_HAVE_URING
+static void ring_free(AioRing *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+}
+
+static Status ring_setup(AioRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return e_failure;
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_map_size > ring->sq_map_size)
+            ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        ring_free(ring);
+        return e_failure;
+    }
+    ring->cq_map = params.features & IORING_FEAT_SINGLE_MMAP
+                   ? ring->sq_map
+                   : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                          IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        ring_free(ring);
+        return e_failure;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return e_success;
+}
+
+/* Record every completion the kernel has posted */
+static void ring_reap(AioStream *s)
+{
+    AioRing *ring = &s->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        AioSlot *slot = &s->slots[cqe->user_data];
+        slot->result = cqe->res;
+        slot->state = e_slot_done;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void ring_submit(AioStream *s, unsigned index)
+{
+    AioRing *ring = &s->ring;
+    AioSlot *slot = &s->slots[index];
+    unsigned tail = *ring->sq_tail;
+    unsigned entry = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[entry];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = s->writing ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)slot->data;
+    sqe->len = slot->length;
+    sqe->off = slot->offset;
+    sqe->user_data = index;
+    ring->sq_array[entry] = entry;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    // The entry stays queued until the kernel takes it, so a busy ring just tries again
+    while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0 &&
+           (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        ring_reap(s);
+}
+#endif
+
+/* Thread engine: pread/pwrite the submitted slots in the order they were queued */
+static void *aio_thread(void *arg)
+{
+    AioStream *s = arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;)
+    {
+        while (!s->stopping && s->slots[s->cursor].state != e_slot_submitted)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if (s->stopping)
+            break;
+        unsigned index = s->cursor;
+        AioSlot *slot = &s->slots[index];
+        pthread_mutex_unlock(&s->lock);
+
+        ssize_t n = s->writing ? pwrite(s->fd, slot->data, slot->length, slot->offset)
+                               : pread(s->fd, slot->data, slot->length, slot->offset);
+
+        pthread_mutex_lock(&s->lock);
+        slot->result = n < 0 ? -errno : n;
+        slot->state = e_slot_done;
+        s->cursor = (index + 1) % AIO_SLOTS;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void set_state(AioStream *s, AioSlot *slot, SlotState state)
+{
+    if (s->use_ring)
+    {
+        slot->state = state;
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    slot->state = state;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void submit_slot(AioStream *s, unsigned index)
+{
+    s->slots[index].result = 0;
+    set_state(s, &s->slots[index], e_slot_submitted);
+#if AIO_HAVE_URING
+    if (s->use_ring)
+        ring_submit(s, index);
+#endif
+}
+
+/* Wait for a submitted slot, finishing a short transfer with plain pread/pwrite */
+static void wait_slot(AioStream *s, AioSlot *slot)
+{
+#if AIO_HAVE_URING
+    if (s->use_ring)
+    {
+        while (slot->state == e_slot_submitted)
+        {
+            ring_reap(s);
+            if (slot->state == e_slot_submitted)
+                syscall(__NR_io_uring_enter, s->ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        }
+    }
+#endif
+    if (!s->use_ring)
+    {
+        pthread_mutex_lock(&s->lock);
+        while (slot->state == e_slot_submitted)
+            pthread_cond_wait(&s->cond, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    size_t done = slot->result;
+    while (slot->result >= 0 && done < slot->length)
+    {
+        ssize_t n = s->writing ? pwrite(s->fd, slot->data + done, slot->length - done, slot->offset + done)
+                               : pread(s->fd, slot->data + done, slot->length - done, slot->offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            slot->result = -errno;
+        if (n <= 0)
+            break;
+        done += n;
+        slot->result = done;
+    }
+    if (slot->result < 0 && s->error == 0)
+        s->error = -slot->result;
+}
+
+/* Wait for every slot in flight and mark them all free */
+static void drain(AioStream *s)
+{
+    for (unsigned i = 0; i < AIO_SLOTS; i++)
+    {
+        AioSlot *slot = &s->slots[(s->head + i) % AIO_SLOTS];
+        if (slot->state == e_slot_submitted)
+            wait_slot(s, slot);
+        set_state(s, slot, e_slot_idle);
+    }
+}
+
+/* Reader */
+
+/* Queue the idle slots from head on for the blocks behind next_offset */
+static void prefetch(AioStream *s)
+{
+    for (unsigned i = 0; i < AIO_SLOTS && s->next_offset < s->file_size; i++)
+    {
+        unsigned index = (s->head + i) % AIO_SLOTS;
+        AioSlot *slot = &s->slots[index];
+        if (slot->state != e_slot_idle)
+            continue;
+        slot->offset = s->next_offset;
+        slot->length = s->file_size - s->next_offset < AIO_BLOCK ? (size_t)(s->file_size - s->next_offset) : AIO_BLOCK;
+        s->next_offset += slot->length;
+        submit_slot(s, index);
+    }
+}
+
+static ssize_t aio_read(void *cookie, char *buffer, size_t size)
+{
+    AioStream *s = cookie;
+    size_t copied = 0;
+    while (copied < size)
+    {
+        AioSlot *slot = &s->slots[s->head];
+        if (slot->state == e_slot_idle)
+            prefetch(s);
+        if (slot->state == e_slot_idle)
+            break;                      // End of the file
+        if (slot->state == e_slot_submitted)
+            wait_slot(s, slot);
+        if (slot->result < 0)
+        {
+            errno = -slot->result;
+            return copied ? (ssize_t)copied : -1;
+        }
+
+        size_t n = slot->result - s->used;
+        if (n > size - copied)
+            n = size - copied;
+        memcpy(buffer + copied, slot->data + s->used, n);
+        copied += n;
+        s->used += n;
+        s->position += n;
+        if (s->used == (size_t)slot->result)
+        {
+            // Block used up, its slot goes to the next block ahead
+            set_state(s, slot, e_slot_idle);
+            s->head = (s->head + 1) % AIO_SLOTS;
+            s->used = 0;
+            prefetch(s);
+        }
+    }
+    return copied;
+}
+
+/* Writer */
+
+/* Queue the filled part of the head slot */
+static void flush_head(AioStream *s)
+{
+    if (s->used == 0)
+        return;
+    s->slots[s->head].length = s->used;
+    submit_slot(s, s->head);
+    s->head = (s->head + 1) % AIO_SLOTS;
+    s->used = 0;
+}
+
+static ssize_t aio_write(void *cookie, const char *buffer, size_t size)
+{
+    AioStream *s = cookie;
+    size_t copied = 0;
+    while (copied < size)
+    {
+        AioSlot *slot = &s->slots[s->head];
+        if (s->used == 0)
+        {
+            // The block this slot held last time round has to be written first
+            if (slot->state == e_slot_submitted)
+                wait_slot(s, slot);
+            set_state(s, slot, e_slot_idle);
+            slot->offset = s->position;
+        }
+        if (s->error)
+        {
+            errno = s->error;
+            return copied ? (ssize_t)copied : -1;
+        }
+        size_t n = AIO_BLOCK - s->used;
+        if (n > size - copied)
+            n = size - copied;
+        memcpy(slot->data + s->used, buffer + copied, n);
+        copied += n;
+        s->used += n;
+        s->position += n;
+        if (s->used == AIO_BLOCK)
+            flush_head(s);
+    }
+    return copied;
+}
+
+static int aio_seek(void *cookie, off64_t *offset, int whence)
+{
+    AioStream *s = cookie;
+    off_t target = *offset;
+    if (whence == SEEK_CUR)
+        target += s->position;
+    else if (whence == SEEK_END)
+        target += s->writing ? s->position : s->file_size;
+    if (target < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (target != s->position)
+    {
+        AioSlot *slot = &s->slots[s->head];
+        if (!s->writing && slot->state == e_slot_submitted)
+            wait_slot(s, slot);
+        if (!s->writing && slot->state == e_slot_done && slot->result > 0 && target >= slot->offset &&
+            target < slot->offset + slot->result)
+        {
+            // Still inside the block at hand
+            s->used = target - slot->offset;
+        }
+        else
+        {
+            // Start over at target: queued writes go out, prefetched blocks are dropped
+            if (s->writing)
+                flush_head(s);
+            drain(s);
+            pthread_mutex_lock(&s->lock);
+            s->head = s->cursor = 0;
+            pthread_mutex_unlock(&s->lock);
+            s->used = 0;
+            s->next_offset = target;
+        }
+        s->position = target;
+    }
+    *offset = target;
+    return 0;
+}
+
+static void free_stream(AioStream *s)
+{
+    if (s->thread_started)
+    {
+        pthread_mutex_lock(&s->lock);
+        s->stopping = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->thread, NULL);
+    }
+#if AIO_HAVE_URING
+    if (s->use_ring)
+        ring_free(&s->ring);
+#endif
+    for (int i = 0; i < AIO_SLOTS; i++)
+        free(s->slots[i].data);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s);
+}
+
+static int aio_close(void *cookie)
+{
+    AioStream *s = cookie;
+    if (s->writing)
+        flush_head(s);
+    drain(s);
+    int error = s->error;
+    FILE *base = s->base;
+    free_stream(s);
+    int closed = fclose(base);
+    if (error)
+    {
+        errno = error;
+        return -1;
+    }
+    return closed == 0 ? 0 : -1;
+}
+
+FILE *aio_open(FILE *base, const char *mode)
+{
+    int writing = mode[0] == 'w';
+    int fd = fileno(base);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return NULL;
+    // A write into the page cache is a copy by the CPU, so on a single
+    // core queueing it only adds a copy of our own
+    if (writing && sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        return NULL;
+    // Take over from the stream position, anything base buffered is accounted for
+    if (fflush(base) != 0)
+        return NULL;
+    off_t start = ftello(base);
+    if (start < 0)
+        return NULL;
+
+    AioStream *s = calloc(1, sizeof(AioStream));
+    if (s == NULL)
+        return NULL;
+    s->base = base;
+    s->fd = fd;
+    s->writing = writing;
+    s->position = s->next_offset = start;
+    s->file_size = st.st_size;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    for (int i = 0; i < AIO_SLOTS; i++)
+    {
+        if (posix_memalign((void **)&s->slots[i].data, 4096, AIO_BLOCK) != 0)
+        {
+            s->slots[i].data = NULL;
+            free_stream(s);
+            return NULL;
+        }
+    }
+
+    pthread_once(&engine_once, probe_engine);
+#if AIO_HAVE_URING
+    if (engine_uring && ring_setup(&s->ring, AIO_SLOTS) == e_success)
+        s->use_ring = 1;
+#endif
+    if (!s->use_ring)
+    {
+        if (pthread_create(&s->thread, NULL, aio_thread, s) != 0)
+        {
+            free_stream(s);
+            return NULL;
+        }
+        s->thread_started = 1;
+    }
+
+    cookie_io_functions_t io = {writing ? NULL : aio_read, writing ? aio_write : NULL, aio_seek, aio_close};
+    FILE *stream = fopencookie(s, writing ? "w" : "r", io);
+    if (stream == NULL)
+        free_stream(s);
+    return stream;
+}
@@ -0,0 +1,38 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdio.h>
+
+/*
+ * Overlapped block I/O for --io=async
+ * Wraps a regular file in a stdio stream that keeps AIO_SLOTS blocks of
+ * AIO_BLOCK bytes in flight: a reader prefetches the blocks ahead of
+ * the current position, a writer queues each filled block and only
+ * waits for it when its slot comes round again. The encode and decode
+ * stages read and write the stream exactly as they do a stdio one, and
+ * the embedding of one block overlaps the I/O of its neighbours.
+ *
+ * Blocks go through io_uring (raw syscalls, no liburing) when the
+ * kernel has it, else through one I/O thread per stream doing
+ * pread/pwrite. STEG_AIO=threads forces the thread fallback. Writes
+ * only go behind with a second core to do them on, a single core
+ * writes straight into the page cache as stdio does.
+ */
+
+/* Blocks in flight per stream, and their size */
+#define AIO_SLOTS 4
+#define AIO_BLOCK (1 << 20)
+
+/*
+ * Stream over base ("r": read-ahead, "w": write-behind) starting at its
+ * current offset. The stream owns base and closes it. NULL, with base
+ * left alone, when base is not a regular file, a writer would run on a
+ * single core or the engine can't start.
+ * Closing a writer waits for the queued blocks and fails if any did.
+ */
+FILE *aio_open(FILE *base, const char *mode);
+
+/* "io_uring" or "threads", the engine new streams use */
+const char *aio_engine_name(void);
+
+#endif
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "parallel.h"
+#include "cache.h"
+
+/* One manifest line */
+typedef struct _BatchJob
+{
+    int line_no;                // Line in the manifest, for the report
+    char *line;                 // Owned copy of the line, args point into it
+    char *args[6];              // argv layout read_and_validate_*_args() expect
+    OperationType operation;
+    Status status;
+    const char *failed_stage;   // Where a failed job stopped
+    char error[STEG_ERROR_SIZE];    // What stopped it, when the job knows
+    off_t payload_size;
+    double millis;
+    ssize_t after;              // Earlier job sharing a file with this one, -1 for none
+    int done;                   // Set under done_lock once the job finished
+} BatchJob;
+
+/* State shared by the workers */
+typedef struct _Batch
+{
+    BatchJob *jobs;
+    size_t count;
+    size_t next;                // Next job to hand out (atomic)
+    IoMode io_mode;
+    int checksum;               // Encode jobs store a payload checksum
+    CarrierCache carrier_cache;     // Shared by the encode jobs
+    int use_cache;
+    pthread_mutex_t report_lock;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;   // Signalled whenever a job finishes
+} Batch;
+
+static double now_millis(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Split a manifest line into a job, returns e_failure for a malformed line */
+static Status parse_job(char *line, BatchJob *job)
+{
+    char *save = NULL;
+    char *op = strtok_r(line, " \t\r\n", &save);
+    if (op == NULL)
+        return e_failure;
+
+    if (strcmp(op, "e") == 0 || strcmp(op, "-e") == 0)
+    {
+        job->operation = e_encode;
+        job->args[1] = "-e";
+    }
+    else if (strcmp(op, "d") == 0 || strcmp(op, "-d") == 0)
+    {
+        job->operation = e_decode;
+        job->args[1] = "-d";
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    // args[2..4] as on the command line, unused slots stay NULL
+    job->args[0] = "batch";
+    int nargs = 2;
+    char *token;
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+    {
+        if (nargs > 4)
+            return e_failure;
+        job->args[nargs++] = token;
+    }
+    int min_args = job->operation == e_encode ? 4 : 3;
+    if (nargs < min_args || (job->operation == e_decode && nargs > 4))
+        return e_failure;
+    return e_success;
+}
+
+/* Length of path without its extension (decode replaces the extension given) */
+static size_t path_stem(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash + 1 : path, '.');
+    return dot ? (size_t)(dot - path) : strlen(path);
+}
+
+static int same_stem(const char *a, const char *b)
+{
+    size_t len = path_stem(a);
+    return len == path_stem(b) && strncmp(a, b, len) == 0;
+}
+
+/* Files the job writes (0) or only reads (1 and on), NULL terminated */
+static void job_files(const BatchJob *job, const char *files[4])
+{
+    memset(files, 0, 4 * sizeof(*files));
+    if (job->operation == e_encode)
+    {
+        files[0] = job->args[4] ? job->args[4] : "output.bmp";
+        files[1] = job->args[2];
+        files[2] = job->args[3];
+    }
+    else if (job->operation == e_decode)
+    {
+        files[0] = job->args[3] ? job->args[3] : "decoded";
+        files[1] = job->args[2];
+    }
+}
+
+/*
+ * Order jobs that share a file: a job runs after the last earlier job
+ * that writes one of its files, or reads the file it writes. Paths are
+ * compared without their extension, so a few unrelated jobs may be
+ * serialized, but a decode never reads a stego image still being written.
+ */
+static void order_jobs(Batch *batch)
+{
+    for (size_t i = 0; i < batch->count; i++)
+    {
+        BatchJob *job = &batch->jobs[i];
+        const char *files[4];
+        job_files(job, files);
+        job->after = -1;
+        for (size_t k = i; k-- > 0 && job->after < 0 && files[0] != NULL; )
+        {
+            const char *earlier[4];
+            job_files(&batch->jobs[k], earlier);
+            for (int a = 0; earlier[a] != NULL && job->after < 0; a++)
+            {
+                for (int b = 0; files[b] != NULL; b++)
+                {
+                    // Reads against reads never conflict
+                    if ((a == 0 || b == 0) && same_stem(earlier[a], files[b]))
+                    {
+                        job->after = k;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Load every job of the manifest, blank and '#' lines are skipped */
+static Status load_manifest(const char *manifest_fname, Batch *batch)
+{
+    FILE *fptr = fopen(manifest_fname, "r");
+    if (fptr == NULL)
+    {
+        perror("Error opening batch manifest");
+        return e_failure;
+    }
+
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_no = 0;
+    Status status = e_success;
+    while (getline(&line, &line_size, fptr) != -1)
+    {
+        line_no++;
+        char *start = line + strspn(line, " \t\r\n");
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        if (batch->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchJob *jobs = realloc(batch->jobs, capacity * sizeof(BatchJob));
+            if (jobs == NULL)
+            {
+                status = e_failure;
+                break;
+            }
+            batch->jobs = jobs;
+        }
+
+        BatchJob *job = &batch->jobs[batch->count++];
+        memset(job, 0, sizeof(*job));
+        job->line_no = line_no;
+        job->line = strdup(start);
+        if (job->line == NULL)
+        {
+            status = e_failure;
+            break;
+        }
+        if (parse_job(job->line, job) == e_failure)
+        {
+            // Keep it so it shows up as failed in the report
+            job->operation = e_unsupported;
+        }
+    }
+    free(line);
+    fclose(fptr);
+    return status;
+}
+
+/* Run one job with the worker's buffers */
+static void run_job(Batch *batch, BatchJob *job, char *block_buffer, char *chunk_buffer)
+{
+    double start = now_millis();
+    job->status = e_failure;
+
+    if (job->operation == e_encode)
+    {
+        EncodeInfo encInfo = {0};
+        encInfo.io_mode = batch->io_mode;
+        encInfo.threads = 1;
+        encInfo.block_buffer = block_buffer;
+        encInfo.chunk_buffer = chunk_buffer;
+        encInfo.carrier_cache = batch->use_cache ? &batch->carrier_cache : NULL;
+        encInfo.checksum = batch->checksum;
+        encInfo.quiet = 1;
+        if (read_and_validate_encode_args(job->args, &encInfo) == e_failure)
+            job->failed_stage = "validation";
+        else if (do_encoding(&encInfo) == e_failure)
+            job->failed_stage = "encoding";
+        else
+            job->status = e_success;
+        job->payload_size = encInfo.size_secret_file;
+        close_files(&encInfo);
+        strcpy(job->error, encInfo.error);
+    }
+    else if (job->operation == e_decode)
+    {
+        DecodeInfo decInfo = {0};
+        decInfo.io_mode = batch->io_mode;
+        decInfo.threads = 1;
+        decInfo.block_buffer = block_buffer;
+        decInfo.chunk_buffer = chunk_buffer;
+        decInfo.quiet = 1;
+        if (read_and_validate_decode_args(job->args, &decInfo) == e_failure)
+            job->failed_stage = "validation";
+        else if (do_decoding(&decInfo) == e_failure)
+            job->failed_stage = "decoding";
+        else
+            job->status = e_success;
+        job->payload_size = decInfo.size_secret_file;
+        close_decode_files(&decInfo);
+        strcpy(job->error, decInfo.error);
+    }
+    else
+    {
+        job->failed_stage = "manifest syntax";
+    }
+    job->millis = now_millis() - start;
+
+    pthread_mutex_lock(&batch->report_lock);
+    if (job->status == e_success)
+    {
+        printf("[line %d] %s %s OK (%lld bytes, %.2f ms)\n", job->line_no,
+               job->operation == e_encode ? "encode" : "decode", job->args[2],
+               (long long)job->payload_size, job->millis);
+    }
+    else if (job->error[0] != '\0')
+    {
+        printf("[line %d] %s FAILED at %s (%s)\n", job->line_no,
+               job->args[2] ? job->args[2] : job->line, job->failed_stage, job->error);
+    }
+    else
+    {
+        printf("[line %d] %s FAILED at %s\n", job->line_no,
+               job->args[2] ? job->args[2] : job->line, job->failed_stage);
+    }
+    pthread_mutex_unlock(&batch->report_lock);
+
+    pthread_mutex_lock(&batch->done_lock);
+    job->done = 1;
+    pthread_cond_broadcast(&batch->done_cond);
+    pthread_mutex_unlock(&batch->done_lock);
+}
+
+static void batch_worker(void *ctx, int index, int nworkers)
+{
+    Batch *batch = ctx;
+    (void)index;        // Jobs are claimed from batch->next, not split by index
+    (void)nworkers;
+
+    // Buffers live as long as the worker, jobs fall back to their own on NULL
+    char *block_buffer = malloc(STEG_BLOCK_SIZE);
+    char *chunk_buffer = malloc(STEG_SECRET_CHUNK);
+
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (i >= batch->count)
+            break;
+
+        // Jobs are claimed in manifest order, so the one waited for is already running
+        BatchJob *job = &batch->jobs[i];
+        if (job->after >= 0)
+        {
+            pthread_mutex_lock(&batch->done_lock);
+            while (!batch->jobs[job->after].done)
+                pthread_cond_wait(&batch->done_cond, &batch->done_lock);
+            pthread_mutex_unlock(&batch->done_lock);
+        }
+        run_job(batch, job, block_buffer, chunk_buffer);
+    }
+
+    free(block_buffer);
+    free(chunk_buffer);
+}
+
+Status run_batch(const char *manifest_fname, int nworkers, IoMode io_mode, size_t cache_budget, int checksum)
+{
+    Batch batch = {0};
+    batch.io_mode = io_mode;
+    batch.checksum = checksum;
+    batch.use_cache = cache_budget > 0 && carrier_cache_init(&batch.carrier_cache, cache_budget) == e_success;
+    pthread_mutex_init(&batch.report_lock, NULL);
+    pthread_mutex_init(&batch.done_lock, NULL);
+    pthread_cond_init(&batch.done_cond, NULL);
+
+    Status status = load_manifest(manifest_fname, &batch);
+    if (status == e_success)
+    {
+        order_jobs(&batch);
+        if (nworkers > (int)batch.count)
+            nworkers = batch.count ? batch.count : 1;
+
+        double start = now_millis();
+        status = parallel_run(nworkers, batch_worker, &batch);
+        double elapsed = (now_millis() - start) / 1000.0;
+
+        size_t succeeded = 0;
+        double payload_bytes = 0;
+        for (size_t i = 0; i < batch.count; i++)
+        {
+            if (batch.jobs[i].status == e_success)
+            {
+                succeeded++;
+                payload_bytes += batch.jobs[i].payload_size;
+            }
+        }
+        printf("\nBatch summary: %zu jobs, %zu succeeded, %zu failed, %d workers\n",
+               batch.count, succeeded, batch.count - succeeded, nworkers);
+        if (elapsed > 0)
+        {
+            printf("Elapsed %.3f s, %.1f jobs/s, %.2f MB/s payload\n",
+                   elapsed, batch.count / elapsed, payload_bytes / elapsed / 1e6);
+        }
+        if (batch.use_cache)
+        {
+            CarrierCacheStats cache;
+            carrier_cache_stats(&batch.carrier_cache, &cache);
+            printf("Carrier cache: %llu hits, %llu header only, %llu misses, %llu evictions, "
+                   "%llu carriers in %.1f MiB\n",
+                   (unsigned long long)cache.hits, (unsigned long long)cache.header_hits,
+                   (unsigned long long)cache.misses, (unsigned long long)cache.evictions,
+                   (unsigned long long)cache.entries, cache.bytes / 1048576.0);
+        }
+        if (succeeded != batch.count)
+            status = e_failure;
+    }
+
+    for (size_t i = 0; i < batch.count; i++)
+        free(batch.jobs[i].line);
+    free(batch.jobs);
+    if (batch.use_cache)
+        carrier_cache_free(&batch.carrier_cache);
+    pthread_mutex_destroy(&batch.report_lock);
+    pthread_mutex_destroy(&batch.done_lock);
+    pthread_cond_destroy(&batch.done_cond);
+    return status;
+}
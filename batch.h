@@ -0,0 +1,26 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Batch mode
+ * The manifest lists one job per line, blank lines and lines starting
+ * with '#' are skipped:
+ *   e <source.bmp> <secret.txt> [output.bmp]
+ *   d <stego.bmp> [output.txt]
+ * Jobs run on a fixed pool of workers that keep their work buffers for
+ * the whole batch, in any order except that a job sharing a file with an
+ * earlier line (one of them writing it) waits for that line to finish.
+ * A failing job is reported with the error it recorded instead of
+ * printing, and the batch carries on.
+ * Encode jobs share a cache.h carrier cache of cache_budget bytes (0
+ * for none), so a cover image used by many jobs is read once, and store
+ * a payload checksum when checksum is set.
+ */
+
+/* Run every job of the manifest on nworkers threads */
+Status run_batch(const char *manifest_fname, int nworkers, IoMode io_mode, size_t cache_budget, int checksum);
+
+#endif
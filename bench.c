@@ -0,0 +1,590 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bench.h"
+#include "encode.h"
+#include "decode.h"
+#include "stats.h"
+#include "steg.h"
+#include "bmp.h"
+#include "common.h"
+#include "ecc.h"
+#include "lsb.h"
+#include "crypto.h"
+#include "crc32c.h"
+
+/* Carrier, secret, stego image and decoded secret, then the same two for the per-byte reference */
+#define BENCH_FILES 6
+
+/* Secret bytes each LSB kernel is timed over */
+#define BENCH_KERNEL_BYTES ((size_t)4 << 20)
+
+/* Carrier GB/s of one LSB kernel */
+typedef struct _KernelSpeed
+{
+    double embed_gbps;          // 0 when it could not be timed
+    double extract_gbps;
+} KernelSpeed;
+
+/* A memfd, or a file in dir that is unlinked straight away so nothing is left behind */
+static int scratch_file(const char *dir, const char *name)
+{
+    if (dir == NULL)
+        return memfd_create(name, MFD_CLOEXEC);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/steg-bench-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    return fd;
+}
+
+/* xorshift64*, cheap enough that generating the data doesn't drag on */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/* prefix followed by random bytes up to size */
+static Status fill_random(int fd, uint64_t size, uint64_t seed, const unsigned char *prefix, size_t prefix_size)
+{
+    unsigned char *buffer = malloc(STEG_BLOCK_SIZE);
+    if (buffer == NULL)
+        return e_failure;
+    uint64_t state = seed;
+    uint64_t written = 0;
+    Status status = e_success;
+    while (written < size && status == e_success)
+    {
+        size_t n = size - written < STEG_BLOCK_SIZE ? size - written : STEG_BLOCK_SIZE;
+        for (size_t i = 0; i < n; i += 8)
+        {
+            uint64_t word = next_random(&state);
+            memcpy(buffer + i, &word, n - i < 8 ? n - i : 8);
+        }
+        if (written == 0 && prefix_size > 0)
+            memcpy(buffer, prefix, prefix_size);
+        if (pwrite(fd, buffer, n, written) != (ssize_t)n)
+            status = e_failure;
+        written += n;
+    }
+    free(buffer);
+    return status;
+}
+
+/* 24 bpp BITMAPINFOHEADER image of width x height */
+static size_t make_header(unsigned width, unsigned height, unsigned char header[54], uint64_t *file_size)
+{
+    uint64_t stride = ((uint64_t)width * 3 + 3) & ~(uint64_t)3;
+    uint64_t pixels = stride * height;
+    uint32_t fields[13] = {(uint32_t)(54 + pixels), 0, 54, 40, width, height, 1 | (24 << 16), 0, (uint32_t)pixels,
+                           2835, 2835, 0, 0};
+    header[0] = 'B';
+    header[1] = 'M';
+    for (int i = 0; i < 13; i++)
+    {
+        for (int b = 0; b < 4; b++)
+            header[2 + 4 * i + b] = fields[i] >> (8 * b);
+    }
+    *file_size = 54 + pixels;
+    return 54;
+}
+
+/* Point the next run at the start of the inputs and empty the outputs */
+static void reset_files(int *fds, int first_output)
+{
+    for (int i = 0; i < BENCH_FILES; i++)
+    {
+        lseek(fds[i], 0, SEEK_SET);
+        if (i >= first_output && ftruncate(fds[i], 0) != 0)
+            perror("ftruncate");
+    }
+}
+
+static Status bench_encode(const BenchConfig *config, int *fds, Stats *stats, uint64_t *payload_bytes)
+{
+    char src[16], secret[16], output[16];
+    snprintf(src, sizeof(src), "fd:%d", fds[0]);
+    snprintf(secret, sizeof(secret), "fd:%d", fds[1]);
+    snprintf(output, sizeof(output), "fd:%d", fds[2]);
+    reset_files(fds, 2);
+
+    EncodeInfo encInfo = {0};
+    encInfo.io_mode = config->io_mode;
+    encInfo.threads = config->threads;
+    encInfo.depth = config->depth;
+    encInfo.compress = config->compress;
+    encInfo.encrypt = config->encrypt;
+    encInfo.checksum = config->checksum;
+    encInfo.ecc = config->ecc;
+    encInfo.passphrase = config->passphrase;
+    encInfo.quiet = 1;
+    encInfo.src_image_fname = src;
+    encInfo.secret_fname = secret;
+    encInfo.stego_image_fname = output;
+    encInfo.secret_extn = ".txt";
+    encInfo.stats = stats;
+
+    stats_start(stats);
+    Status status = do_encoding(&encInfo);
+    close_files(&encInfo);
+    stats_mark(stats, "close");
+    stats_stop(stats);
+    *payload_bytes = encInfo.size_secret_file;
+    return status;
+}
+
+static Status bench_decode(const BenchConfig *config, int *fds, Stats *stats, uint64_t *payload_bytes)
+{
+    char stego[16];
+    snprintf(stego, sizeof(stego), "fd:%d", fds[2]);
+    reset_files(fds, 3);
+
+    DecodeInfo decInfo = {0};
+    decInfo.io_mode = config->io_mode;
+    decInfo.threads = config->threads;
+    decInfo.passphrase = config->passphrase;
+    decInfo.quiet = 1;
+    decInfo.stego_image_fname = stego;
+    snprintf(decInfo.output_fname, sizeof(decInfo.output_fname), "fd:%d", fds[3]);
+    decInfo.stats = stats;
+
+    stats_start(stats);
+    Status status = do_decoding(&decInfo);
+    close_decode_files(&decInfo);
+    stats_mark(stats, "close");
+    stats_stop(stats);
+    *payload_bytes = decInfo.size_secret_file;
+    return status;
+}
+
+/* Decoded file holds exactly the secret */
+static Status same_contents(int fd_a, int fd_b)
+{
+    off_t size = lseek(fd_a, 0, SEEK_END);
+    if (size != lseek(fd_b, 0, SEEK_END))
+        return e_failure;
+    char *a = malloc(STEG_BLOCK_SIZE), *b = malloc(STEG_BLOCK_SIZE);
+    Status status = a && b ? e_success : e_failure;
+    for (off_t pos = 0; pos < size && status == e_success; pos += STEG_BLOCK_SIZE)
+    {
+        size_t n = size - pos < STEG_BLOCK_SIZE ? size - pos : STEG_BLOCK_SIZE;
+        if (pread(fd_a, a, n, pos) != (ssize_t)n || pread(fd_b, b, n, pos) != (ssize_t)n || memcmp(a, b, n) != 0)
+            status = e_failure;
+    }
+    free(a);
+    free(b);
+    return status;
+}
+
+/*
+ * The per-byte reference (--reference): the loop the block path
+ * replaced, one fread of 8 carrier bytes, a bit loop and one fwrite per
+ * header or payload byte, then the rest of the image a byte at a time.
+ */
+typedef struct _RefCursor
+{
+    FILE *in, *out;             // out is NULL when extracting
+    const BmpInfo *bmp;
+    uint64_t index;             // Next usable carrier byte
+    uint64_t pos;               // File position of in (and out)
+} RefCursor;
+
+/* Hide byte in the next 8 carrier bytes, or read it from them when out is NULL */
+static Status ref_byte(RefCursor *cursor, unsigned char *byte)
+{
+    // Padding bytes between rows are read (and written) with the 8 around them
+    unsigned char raw[32], carrier[8];
+    size_t raw_size = bmp_span_end(cursor->bmp, cursor->index, 8) - cursor->pos;
+    if (cursor->index + 8 > cursor->bmp->capacity || raw_size > sizeof(raw) ||
+        fread(raw, 1, raw_size, cursor->in) != raw_size)
+        return e_failure;
+    bmp_gather(cursor->bmp, raw, cursor->pos, cursor->index, 8, carrier);
+    if (cursor->out != NULL)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            carrier[i] &= 0xFE;
+            carrier[i] |= (*byte >> (7 - i)) & 1;
+        }
+        bmp_scatter(cursor->bmp, raw, cursor->pos, cursor->index, 8, carrier);
+        if (fwrite(raw, 1, raw_size, cursor->out) != raw_size)
+            return e_failure;
+    }
+    else
+    {
+        *byte = 0;
+        for (int i = 0; i < 8; i++)
+            *byte = (*byte << 1) | (carrier[i] & 1);
+    }
+    cursor->index += 8;
+    cursor->pos += raw_size;
+    return e_success;
+}
+
+/* FILE on a dup of fd, from its start; an output is emptied first */
+static FILE *ref_stream(int fd, const char *mode)
+{
+    if (mode[0] == 'w' && ftruncate(fd, 0) != 0)
+        return NULL;
+    int copy = dup(fd);
+    FILE *fptr = copy < 0 ? NULL : fdopen(copy, mode);
+    if (fptr == NULL && copy >= 0)
+        close(copy);
+    if (fptr != NULL)
+        lseek(copy, 0, SEEK_SET);
+    return fptr;
+}
+
+/* Same stego image as the block path, header and (checksummed) payload at depth 1 */
+static Status reference_encode(int *fds, const BmpInfo *bmp, const unsigned char *header, size_t header_size,
+                               int checksum, Stats *stats)
+{
+    FILE *secret = ref_stream(fds[1], "r");
+    RefCursor cursor = {ref_stream(fds[0], "r"), ref_stream(fds[4], "w"), bmp, 0, bmp->pixel_offset};
+    Status status = secret && cursor.in && cursor.out ? e_success : e_failure;
+    unsigned char image_header[256], byte;
+    uint32_t crc = 0;
+
+    stats_start(stats);
+    if (status == e_success && (bmp->pixel_offset > sizeof(image_header) ||
+        fread(image_header, 1, bmp->pixel_offset, cursor.in) != bmp->pixel_offset ||
+        fwrite(image_header, 1, bmp->pixel_offset, cursor.out) != bmp->pixel_offset))
+        status = e_failure;
+    for (size_t i = 0; i < header_size && status == e_success; i++)
+    {
+        byte = header[i];
+        status = ref_byte(&cursor, &byte);
+    }
+    stats_mark(stats, "header");
+    while (status == e_success && fread(&byte, 1, 1, secret) == 1)
+    {
+        if (checksum)
+            crc = crc32c_update(crc, &byte, 1);
+        status = ref_byte(&cursor, &byte);
+    }
+    for (int shift = 24; checksum && shift >= 0 && status == e_success; shift -= 8)
+    {
+        byte = crc >> shift;
+        status = ref_byte(&cursor, &byte);
+    }
+    stats_mark(stats, "embed");
+    while (status == e_success && fread(&byte, 1, 1, cursor.in) == 1)
+    {
+        if (fwrite(&byte, 1, 1, cursor.out) != 1)
+            status = e_failure;
+    }
+    if (cursor.out != NULL && fclose(cursor.out) != 0)
+        status = e_failure;
+    stats_mark(stats, "copy");
+    stats_stop(stats);
+
+    if (cursor.in != NULL)
+        fclose(cursor.in);
+    if (secret != NULL)
+        fclose(secret);
+    return status;
+}
+
+/* Read the header back and extract payload_size bytes of the block path's stego image */
+static Status reference_decode(int *fds, const BmpInfo *bmp, const unsigned char *header, size_t header_size,
+                               uint64_t payload_size, Stats *stats)
+{
+    FILE *output = ref_stream(fds[5], "w");
+    RefCursor cursor = {ref_stream(fds[2], "r"), NULL, bmp, 0, bmp->pixel_offset};
+    Status status = output && cursor.in && fseeko(cursor.in, bmp->pixel_offset, SEEK_SET) == 0 ? e_success : e_failure;
+    unsigned char byte;
+
+    stats_start(stats);
+    for (size_t i = 0; i < header_size && status == e_success; i++)
+    {
+        if (ref_byte(&cursor, &byte) == e_failure || byte != header[i])
+            status = e_failure;
+    }
+    stats_mark(stats, "header");
+    for (uint64_t i = 0; i < payload_size && status == e_success; i++)
+    {
+        if (ref_byte(&cursor, &byte) == e_failure || fwrite(&byte, 1, 1, output) != 1)
+            status = e_failure;
+    }
+    if (output != NULL && fclose(output) != 0)
+        status = e_failure;
+    stats_mark(stats, "extract");
+    stats_stop(stats);
+
+    if (cursor.in != NULL)
+        fclose(cursor.in);
+    return status;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Carrier GB/s of the best of a few passes over n secret bytes */
+static double kernel_speed(const LsbKernelResult *kernel, int embed, unsigned char *secret, size_t n,
+                           unsigned char *carrier)
+{
+    double best = 0;
+    for (int pass = 0; pass < 5; pass++)
+    {
+        double start = now_seconds();
+        if (embed)
+            kernel->embed(secret, n, carrier);
+        else
+            kernel->extract(carrier, n, secret);
+        double elapsed = now_seconds() - start;
+        if (elapsed > 0 && 8 * n / elapsed / 1e9 > best)
+            best = 8 * n / elapsed / 1e9;
+    }
+    return best;
+}
+
+/* Time every kernel lsb_check_kernels() returned over BENCH_KERNEL_BYTES of random data */
+static void time_kernels(const LsbKernelResult *kernels, int count, KernelSpeed *speeds)
+{
+    unsigned char *secret = malloc(BENCH_KERNEL_BYTES);
+    unsigned char *carrier = malloc(8 * BENCH_KERNEL_BYTES);
+    uint64_t state = 0xD1B54A32D192ED03ULL;
+    for (size_t i = 0; secret && carrier && i < 8 * BENCH_KERNEL_BYTES; i += 8)
+    {
+        uint64_t word = next_random(&state);
+        memcpy(carrier + i, &word, 8);
+        if (i < BENCH_KERNEL_BYTES)
+            memcpy(secret + i, &word, 8);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        speeds[i].embed_gbps = 0;
+        speeds[i].extract_gbps = 0;
+        if (secret != NULL && carrier != NULL)
+        {
+            speeds[i].embed_gbps = kernel_speed(&kernels[i], 1, secret, BENCH_KERNEL_BYTES, carrier);
+            speeds[i].extract_gbps = kernel_speed(&kernels[i], 0, secret, BENCH_KERNEL_BYTES, carrier);
+        }
+    }
+    free(secret);
+    free(carrier);
+}
+
+static int compare_totals(const void *x, const void *y)
+{
+    double a = stats_total(x), b = stats_total(y);
+    return a < b ? -1 : a > b;
+}
+
+/* Sort the runs by total time and return the median one */
+static const Stats *median_run(Stats *runs, int count)
+{
+    qsort(runs, count, sizeof(Stats), compare_totals);
+    return &runs[count / 2];
+}
+
+static const char *io_name(IoMode io_mode)
+{
+    return io_mode == e_io_mmap ? "mmap" : io_mode == e_io_async ? "async" : "stdio";
+}
+
+static void print_runs(const char *operation, Stats *runs, int count, uint64_t payload_bytes, int json)
+{
+    const Stats *median = median_run(runs, count);
+    if (json)
+    {
+        printf(", \"%s_median_ms\": %.3f, \"%s\": [", operation, stats_total(median), operation);
+        for (int i = 0; i < count; i++)
+        {
+            if (i)
+                printf(", ");
+            stats_print(&runs[i], stdout, operation, payload_bytes, 1);
+        }
+        printf("]");
+        return;
+    }
+    printf("\n%-11s : median %.3f ms over %d runs (min %.3f, max %.3f), %.1f MB/s of payload\n", operation,
+           stats_total(median), count, stats_total(&runs[0]), stats_total(&runs[count - 1]),
+           payload_bytes / (stats_total(median) * 1000.0));
+    stats_print(median, stdout, operation, payload_bytes, 0);
+}
+
+/* Kernels in use, and how each LSB kernel fared against the scalar one */
+static void print_kernels(const LsbKernelResult *results, const KernelSpeed *speeds, int count, int json)
+{
+    if (json)
+        printf(", \"kernels\": {\"lsb\": \"%s\", \"chacha20\": \"%s\", \"ecc\": \"%s\"}, \"lsb_kernels\": [",
+               lsb_kernel_name(), chacha20_kernel_name(), ecc_kernel_name());
+    else
+        printf("Kernels     : lsb %s, chacha20 %s, ecc %s\n", lsb_kernel_name(), chacha20_kernel_name(),
+               ecc_kernel_name());
+    for (int i = 0; i < count; i++)
+    {
+        if (json)
+            printf("%s{\"name\": \"%s\", \"matches_scalar\": %s, \"embed_gbps\": %.2f, \"extract_gbps\": %.2f}",
+                   i ? ", " : "", results[i].name, results[i].matches ? "true" : "false", speeds[i].embed_gbps,
+                   speeds[i].extract_gbps);
+        else
+            printf("LSB %-7s : %s scalar, embed %.2f GB/s, extract %.2f GB/s of carrier%s\n", results[i].name,
+                   results[i].matches ? "matches" : "DIFFERS FROM", speeds[i].embed_gbps, speeds[i].extract_gbps,
+                   results[i].selected ? " (selected)" : "");
+    }
+    if (json)
+        printf("]");
+}
+
+Status run_bench(const BenchConfig *config)
+{
+    unsigned char header[54];
+    uint64_t carrier_size;
+    make_header(config->width, config->height, header, &carrier_size);
+    BmpInfo bmp;
+    if (config->width == 0 || config->height == 0 || config->height > 0x7fffffff ||
+        bmp_parse_header(header, sizeof(header), &bmp) == e_failure)
+    {
+        fprintf(stderr, "Invalid carrier size %ux%u\n", config->width, config->height);
+        return e_failure;
+    }
+    uint64_t fits = steg_max_payload(&bmp, 4, config->depth);
+    if (config->checksum)
+        fits = fits > STEG_CHECKSUM_SIZE ? fits - STEG_CHECKSUM_SIZE : 0;
+    if (config->ecc)
+        fits = fits / ECC_SYMBOLS * (ECC_SYMBOLS - config->ecc);
+    uint64_t secret_size = config->secret_size >= 0 ? (uint64_t)config->secret_size : fits / 10 * 9;
+
+    int fds[BENCH_FILES];
+    static const char *names[BENCH_FILES] = {"carrier", "secret", "stego", "decoded", "ref-stego", "ref-decoded"};
+    Status status = e_success;
+    for (int i = 0; i < BENCH_FILES; i++)
+    {
+        fds[i] = status == e_success ? scratch_file(config->dir, names[i]) : -1;
+        if (fds[i] < 0 && status == e_success)
+        {
+            perror(config->dir ? config->dir : "memfd_create");
+            status = e_failure;
+        }
+    }
+    if (status == e_success &&
+        (fill_random(fds[0], carrier_size, 0x9E3779B97F4A7C15ULL, header, sizeof(header)) == e_failure ||
+         fill_random(fds[1], secret_size, 0xD1B54A32D192ED03ULL, NULL, 0) == e_failure))
+    {
+        perror("Generating the benchmark data");
+        status = e_failure;
+    }
+
+    Stats *encode_runs = calloc(config->runs, sizeof(Stats));
+    Stats *decode_runs = calloc(config->runs, sizeof(Stats));
+    Stats *ref_encode_runs = config->reference ? calloc(config->runs, sizeof(Stats)) : NULL;
+    Stats *ref_decode_runs = config->reference ? calloc(config->runs, sizeof(Stats)) : NULL;
+    if (encode_runs == NULL || decode_runs == NULL || (config->reference && (!ref_encode_runs || !ref_decode_runs)))
+        status = e_failure;
+    LsbKernelResult kernels[4];
+    KernelSpeed kernel_speeds[4];
+    int kernel_count = status == e_success ? lsb_check_kernels(kernels, 4) : 0;
+    time_kernels(kernels, kernel_count, kernel_speeds);
+    for (int i = 0; i < kernel_count; i++)
+    {
+        if (!kernels[i].matches)
+        {
+            fprintf(stderr, "LSB kernel %s doesn't match the scalar one\n", kernels[i].name);
+            status = e_failure;
+        }
+    }
+
+    uint64_t payload_bytes = 0, decoded_bytes = 0;
+    for (int run = 0; run < config->runs && status == e_success; run++)
+    {
+        if (bench_encode(config, fds, &encode_runs[run], &payload_bytes) == e_failure ||
+            bench_decode(config, fds, &decode_runs[run], &decoded_bytes) == e_failure)
+        {
+            fprintf(stderr, "Benchmark run %d failed (does a %llu byte secret fit?)\n", run + 1,
+                    (unsigned long long)secret_size);
+            status = e_failure;
+        }
+        else if (run == 0 && same_contents(fds[1], fds[3]) == e_failure)
+        {
+            fprintf(stderr, "Benchmark decode doesn't match the secret\n");
+            status = e_failure;
+        }
+    }
+
+    // The block path's header, the reference writes the same one
+    unsigned char steg_header[STEG_MAX_HEADER];
+    size_t steg_header_size = steg_write_header(steg_header, STEG_HEADER_V2, ".txt", 1,
+                                                config->checksum ? STEG_FLAG_CHECKSUM : 0, 0, secret_size);
+    for (int run = 0; config->reference && run < config->runs && status == e_success; run++)
+    {
+        if (reference_encode(fds, &bmp, steg_header, steg_header_size, config->checksum,
+                             &ref_encode_runs[run]) == e_failure ||
+            reference_decode(fds, &bmp, steg_header, steg_header_size, secret_size, &ref_decode_runs[run]) == e_failure)
+        {
+            fprintf(stderr, "Reference run %d failed\n", run + 1);
+            status = e_failure;
+        }
+        else if (run == 0 && (same_contents(fds[2], fds[4]) == e_failure || same_contents(fds[1], fds[5]) == e_failure))
+        {
+            fprintf(stderr, "Per-byte reference doesn't match the block path\n");
+            status = e_failure;
+        }
+    }
+
+    if (status == e_success)
+    {
+        int flags = (config->compress ? STEG_FLAG_COMPRESSED : 0) | (config->encrypt ? STEG_FLAG_ENCRYPTED : 0) |
+                    (config->checksum ? STEG_FLAG_CHECKSUM : 0) | (config->ecc ? STEG_FLAG_ECC : 0);
+        if (config->json)
+        {
+            printf("{\"carrier\": {\"width\": %u, \"height\": %u, \"bpp\": 24, \"bytes\": %llu}, \"storage\": \"%s\", "
+                   "\"secret_bytes\": %llu, \"depth\": %d, \"flags\": %d, \"io\": \"%s\", \"threads\": %d, \"runs\": %d",
+                   config->width, config->height, (unsigned long long)carrier_size, config->dir ? config->dir : "memfd",
+                   (unsigned long long)secret_size, config->depth, flags, io_name(config->io_mode), config->threads,
+                   config->runs);
+        }
+        else
+        {
+            printf("Carrier     : %ux%u 24 bpp, %llu bytes in %s\n", config->width, config->height,
+                   (unsigned long long)carrier_size, config->dir ? config->dir : "memfd");
+            printf("Secret      : %llu bytes at depth %d, flags 0x%02x, %s I/O, %d thread%s\n",
+                   (unsigned long long)secret_size, config->depth, flags, io_name(config->io_mode), config->threads,
+                   config->threads == 1 ? "" : "s");
+        }
+        print_kernels(kernels, kernel_speeds, kernel_count, config->json);
+        print_runs("encode", encode_runs, config->runs, payload_bytes, config->json);
+        print_runs("decode", decode_runs, config->runs, decoded_bytes, config->json);
+        if (config->reference)
+        {
+            print_runs("ref_encode", ref_encode_runs, config->runs, secret_size, config->json);
+            print_runs("ref_decode", ref_decode_runs, config->runs, secret_size, config->json);
+            // print_runs() sorted every run list, so the medians sit in the middle
+            double encode_ms = stats_total(&encode_runs[config->runs / 2]);
+            double decode_ms = stats_total(&decode_runs[config->runs / 2]);
+            if (!config->json)
+                printf("\nBlock path  : encode %.1fx, decode %.1fx the speed of the per-byte reference\n",
+                       stats_total(&ref_encode_runs[config->runs / 2]) / encode_ms,
+                       stats_total(&ref_decode_runs[config->runs / 2]) / decode_ms);
+        }
+        if (config->json)
+            printf("}\n");
+    }
+
+    free(encode_runs);
+    free(decode_runs);
+    free(ref_encode_runs);
+    free(ref_decode_runs);
+    for (int i = 0; i < BENCH_FILES; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    return status;
+}
@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+
+/*
+ * Benchmark mode (-B)
+ * Builds a synthetic 24 bpp carrier of the given size and a random
+ * secret, in memory (memfd) or as unlinked files in a directory, then
+ * runs the normal encode and decode on them `runs` times with the
+ * per-stage timers of stats.h. Generating the data is not timed. The
+ * first decode is checked against the secret, and every LSB kernel the
+ * CPU can run against the scalar one, each with its own speed.
+ * With reference set the per-byte stdio loop the block path replaced
+ * runs as well (depth 1, checksum only), its first stego image and
+ * decode checked against the block path's.
+ */
+typedef struct _BenchConfig
+{
+    unsigned width, height;     // Carrier size in pixels
+    long long secret_size;      // Payload bytes, -1 for 90% of what fits
+    int depth;
+    IoMode io_mode;
+    int threads;
+    int compress, encrypt, checksum;
+    int ecc;                    // Parity bytes per codeword, 0 for none
+    const char *passphrase;
+    const char *dir;            // Put the files here (tmpfs, disk), NULL for memfd
+    int runs;
+    int json;                   // One JSON object instead of the tables
+    int reference;              // Also time the per-byte reference
+} BenchConfig;
+
+Status run_bench(const BenchConfig *config);
+
+#endif
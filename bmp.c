@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+
+/* Little endian field readers */
+static uint read_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint read_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+}
+
+/* BMP compression types we can embed into */
+#define BMP_BI_RGB 0
+#define BMP_BI_BITFIELDS 3
+#define BMP_BI_ALPHABITFIELDS 6
+
+Status bmp_parse_header(const unsigned char *header, size_t size, BmpInfo *bmp)
+{
+    memset(bmp, 0, sizeof(*bmp));
+    if (size < BMP_FILE_HEADER_SIZE + 4 || header[0] != 'B' || header[1] != 'M')
+        return e_failure;
+
+    bmp->pixel_offset = read_le32(header + 10);
+    bmp->dib_header_size = read_le32(header + 14);
+    if (size < BMP_FILE_HEADER_SIZE + (bmp->dib_header_size < 40 ? bmp->dib_header_size : 40))
+        return e_failure;
+
+    uint compression = BMP_BI_RGB;
+    long long height;
+    if (bmp->dib_header_size == 12)
+    {
+        // BITMAPCOREHEADER: 16 bit unsigned dimensions
+        bmp->width = read_le16(header + 18);
+        height = read_le16(header + 20);
+        bmp->bits_per_pixel = read_le16(header + 24);
+    }
+    else if (bmp->dib_header_size >= 40)
+    {
+        // BITMAPINFOHEADER and its V2..V5 extensions share the first 40 bytes
+        bmp->width = read_le32(header + 18);
+        height = (int)read_le32(header + 22);
+        bmp->bits_per_pixel = read_le16(header + 28);
+        compression = read_le32(header + 30);
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    if ((int)bmp->width <= 0 || height == 0)
+        return e_failure;
+    bmp->top_down = height < 0;
+    bmp->height = height < 0 ? -height : height;
+
+    if (bmp->bits_per_pixel == 24 && compression == BMP_BI_RGB)
+    {
+        bmp->bytes_per_pixel = 3;
+    }
+    else if (bmp->bits_per_pixel == 32 &&
+             (compression == BMP_BI_RGB || compression == BMP_BI_BITFIELDS || compression == BMP_BI_ALPHABITFIELDS))
+    {
+        // Colour must sit in bytes 0..2 of the pixel, byte 3 is alpha/unused
+        if (compression != BMP_BI_RGB)
+        {
+            if (size < 66)
+                return e_failure;
+            uint colour = read_le32(header + 54) | read_le32(header + 58) | read_le32(header + 62);
+            if (colour != 0x00FFFFFF)
+                return e_failure;
+        }
+        bmp->bytes_per_pixel = 4;
+    }
+    else
+    {
+        // Palette, 16 bit and compressed images can't take LSB changes
+        return e_failure;
+    }
+
+    bmp->row_bytes = (uint64_t)bmp->width * bmp->bytes_per_pixel;
+    bmp->row_stride = (bmp->row_bytes + 3) & ~(uint64_t)3;
+    bmp->pixel_size = bmp->row_stride * bmp->height;
+    bmp->capacity = (uint64_t)bmp->width * bmp->height * 3;
+    bmp->contiguous = bmp->bytes_per_pixel == 3 && bmp->row_stride == bmp->row_bytes;
+
+    if (bmp->pixel_offset < BMP_FILE_HEADER_SIZE + bmp->dib_header_size ||
+        bmp->pixel_offset > BMP_MAX_HEADER_SIZE)
+        return e_failure;
+    return e_success;
+}
+
+size_t bmp_header_size(const unsigned char *file_header)
+{
+    if (file_header[0] != 'B' || file_header[1] != 'M')
+        return 0;
+    uint pixel_offset = read_le32(file_header + 10);
+    if (pixel_offset < BMP_FILE_HEADER_SIZE + 12 || pixel_offset > BMP_MAX_HEADER_SIZE)
+        return 0;
+    return pixel_offset;
+}
+
+void bmp_use_legacy_layout(BmpInfo *bmp)
+{
+    // The pixel array holds at least width * height * 3 bytes in any layout
+    bmp->contiguous = 1;
+}
+
+uint64_t bmp_carrier_offset(const BmpInfo *bmp, uint64_t index)
+{
+    if (bmp->contiguous)
+        return bmp->pixel_offset + index;
+
+    uint64_t row_channels = (uint64_t)bmp->width * 3;
+    uint64_t row = index / row_channels;
+    uint64_t column = index % row_channels;
+    if (bmp->bytes_per_pixel == 4)
+        column = column / 3 * 4 + column % 3;
+    return bmp->pixel_offset + row * bmp->row_stride + column;
+}
+
+uint64_t bmp_carrier_run(const BmpInfo *bmp, uint64_t index)
+{
+    if (bmp->contiguous)
+        return bmp->capacity - index;
+    if (bmp->bytes_per_pixel == 4)
+        return 3 - index % 3;
+    return (uint64_t)bmp->width * 3 - index % ((uint64_t)bmp->width * 3);
+}
+
+uint64_t bmp_span_end(const BmpInfo *bmp, uint64_t index, uint64_t count)
+{
+    if (count == 0)
+        return bmp_carrier_offset(bmp, index);
+    return bmp_carrier_offset(bmp, index + count - 1) + 1;
+}
+
+void bmp_gather(const BmpInfo *bmp, const unsigned char *raw, uint64_t raw_offset,
+                uint64_t index, size_t count, unsigned char *out)
+{
+    while (count > 0)
+    {
+        uint64_t run = bmp_carrier_run(bmp, index);
+        size_t n = run < count ? run : count;
+        memcpy(out, raw + (bmp_carrier_offset(bmp, index) - raw_offset), n);
+        out += n;
+        index += n;
+        count -= n;
+    }
+}
+
+void bmp_scatter(const BmpInfo *bmp, unsigned char *raw, uint64_t raw_offset,
+                 uint64_t index, size_t count, const unsigned char *in)
+{
+    while (count > 0)
+    {
+        uint64_t run = bmp_carrier_run(bmp, index);
+        size_t n = run < count ? run : count;
+        memcpy(raw + (bmp_carrier_offset(bmp, index) - raw_offset), in, n);
+        in += n;
+        index += n;
+        count -= n;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+
+/* BITMAPFILEHEADER size, the DIB header follows it */
+#define BMP_FILE_HEADER_SIZE 14
+
+/* Largest bfOffBits we accept (headers, palette and gap before pixels) */
+#define BMP_MAX_HEADER_SIZE (1 << 20)
+
+/*
+ * Pixel span descriptor of a BMP image
+ * Payload bits go into the colour bytes of the pixel array only, in file
+ * order: row padding and the alpha/unused byte of 32 bpp pixels are
+ * skipped. A "carrier index" numbers these usable bytes from 0. Images
+ * with a legacy (version 0/1) stego header use the raw layout of the
+ * first builds instead, see bmp_use_legacy_layout().
+ */
+typedef struct _BmpInfo
+{
+    uint64_t pixel_offset;      // bfOffBits, start of the pixel array
+    uint dib_header_size;       // 12 (CORE), 40 (INFO), 108 (V4), 124 (V5)
+    uint width;                 // Pixels per row
+    uint height;                // Rows
+    int top_down;               // Rows stored top to bottom (negative height)
+    uint bits_per_pixel;        // 24 or 32
+    uint bytes_per_pixel;       // 3 or 4
+    uint64_t row_bytes;         // width * bytes_per_pixel
+    uint64_t row_stride;        // row_bytes padded to a multiple of 4
+    uint64_t pixel_size;        // row_stride * height
+    uint64_t capacity;          // Usable carrier bytes (3 per pixel)
+    int contiguous;             // Usable bytes form a single run
+} BmpInfo;
+
+/* Parse the headers in buffer (at least 14 + DIB header bytes) */
+Status bmp_parse_header(const unsigned char *header, size_t size, BmpInfo *bmp);
+
+/*
+ * bfOffBits of the BITMAPFILEHEADER in file_header (14 bytes), the size
+ * of everything in front of the pixel array; 0 when it isn't a BMP or
+ * that is out of bounds
+ */
+size_t bmp_header_size(const unsigned char *file_header);
+
+/*
+ * Take the pixel array as one run of bytes from bfOffBits, padding and
+ * alpha bytes included, the way legacy stego headers and payloads were
+ * embedded. The capacity stays width * height * 3 bytes.
+ */
+void bmp_use_legacy_layout(BmpInfo *bmp);
+
+/* File offset of usable carrier byte index */
+uint64_t bmp_carrier_offset(const BmpInfo *bmp, uint64_t index);
+
+/* Usable bytes stored back to back starting at index */
+uint64_t bmp_carrier_run(const BmpInfo *bmp, uint64_t index);
+
+/* File offset just past the last of count usable bytes starting at index */
+uint64_t bmp_span_end(const BmpInfo *bmp, uint64_t index, uint64_t count);
+
+/*
+ * Copy count usable bytes starting at index out of raw file bytes
+ * (raw[0] is the byte at file offset raw_offset), and back again
+ */
+void bmp_gather(const BmpInfo *bmp, const unsigned char *raw, uint64_t raw_offset,
+                uint64_t index, size_t count, unsigned char *out);
+void bmp_scatter(const BmpInfo *bmp, unsigned char *raw, uint64_t raw_offset,
+                 uint64_t index, size_t count, const unsigned char *in);
+
+#endif
@@ -0,0 +1,29 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bmpio.h"
+
+Status bmp_read_header(FILE *fptr, unsigned char **header, size_t *header_size, BmpInfo *bmp)
+{
+    unsigned char file_header[BMP_FILE_HEADER_SIZE];
+    *header = NULL;
+    if (fread(file_header, 1, sizeof(file_header), fptr) != sizeof(file_header))
+        return e_failure;
+    size_t pixel_offset = bmp_header_size(file_header);
+    if (pixel_offset == 0)
+        return e_failure;
+
+    unsigned char *buffer = malloc(pixel_offset);
+    if (buffer == NULL)
+        return e_failure;
+    memcpy(buffer, file_header, sizeof(file_header));
+    size_t rest = pixel_offset - sizeof(file_header);
+    if (fread(buffer + sizeof(file_header), 1, rest, fptr) != rest ||
+        bmp_parse_header(buffer, pixel_offset, bmp) == e_failure)
+    {
+        free(buffer);
+        return e_failure;
+    }
+    *header = buffer;
+    *header_size = pixel_offset;
+    return e_success;
+}
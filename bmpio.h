@@ -0,0 +1,17 @@
+#ifndef BMPIO_H
+#define BMPIO_H
+
+#include <stdio.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Stream side of bmp.h, kept out of libsteg.a so the in-memory library
+ * links no stdio.
+ * Read everything in front of the pixel array from fptr (positioned at
+ * the start of the file) into a malloc'd buffer and parse it. fptr is
+ * left at the first pixel byte, so this also works on pipes.
+ */
+Status bmp_read_header(FILE *fptr, unsigned char **header, size_t *header_size, BmpInfo *bmp);
+
+#endif
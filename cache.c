@@ -0,0 +1,246 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+struct _CarrierEntry
+{
+    dev_t dev;                  // The file as fstat() saw it when it was read
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    unsigned char *header;      // Points into image when that is kept
+    size_t header_size;
+    BmpInfo bmp;
+    unsigned char *image;
+    size_t image_size;
+    size_t cost;                // Bytes counted against the budget
+    int refs;                   // Carriers handed out, plus one while listed
+    CarrierEntry *prev;
+    CarrierEntry *next;
+};
+
+static int same_time(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* Unchanged since the entry was read */
+static int same_file(const CarrierEntry *entry, const struct stat *st)
+{
+    return entry->size == st->st_size && same_time(&entry->mtime, &st->st_mtim) &&
+           same_time(&entry->ctime, &st->st_ctim);
+}
+
+static void unlink_entry(CarrierCache *cache, CarrierEntry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_front(CarrierCache *cache, CarrierEntry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+}
+
+static void free_entry(CarrierEntry *entry)
+{
+    if (entry->image == NULL)
+        free(entry->header);
+    free(entry->image);
+    free(entry);
+}
+
+/* Take a listed entry off the list, it lives on while carriers hold it (lock held) */
+static void drop_entry(CarrierCache *cache, CarrierEntry *entry)
+{
+    unlink_entry(cache, entry);
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->cost;
+    cache->stats.evictions++;
+    if (--entry->refs == 0)
+        free_entry(entry);
+}
+
+static CarrierEntry *find_entry(CarrierCache *cache, dev_t dev, ino_t ino)
+{
+    CarrierEntry *entry = cache->head;
+    while (entry != NULL && (entry->dev != dev || entry->ino != ino))
+        entry = entry->next;
+    return entry;
+}
+
+static Status read_at(int fd, unsigned char *buffer, size_t n, off_t offset)
+{
+    while (n > 0)
+    {
+        ssize_t got = pread(fd, buffer, n, offset);
+        if (got <= 0)
+            return e_failure;
+        buffer += got;
+        n -= got;
+        offset += got;
+    }
+    return e_success;
+}
+
+/* Read the header, and the whole file when it fits the budget, into a new entry */
+static CarrierEntry *read_carrier(int fd, const struct stat *st, size_t budget)
+{
+    unsigned char file_header[BMP_FILE_HEADER_SIZE];
+    if (read_at(fd, file_header, sizeof(file_header), 0) == e_failure)
+        return NULL;
+    size_t header_size = bmp_header_size(file_header);
+    if (header_size == 0 || (uint64_t)st->st_size < header_size)
+        return NULL;
+
+    int whole = (uint64_t)st->st_size + sizeof(CarrierEntry) <= budget;
+    size_t n = whole ? (size_t)st->st_size : header_size;
+    CarrierEntry *entry = calloc(1, sizeof(CarrierEntry));
+    unsigned char *data = malloc(n);
+    if (entry == NULL || data == NULL || read_at(fd, data, n, 0) == e_failure ||
+        bmp_parse_header(data, header_size, &entry->bmp) == e_failure)
+    {
+        free(entry);
+        free(data);
+        return NULL;
+    }
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->ctime = st->st_ctim;
+    entry->header = data;
+    entry->header_size = header_size;
+    entry->image = whole ? data : NULL;
+    entry->image_size = whole ? n : 0;
+    entry->cost = n + sizeof(CarrierEntry);
+    return entry;
+}
+
+/* List a freshly read entry and evict from the tail down to the budget (lock held) */
+static void insert_entry(CarrierCache *cache, CarrierEntry *entry)
+{
+    if (entry->cost > cache->budget)
+        return;
+    // Another thread may have read the same carrier meanwhile, or an older version of it
+    CarrierEntry *old = find_entry(cache, entry->dev, entry->ino);
+    if (old != NULL && old->size == entry->size && same_time(&old->mtime, &entry->mtime) &&
+        same_time(&old->ctime, &entry->ctime))
+        return;
+    if (old != NULL)
+        drop_entry(cache, old);
+
+    push_front(cache, entry);
+    entry->refs++;
+    cache->stats.entries++;
+    cache->stats.bytes += entry->cost;
+    while (cache->stats.bytes > cache->budget)
+        drop_entry(cache, cache->tail);
+}
+
+Status carrier_cache_init(CarrierCache *cache, size_t budget)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+    return pthread_mutex_init(&cache->lock, NULL) == 0 ? e_success : e_failure;
+}
+
+void carrier_cache_free(CarrierCache *cache)
+{
+    while (cache->head != NULL)
+    {
+        CarrierEntry *entry = cache->head;
+        unlink_entry(cache, entry);
+        if (--entry->refs == 0)
+            free_entry(entry);
+    }
+    pthread_mutex_destroy(&cache->lock);
+}
+
+Status carrier_cache_get(CarrierCache *cache, int fd, Carrier *carrier)
+{
+    memset(carrier, 0, sizeof(*carrier));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return e_failure;
+
+    pthread_mutex_lock(&cache->lock);
+    CarrierEntry *entry = find_entry(cache, st.st_dev, st.st_ino);
+    if (entry != NULL && !same_file(entry, &st))
+    {
+        drop_entry(cache, entry);
+        entry = NULL;
+    }
+    if (entry != NULL)
+    {
+        unlink_entry(cache, entry);
+        push_front(cache, entry);
+        entry->refs++;
+        if (entry->image != NULL)
+            cache->stats.hits++;
+        else
+            cache->stats.header_hits++;
+    }
+    else
+    {
+        cache->stats.misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    // Read outside the lock, so other carriers are served meanwhile
+    if (entry == NULL)
+    {
+        entry = read_carrier(fd, &st, cache->budget);
+        if (entry == NULL)
+            return e_failure;
+        entry->refs = 1;
+        pthread_mutex_lock(&cache->lock);
+        insert_entry(cache, entry);
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    carrier->header = entry->header;
+    carrier->header_size = entry->header_size;
+    carrier->bmp = entry->bmp;
+    carrier->image = entry->image;
+    carrier->image_size = entry->image_size;
+    carrier->entry = entry;
+    return e_success;
+}
+
+void carrier_cache_release(CarrierCache *cache, Carrier *carrier)
+{
+    CarrierEntry *entry = carrier->entry;
+    if (entry == NULL)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    int last = --entry->refs == 0;
+    pthread_mutex_unlock(&cache->lock);
+    if (last)
+        free_entry(entry);
+    memset(carrier, 0, sizeof(*carrier));
+}
+
+void carrier_cache_stats(CarrierCache *cache, CarrierCacheStats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,83 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Carrier cache
+ * Keeps what reading a carrier yields, for a process that embeds into
+ * the same few cover images over and over (batch mode, or a library
+ * caller): the BMP header bytes and their parsed BmpInfo, and the whole
+ * file image as long as it fits the memory budget. A hit on the image
+ * reads nothing from the carrier at all, a hit on the header alone
+ * skips reading and parsing the header.
+ *
+ * Carriers are known by the device, inode, size and modification and
+ * change times of the open file, so a file written to or replaced under
+ * the same path is read afresh. When the budget runs out the least
+ * recently used carriers are dropped; a carrier handed out stays valid
+ * until it is released. One cache may be shared by any number of
+ * threads.
+ */
+
+/* Memory budget batch mode starts with */
+#define CARRIER_CACHE_DEFAULT_BUDGET ((size_t)64 << 20)
+
+typedef struct _CarrierEntry CarrierEntry;
+
+/* Counters since carrier_cache_init() */
+typedef struct _CarrierCacheStats
+{
+    uint64_t hits;              // Lookups served with the file image
+    uint64_t header_hits;       // Lookups served with the header alone
+    uint64_t misses;            // Lookups that had to read the carrier
+    uint64_t evictions;         // Entries dropped for the budget or a changed file
+    uint64_t entries;           // Carriers held now
+    uint64_t bytes;             // Memory they take
+} CarrierCacheStats;
+
+typedef struct _CarrierCache
+{
+    size_t budget;              // Bytes of headers and images to keep at most
+    CarrierEntry *head;         // Most recently used first
+    CarrierEntry *tail;
+    CarrierCacheStats stats;
+    pthread_mutex_t lock;
+} CarrierCache;
+
+/* A carrier handed out by carrier_cache_get(), valid until carrier_cache_release() */
+typedef struct _Carrier
+{
+    const unsigned char *header;    // Everything in front of the pixel array
+    size_t header_size;             // bfOffBits
+    BmpInfo bmp;
+    const unsigned char *image;     // The whole file, NULL when only the header is kept
+    size_t image_size;
+    CarrierEntry *entry;
+} Carrier;
+
+/* Empty cache that keeps up to budget bytes */
+Status carrier_cache_init(CarrierCache *cache, size_t budget);
+
+/* Drop every entry, carriers still handed out must have been released */
+void carrier_cache_free(CarrierCache *cache);
+
+/*
+ * Look up the carrier open as fd, reading it (by pread, the file
+ * position is left alone) on a miss. e_failure if fd isn't a regular
+ * file, can't be read or isn't a BMP we can embed into; nothing is
+ * cached then.
+ */
+Status carrier_cache_get(CarrierCache *cache, int fd, Carrier *carrier);
+
+/* Hand a carrier back, it may be freed from here on */
+void carrier_cache_release(CarrierCache *cache, Carrier *carrier);
+
+/* Snapshot of the counters */
+void carrier_cache_stats(CarrierCache *cache, CarrierCacheStats *stats);
+
+#endif
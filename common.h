@@ -4,4 +4,77 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/*
+ * The 32-bit extension size field doubles as a format word:
+ * bits 0-7 hold the extension length, bits 8-11 the payload bits per
+ * carrier byte (0 in legacy images, meaning 1), bits 16-23 the payload
+ * flags and bits 24-31 the header version. Everything up to and
+ * including the size field is always stored 1 bit per carrier byte.
+ */
+#define STEG_EXTN_LEN_MASK 0xFF
+#define STEG_DEPTH_SHIFT 8
+#define STEG_DEPTH_MASK 0xF
+#define STEG_FLAGS_SHIFT 16
+#define STEG_FLAGS_MASK 0xFF
+#define STEG_VERSION_SHIFT 24
+#define STEG_VERSION_MASK 0xFF
+
+/*
+ * Header versions: 0 (legacy) stores the payload size in 32 bits,
+ * 1 in 64 bits. Version 0 is written whenever the size fits.
+ *
+ * Version 2 is the compact layout written by default. Its version byte
+ * sits where the top byte of the legacy extension size word does, so
+ * one reader tells them apart:
+ *   magic, version (1 byte),
+ *   varint format word (bits 0-1: log2 of the depth, bits 2-: flags),
+ *   varint parity bytes per codeword (only with STEG_FLAG_ECC),
+ *   varint extension length, extension, varint payload size,
+ *   2 byte big endian header check (low 16 bits of the CRC32C of
+ *   everything before it)
+ * Varints are LEB128: 7 bits per byte, low group first.
+ */
+#define STEG_HEADER_V0 0
+#define STEG_HEADER_V1 1
+#define STEG_HEADER_V2 2
+
+#define STEG_V2_DEPTH_MASK 0x3
+#define STEG_V2_FLAGS_SHIFT 2
+#define STEG_V2_CHECK_SIZE 2
+
+/*
+ * Payload flags: the stored payload is the lz.h compressed stream,
+ * sealed with seal.h (compression is applied first), laid out in
+ * keyed scatter.h tiles instead of straight after the header,
+ * followed by a STEG_CHECKSUM_SIZE byte big endian CRC32C of itself
+ * (stored like one more payload chunk), a directory.h container of
+ * several files rather than one, or the ecc.h Reed-Solomon codewords
+ * of the (compressed, sealed) stream. Only version 2 headers have room
+ * for the parity count of STEG_FLAG_ECC.
+ */
+#define STEG_FLAG_COMPRESSED 0x01
+#define STEG_FLAG_ENCRYPTED 0x02
+#define STEG_FLAG_SCATTERED 0x04
+#define STEG_FLAG_CHECKSUM 0x08
+#define STEG_FLAG_DIRECTORY 0x10
+#define STEG_FLAG_ECC 0x20
+
+#define STEG_CHECKSUM_SIZE 4
+
+/* Flags this build can undo */
+#define STEG_KNOWN_FLAGS (STEG_FLAG_COMPRESSED | STEG_FLAG_ENCRYPTED | STEG_FLAG_SCATTERED | STEG_FLAG_CHECKSUM | \
+                          STEG_FLAG_DIRECTORY | STEG_FLAG_ECC)
+
+/* Size of the carrier blocks moved per fread/fwrite call (1 MiB) */
+#define STEG_BLOCK_SIZE (1 << 20)
+
+/* Secret bytes embedded per carrier block (one carrier byte per bit) */
+#define STEG_SECRET_CHUNK (STEG_BLOCK_SIZE / 8)
+
+/* Secret bytes per unit of work handed to a thread (-j) */
+#define STEG_PARALLEL_GRAIN 4096
+
+/* Room for the error message a quiet (batch) run keeps instead of printing it */
+#define STEG_ERROR_SIZE 160
+
 #endif
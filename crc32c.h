@@ -0,0 +1,22 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli), the payload checksum of --checksum
+ * Uses the SSE4.2 crc32 instruction when the CPU has it (picked at
+ * runtime like lsb.c), a table otherwise. Calls chain like zlib's
+ * crc32(): start from 0 and pass the previous result back in.
+ */
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n);
+
+/* CRC of A followed by B, from the CRCs of A and B and the length of B */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+/* Name of the kernel selected for this CPU */
+const char *crc32c_kernel_name(void);
+
+#endif
@@ -0,0 +1,657 @@
+#include <stdint.h>
+#include <string.h>
+#include "crypto.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRYPTO_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Little endian helpers */
+static inline uint32_t load_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_le32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline uint64_t load_le64(const unsigned char *p)
+{
+    return load_le32(p) | ((uint64_t)load_le32(p + 4) << 32);
+}
+
+static inline void store_le64(unsigned char *p, uint64_t v)
+{
+    store_le32(p, (uint32_t)v);
+    store_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+void secure_wipe(void *p, size_t n)
+{
+    volatile unsigned char *bytes = p;
+    while (n--)
+        *bytes++ = 0;
+}
+
+/* ChaCha20 */
+
+#define CHACHA20_BLOCK 64
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)                          \
+    do                                                     \
+    {                                                      \
+        a += b; d ^= a; d = ROTL32(d, 16);                 \
+        c += d; b ^= c; b = ROTL32(b, 12);                 \
+        a += b; d ^= a; d = ROTL32(d, 8);                  \
+        c += d; b ^= c; b = ROTL32(b, 7);                  \
+    } while (0)
+
+static void chacha20_setup(uint32_t state[16], const unsigned char *key, const unsigned char *nonce, uint32_t counter)
+{
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++)
+        state[4 + i] = load_le32(key + 4 * i);
+    state[12] = counter;
+    for (int i = 0; i < 3; i++)
+        state[13 + i] = load_le32(nonce + 4 * i);
+}
+
+static void chacha20_block(const uint32_t state[16], unsigned char out[CHACHA20_BLOCK])
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+        store_le32(out + 4 * i, x[i] + state[i]);
+}
+
+/* Scalar kernel: one block at a time, handles the tail */
+static void xor_scalar(uint32_t state[16], const unsigned char *in, size_t n, unsigned char *out)
+{
+    unsigned char stream[CHACHA20_BLOCK];
+    while (n > 0)
+    {
+        size_t len = n < CHACHA20_BLOCK ? n : CHACHA20_BLOCK;
+        chacha20_block(state, stream);
+        for (size_t i = 0; i < len; i++)
+            out[i] = in[i] ^ stream[i];
+        state[12]++;
+        in += len;
+        out += len;
+        n -= len;
+    }
+    secure_wipe(stream, sizeof(stream));
+}
+
+#ifdef CRYPTO_HAVE_X86
+
+/*
+ * SIMD kernels keep word i of 4 (SSE2) or 8 (AVX2) consecutive blocks
+ * in one register, run the rounds on all of them at once and transpose
+ * the result back into block order before the XOR.
+ */
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define SSE2_QR(a, b, c, d)                                                         \
+    do                                                                              \
+    {                                                                               \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 16);     \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12);     \
+        a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 8);      \
+        c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 7);      \
+    } while (0)
+
+/* 4 blocks per 256 bytes */
+__attribute__((target("sse2")))
+static void xor_sse2(uint32_t state[16], const unsigned char *in, size_t n, unsigned char *out)
+{
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    for (; n >= 4 * CHACHA20_BLOCK; n -= 4 * CHACHA20_BLOCK)
+    {
+        __m128i s[16], x[16];
+        for (int i = 0; i < 16; i++)
+            s[i] = _mm_set1_epi32((int)state[i]);
+        s[12] = _mm_add_epi32(s[12], lanes);
+        memcpy(x, s, sizeof(x));
+        for (int i = 0; i < 10; i++)
+        {
+            SSE2_QR(x[0], x[4], x[8], x[12]);
+            SSE2_QR(x[1], x[5], x[9], x[13]);
+            SSE2_QR(x[2], x[6], x[10], x[14]);
+            SSE2_QR(x[3], x[7], x[11], x[15]);
+            SSE2_QR(x[0], x[5], x[10], x[15]);
+            SSE2_QR(x[1], x[6], x[11], x[12]);
+            SSE2_QR(x[2], x[7], x[8], x[13]);
+            SSE2_QR(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++)
+            x[i] = _mm_add_epi32(x[i], s[i]);
+
+        // Each group of 4 words becomes 16 bytes of each of the 4 blocks
+        for (int g = 0; g < 4; g++)
+        {
+            __m128i t0 = _mm_unpacklo_epi32(x[4 * g], x[4 * g + 1]);
+            __m128i t1 = _mm_unpackhi_epi32(x[4 * g], x[4 * g + 1]);
+            __m128i t2 = _mm_unpacklo_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m128i t3 = _mm_unpackhi_epi32(x[4 * g + 2], x[4 * g + 3]);
+            __m128i rows[4] = {
+                _mm_unpacklo_epi64(t0, t2), _mm_unpackhi_epi64(t0, t2),
+                _mm_unpacklo_epi64(t1, t3), _mm_unpackhi_epi64(t1, t3)
+            };
+            for (int b = 0; b < 4; b++)
+            {
+                size_t at = b * CHACHA20_BLOCK + g * 16;
+                __m128i data = _mm_loadu_si128((const __m128i *)(in + at));
+                _mm_storeu_si128((__m128i *)(out + at), _mm_xor_si128(data, rows[b]));
+            }
+        }
+        state[12] += 4;
+        in += 4 * CHACHA20_BLOCK;
+        out += 4 * CHACHA20_BLOCK;
+    }
+    xor_scalar(state, in, n, out);
+}
+
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define AVX2_QR(a, b, c, d)                                                                   \
+    do                                                                                        \
+    {                                                                                         \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 12);         \
+        a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8); \
+        c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 7);          \
+    } while (0)
+
+/* 8 blocks per 512 bytes, byte-aligned rotations go through pshufb */
+__attribute__((target("avx2")))
+static void xor_avx2(uint32_t state[16], const unsigned char *in, size_t n, unsigned char *out)
+{
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    for (; n >= 8 * CHACHA20_BLOCK; n -= 8 * CHACHA20_BLOCK)
+    {
+        __m256i s[16], x[16];
+        for (int i = 0; i < 16; i++)
+            s[i] = _mm256_set1_epi32((int)state[i]);
+        s[12] = _mm256_add_epi32(s[12], lanes);
+        memcpy(x, s, sizeof(x));
+        for (int i = 0; i < 10; i++)
+        {
+            AVX2_QR(x[0], x[4], x[8], x[12]);
+            AVX2_QR(x[1], x[5], x[9], x[13]);
+            AVX2_QR(x[2], x[6], x[10], x[14]);
+            AVX2_QR(x[3], x[7], x[11], x[15]);
+            AVX2_QR(x[0], x[5], x[10], x[15]);
+            AVX2_QR(x[1], x[6], x[11], x[12]);
+            AVX2_QR(x[2], x[7], x[8], x[13]);
+            AVX2_QR(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++)
+            x[i] = _mm256_add_epi32(x[i], s[i]);
+
+        // Each group of 8 words becomes 32 bytes of each of the 8 blocks
+        for (int g = 0; g < 2; g++)
+        {
+            const __m256i *a = x + 8 * g;
+            __m256i t0 = _mm256_unpacklo_epi32(a[0], a[1]);
+            __m256i t1 = _mm256_unpackhi_epi32(a[0], a[1]);
+            __m256i t2 = _mm256_unpacklo_epi32(a[2], a[3]);
+            __m256i t3 = _mm256_unpackhi_epi32(a[2], a[3]);
+            __m256i t4 = _mm256_unpacklo_epi32(a[4], a[5]);
+            __m256i t5 = _mm256_unpackhi_epi32(a[4], a[5]);
+            __m256i t6 = _mm256_unpacklo_epi32(a[6], a[7]);
+            __m256i t7 = _mm256_unpackhi_epi32(a[6], a[7]);
+            __m256i u[8] = {
+                _mm256_unpacklo_epi64(t0, t2), _mm256_unpackhi_epi64(t0, t2),
+                _mm256_unpacklo_epi64(t1, t3), _mm256_unpackhi_epi64(t1, t3),
+                _mm256_unpacklo_epi64(t4, t6), _mm256_unpackhi_epi64(t4, t6),
+                _mm256_unpacklo_epi64(t5, t7), _mm256_unpackhi_epi64(t5, t7)
+            };
+            for (int b = 0; b < 4; b++)
+            {
+                __m256i low = _mm256_permute2x128_si256(u[b], u[b + 4], 0x20);
+                __m256i high = _mm256_permute2x128_si256(u[b], u[b + 4], 0x31);
+                size_t at = b * CHACHA20_BLOCK + g * 32;
+                __m256i data = _mm256_loadu_si256((const __m256i *)(in + at));
+                _mm256_storeu_si256((__m256i *)(out + at), _mm256_xor_si256(data, low));
+                at += 4 * CHACHA20_BLOCK;
+                data = _mm256_loadu_si256((const __m256i *)(in + at));
+                _mm256_storeu_si256((__m256i *)(out + at), _mm256_xor_si256(data, high));
+            }
+        }
+        state[12] += 8;
+        in += 8 * CHACHA20_BLOCK;
+        out += 8 * CHACHA20_BLOCK;
+    }
+    xor_sse2(state, in, n, out);
+}
+
+#endif /* CRYPTO_HAVE_X86 */
+
+/* Runtime dispatch */
+
+typedef enum
+{
+    e_chacha_scalar,
+    e_chacha_sse2,
+    e_chacha_avx2
+} ChachaKernel;
+
+static ChachaKernel select_kernel(void)
+{
+#ifdef CRYPTO_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+        return e_chacha_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return e_chacha_sse2;
+#endif
+    return e_chacha_scalar;
+}
+
+void chacha20_xor(const unsigned char key[CHACHA20_KEY_SIZE], const unsigned char nonce[CHACHA20_NONCE_SIZE],
+                  uint32_t counter, const unsigned char *in, size_t n, unsigned char *out)
+{
+    uint32_t state[16];
+    chacha20_setup(state, key, nonce, counter);
+    switch (select_kernel())
+    {
+#ifdef CRYPTO_HAVE_X86
+        case e_chacha_avx2:
+            xor_avx2(state, in, n, out);
+            break;
+        case e_chacha_sse2:
+            xor_sse2(state, in, n, out);
+            break;
+#endif
+        default:
+            xor_scalar(state, in, n, out);
+            break;
+    }
+    secure_wipe(state, sizeof(state));
+}
+
+const char *chacha20_kernel_name(void)
+{
+    switch (select_kernel())
+    {
+        case e_chacha_avx2:
+            return "avx2";
+        case e_chacha_sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+/* Poly1305, 44/44/42 bit limbs with 128 bit products */
+
+#define POLY_MASK44 0xFFFFFFFFFFFULL
+#define POLY_MASK42 0x3FFFFFFFFFFULL
+
+typedef unsigned __int128 uint128;
+
+typedef struct
+{
+    uint64_t r[3];
+    uint64_t h[3];
+    uint64_t pad[2];
+} Poly1305;
+
+static void poly1305_init(Poly1305 *st, const unsigned char key[32])
+{
+    uint64_t t0 = load_le64(key);
+    uint64_t t1 = load_le64(key + 8);
+    // Clamp r as the spec requires
+    st->r[0] = t0 & 0xFFC0FFFFFFFULL;
+    st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xFFFFFC0FFFFULL;
+    st->r[2] = (t1 >> 24) & 0x00FFFFFFC0FULL;
+    st->h[0] = st->h[1] = st->h[2] = 0;
+    st->pad[0] = load_le64(key + 16);
+    st->pad[1] = load_le64(key + 24);
+}
+
+/* Absorb n bytes, a short final block is zero padded (the AEAD pad16) */
+static void poly1305_update_padded(Poly1305 *st, const unsigned char *m, size_t n)
+{
+    const uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    unsigned char last[16];
+
+    while (n > 0)
+    {
+        if (n < 16)
+        {
+            memset(last, 0, sizeof(last));
+            memcpy(last, m, n);
+            m = last;
+            n = 16;
+        }
+        uint64_t t0 = load_le64(m);
+        uint64_t t1 = load_le64(m + 8);
+        h0 += t0 & POLY_MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & POLY_MASK44;
+        h2 += ((t1 >> 24) & POLY_MASK42) | (1ULL << 40);
+
+        uint128 d0 = (uint128)h0 * r0 + (uint128)h1 * s2 + (uint128)h2 * s1;
+        uint128 d1 = (uint128)h0 * r1 + (uint128)h1 * r0 + (uint128)h2 * s2;
+        uint128 d2 = (uint128)h0 * r2 + (uint128)h1 * r1 + (uint128)h2 * r0;
+
+        uint64_t c = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & POLY_MASK44;
+        d1 += c;
+        c = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & POLY_MASK44;
+        d2 += c;
+        c = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & POLY_MASK42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= POLY_MASK44;
+        h1 += c;
+
+        m += 16;
+        n -= 16;
+    }
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+}
+
+static void poly1305_finish(Poly1305 *st, unsigned char tag[POLY1305_TAG_SIZE])
+{
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+    uint64_t c;
+
+    // Fully carry h
+    c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += c; c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += c;
+
+    // g = h - (2^130 - 5), keep h if that underflows
+    uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= POLY_MASK44;
+    uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= POLY_MASK44;
+    uint64_t g2 = h2 + c - (1ULL << 42);
+    c = (g2 >> 63) - 1;
+    g0 &= c;
+    g1 &= c;
+    g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    // h + s mod 2^128
+    uint64_t t0 = st->pad[0], t1 = st->pad[1];
+    h0 += t0 & POLY_MASK44; c = h0 >> 44; h0 &= POLY_MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & POLY_MASK44) + c; c = h1 >> 44; h1 &= POLY_MASK44;
+    h2 += ((t1 >> 24) & POLY_MASK42) + c; h2 &= POLY_MASK42;
+
+    store_le64(tag, h0 | (h1 << 44));
+    store_le64(tag + 8, (h1 >> 20) | (h2 << 24));
+    secure_wipe(st, sizeof(*st));
+}
+
+/* ChaCha20-Poly1305 (RFC 8439 section 2.8) */
+
+static void aead_tag(const unsigned char *key, const unsigned char *nonce, const unsigned char *aad, size_t aad_len,
+                     const unsigned char *ct, size_t n, unsigned char tag[POLY1305_TAG_SIZE])
+{
+    // The one-time Poly1305 key is the first 32 bytes of block 0
+    unsigned char block0[CHACHA20_BLOCK] = {0};
+    unsigned char lengths[16];
+    Poly1305 st;
+
+    chacha20_xor(key, nonce, 0, block0, sizeof(block0), block0);
+    poly1305_init(&st, block0);
+    poly1305_update_padded(&st, aad, aad_len);
+    poly1305_update_padded(&st, ct, n);
+    store_le64(lengths, aad_len);
+    store_le64(lengths + 8, n);
+    poly1305_update_padded(&st, lengths, sizeof(lengths));
+    poly1305_finish(&st, tag);
+    secure_wipe(block0, sizeof(block0));
+}
+
+void aead_seal(const unsigned char key[CHACHA20_KEY_SIZE], const unsigned char nonce[CHACHA20_NONCE_SIZE],
+               const unsigned char *aad, size_t aad_len, const unsigned char *in, size_t n,
+               unsigned char *out, unsigned char tag[POLY1305_TAG_SIZE])
+{
+    chacha20_xor(key, nonce, 1, in, n, out);
+    aead_tag(key, nonce, aad, aad_len, out, n, tag);
+}
+
+int aead_open(const unsigned char key[CHACHA20_KEY_SIZE], const unsigned char nonce[CHACHA20_NONCE_SIZE],
+              const unsigned char *aad, size_t aad_len, const unsigned char *in, size_t n,
+              const unsigned char tag[POLY1305_TAG_SIZE], unsigned char *out)
+{
+    unsigned char expected[POLY1305_TAG_SIZE];
+    unsigned char diff = 0;
+
+    aead_tag(key, nonce, aad, aad_len, in, n, expected);
+    // Constant time compare
+    for (int i = 0; i < POLY1305_TAG_SIZE; i++)
+        diff |= expected[i] ^ tag[i];
+    if (diff != 0)
+        return -1;
+    chacha20_xor(key, nonce, 1, in, n, out);
+    return 0;
+}
+
+/* SHA-256 (FIPS 180-4) */
+
+typedef struct
+{
+    uint32_t h[8];
+    uint64_t length;
+    unsigned char buffer[64];
+    size_t used;
+} Sha256;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+static void sha256_compress(uint32_t h[8], const unsigned char block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = k + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += k;
+}
+
+static void sha256_init(Sha256 *st)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(st->h, iv, sizeof(iv));
+    st->length = 0;
+    st->used = 0;
+}
+
+static void sha256_update(Sha256 *st, const unsigned char *data, size_t n)
+{
+    st->length += n;
+    while (n > 0)
+    {
+        size_t take = 64 - st->used < n ? 64 - st->used : n;
+        memcpy(st->buffer + st->used, data, take);
+        st->used += take;
+        data += take;
+        n -= take;
+        if (st->used == 64)
+        {
+            sha256_compress(st->h, st->buffer);
+            st->used = 0;
+        }
+    }
+}
+
+static void sha256_final(Sha256 *st, unsigned char digest[SHA256_SIZE])
+{
+    uint64_t bits = st->length * 8;
+    unsigned char pad = 0x80;
+    sha256_update(st, &pad, 1);
+    pad = 0;
+    while (st->used != 56)
+        sha256_update(st, &pad, 1);
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++)
+        length[i] = bits >> (56 - 8 * i);
+    sha256_update(st, length, 8);
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = st->h[i] >> 24;
+        digest[4 * i + 1] = st->h[i] >> 16;
+        digest[4 * i + 2] = st->h[i] >> 8;
+        digest[4 * i + 3] = st->h[i];
+    }
+    secure_wipe(st, sizeof(*st));
+}
+
+void sha256(const unsigned char *data, size_t n, unsigned char digest[SHA256_SIZE])
+{
+    Sha256 st;
+    sha256_init(&st);
+    sha256_update(&st, data, n);
+    sha256_final(&st, digest);
+}
+
+/* HMAC-SHA256 with the inner and outer pads hashed once */
+
+typedef struct
+{
+    Sha256 inner;
+    Sha256 outer;
+} HmacSha256;
+
+static void hmac_init(HmacSha256 *mac, const unsigned char *key, size_t key_len)
+{
+    unsigned char block[64] = {0};
+    if (key_len > sizeof(block))
+        sha256(key, key_len, block);
+    else
+        memcpy(block, key, key_len);
+
+    for (int i = 0; i < 64; i++)
+        block[i] ^= 0x36;
+    sha256_init(&mac->inner);
+    sha256_update(&mac->inner, block, 64);
+    for (int i = 0; i < 64; i++)
+        block[i] ^= 0x36 ^ 0x5c;
+    sha256_init(&mac->outer);
+    sha256_update(&mac->outer, block, 64);
+    secure_wipe(block, sizeof(block));
+}
+
+static void hmac_final(const HmacSha256 *keyed, const unsigned char *data, size_t n, unsigned char out[SHA256_SIZE])
+{
+    HmacSha256 mac = *keyed;
+    unsigned char inner[SHA256_SIZE];
+    sha256_update(&mac.inner, data, n);
+    sha256_final(&mac.inner, inner);
+    sha256_update(&mac.outer, inner, sizeof(inner));
+    sha256_final(&mac.outer, out);
+    secure_wipe(inner, sizeof(inner));
+}
+
+void pbkdf2_hmac_sha256(const unsigned char *password, size_t password_len, const unsigned char *salt,
+                        size_t salt_len, uint32_t iterations, unsigned char *out, size_t out_len)
+{
+    HmacSha256 keyed, salted;
+    unsigned char u[SHA256_SIZE], t[SHA256_SIZE];
+
+    hmac_init(&keyed, password, password_len);
+    for (uint32_t block = 1; out_len > 0; block++)
+    {
+        unsigned char index[4] = {block >> 24, block >> 16, block >> 8, block};
+        // U1 = HMAC(P, S || INT(i))
+        salted = keyed;
+        sha256_update(&salted.inner, salt, salt_len);
+        hmac_final(&salted, index, sizeof(index), u);
+        memcpy(t, u, sizeof(t));
+        for (uint32_t i = 1; i < iterations; i++)
+        {
+            hmac_final(&keyed, u, sizeof(u), u);
+            for (int j = 0; j < SHA256_SIZE; j++)
+                t[j] ^= u[j];
+        }
+        size_t take = out_len < sizeof(t) ? out_len : sizeof(t);
+        memcpy(out, t, take);
+        out += take;
+        out_len -= take;
+    }
+    secure_wipe(&keyed, sizeof(keyed));
+    secure_wipe(&salted, sizeof(salted));
+    secure_wipe(u, sizeof(u));
+    secure_wipe(t, sizeof(t));
+}
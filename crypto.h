@@ -0,0 +1,43 @@
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bundled primitives for --encrypt
+ * ChaCha20 (RFC 8439) with SSE2/AVX2 kernels picked at runtime like
+ * lsb.c, Poly1305, ChaCha20-Poly1305 AEAD and PBKDF2-HMAC-SHA256.
+ */
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 12
+#define POLY1305_TAG_SIZE 16
+#define SHA256_SIZE 32
+
+/* XOR n bytes of keystream starting at block counter into out */
+void chacha20_xor(const unsigned char key[CHACHA20_KEY_SIZE], const unsigned char nonce[CHACHA20_NONCE_SIZE],
+                  uint32_t counter, const unsigned char *in, size_t n, unsigned char *out);
+
+/* ChaCha20-Poly1305: encrypt n bytes and produce the tag */
+void aead_seal(const unsigned char key[CHACHA20_KEY_SIZE], const unsigned char nonce[CHACHA20_NONCE_SIZE],
+               const unsigned char *aad, size_t aad_len, const unsigned char *in, size_t n,
+               unsigned char *out, unsigned char tag[POLY1305_TAG_SIZE]);
+
+/* Check the tag first and decrypt only if it matches, returns 0 on success */
+int aead_open(const unsigned char key[CHACHA20_KEY_SIZE], const unsigned char nonce[CHACHA20_NONCE_SIZE],
+              const unsigned char *aad, size_t aad_len, const unsigned char *in, size_t n,
+              const unsigned char tag[POLY1305_TAG_SIZE], unsigned char *out);
+
+void sha256(const unsigned char *data, size_t n, unsigned char digest[SHA256_SIZE]);
+
+void pbkdf2_hmac_sha256(const unsigned char *password, size_t password_len, const unsigned char *salt,
+                        size_t salt_len, uint32_t iterations, unsigned char *out, size_t out_len);
+
+/* memset that the compiler may not drop, for keys */
+void secure_wipe(void *p, size_t n);
+
+/* Name of the ChaCha20 kernel selected for this CPU */
+const char *chacha20_kernel_name(void);
+
+#endif
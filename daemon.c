@@ -0,0 +1,642 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "encode.h"
+#include "decode.h"
+#include "inspect.h"
+#include "common.h"
+#include "parallel.h"
+
+/* Service times kept per request type for the percentiles */
+#define DAEMON_SAMPLES 4096
+
+/* How often idle workers look for a stop (ms) */
+#define DAEMON_POLL_MILLIS 200
+
+/* Latest service times of one request type */
+typedef struct _LatencyLog
+{
+    const char *name;
+    double samples[DAEMON_SAMPLES];     // Ring of the latest service times (ms)
+    unsigned long long count;           // Requests seen
+    unsigned long long failed;
+} LatencyLog;
+
+/* State shared by the workers */
+typedef struct _Daemon
+{
+    int listen_fd;                      // Non-blocking, every worker polls it
+    IoMode io_mode;
+    const char *passphrase;             // For --encrypt / --scatter requests
+    pthread_mutex_t lock;               // Guards logs
+    LatencyLog logs[3];                 // embed, extract, inspect
+} Daemon;
+
+static volatile sig_atomic_t daemon_stopping;
+
+static void stop_daemon(int sig)
+{
+    (void)sig;
+    daemon_stopping = 1;
+}
+
+static double now_millis(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int compare_millis(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest rank p50 and p99 of n samples, sorted in place */
+static void percentiles(double *samples, size_t n, double *p50, double *p99)
+{
+    *p50 = *p99 = 0;
+    if (n == 0)
+        return;
+    qsort(samples, n, sizeof(double), compare_millis);
+    *p50 = samples[(n * 50 + 99) / 100 - 1];
+    *p99 = samples[(n * 99 + 99) / 100 - 1];
+}
+
+static void record_latency(Daemon *daemon, int operation, double millis, Status status)
+{
+    if (operation < DAEMON_OP_EMBED || operation > DAEMON_OP_INSPECT)
+        return;
+    LatencyLog *log = &daemon->logs[operation - DAEMON_OP_EMBED];
+    pthread_mutex_lock(&daemon->lock);
+    log->samples[log->count % DAEMON_SAMPLES] = millis;
+    log->count++;
+    if (status == e_failure)
+        log->failed++;
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+/* One line per request type: count, failures, p50 and p99 service time */
+static void format_stats(Daemon *daemon, char *out, size_t size)
+{
+    double *samples = malloc(DAEMON_SAMPLES * sizeof(double));
+    size_t used = 0;
+    out[0] = '\0';
+    for (int i = 0; i < 3 && samples != NULL; i++)
+    {
+        LatencyLog *log = &daemon->logs[i];
+        pthread_mutex_lock(&daemon->lock);
+        unsigned long long count = log->count, failed = log->failed;
+        size_t n = count < DAEMON_SAMPLES ? count : DAEMON_SAMPLES;
+        memcpy(samples, log->samples, n * sizeof(double));
+        pthread_mutex_unlock(&daemon->lock);
+
+        double p50, p99;
+        percentiles(samples, n, &p50, &p99);
+        int written = snprintf(out + used, size - used, "%-8s: %llu requests (%llu failed), p50 %.3f ms, p99 %.3f ms\n",
+                               log->name, count, failed, p50, p99);
+        if (written < 0 || (size_t)written >= size - used)
+            break;
+        used += written;
+    }
+    free(samples);
+}
+
+/* Run an embed request on the worker's buffers */
+static Status serve_embed(Daemon *daemon, const DaemonRequest *request, const int *fds, int nfds,
+                          char *block_buffer, char *chunk_buffer, DaemonReply *reply)
+{
+    if (nfds != 3)
+    {
+        snprintf(reply->message, sizeof(reply->message), "embed needs carrier, secret and output descriptors");
+        return e_failure;
+    }
+    char src[16], secret[16], output[16];
+    snprintf(src, sizeof(src), "fd:%d", fds[0]);
+    snprintf(secret, sizeof(secret), "fd:%d", fds[1]);
+    snprintf(output, sizeof(output), "fd:%d", fds[2]);
+
+    EncodeInfo encInfo = {0};
+    // Scattered tiles are written out of order, so they need the mapping
+    encInfo.io_mode = request->flags & STEG_FLAG_SCATTERED ? e_io_mmap : daemon->io_mode;
+    encInfo.threads = 1;
+    encInfo.block_buffer = block_buffer;
+    encInfo.chunk_buffer = chunk_buffer;
+    encInfo.quiet = 1;
+    encInfo.src_image_fname = src;
+    encInfo.secret_fname = secret;
+    encInfo.stego_image_fname = output;
+    encInfo.secret_extn = request->extn;
+    encInfo.depth = request->depth;
+    encInfo.compress = (request->flags & STEG_FLAG_COMPRESSED) != 0;
+    encInfo.encrypt = (request->flags & STEG_FLAG_ENCRYPTED) != 0;
+    encInfo.scatter = (request->flags & STEG_FLAG_SCATTERED) != 0;
+    encInfo.checksum = (request->flags & STEG_FLAG_CHECKSUM) != 0;
+    encInfo.passphrase = daemon->passphrase;
+    if (request->secret_size >= 0)
+    {
+        encInfo.size_secret_file = request->secret_size;
+        encInfo.secret_size_known = 1;
+    }
+
+    Status status = do_encoding(&encInfo);
+    if (status == e_failure)
+        snprintf(reply->message, sizeof(reply->message), "encoding failed (capacity, carrier format or passphrase)");
+    reply->payload_size = encInfo.size_secret_file;
+    reply->depth = encInfo.depth;
+    close_files(&encInfo);
+    return status;
+}
+
+/* Run an extract request on the worker's buffers */
+static Status serve_extract(Daemon *daemon, const int *fds, int nfds, char *block_buffer, char *chunk_buffer,
+                            DaemonReply *reply)
+{
+    if (nfds != 2)
+    {
+        snprintf(reply->message, sizeof(reply->message), "extract needs stego image and output descriptors");
+        return e_failure;
+    }
+    DecodeInfo decInfo = {0};
+    decInfo.io_mode = daemon->io_mode;
+    decInfo.threads = 1;
+    decInfo.block_buffer = block_buffer;
+    decInfo.chunk_buffer = chunk_buffer;
+    decInfo.quiet = 1;
+    decInfo.passphrase = daemon->passphrase;
+    char stego[16];
+    snprintf(stego, sizeof(stego), "fd:%d", fds[0]);
+    snprintf(decInfo.output_fname, sizeof(decInfo.output_fname), "fd:%d", fds[1]);
+    decInfo.stego_image_fname = stego;
+
+    Status status = do_decoding(&decInfo);
+    if (status == e_failure)
+        snprintf(reply->message, sizeof(reply->message), "decoding failed (no payload, corrupt or wrong passphrase)");
+    reply->payload_size = decInfo.size_secret_file;
+    reply->depth = decInfo.depth;
+    reply->flags = decInfo.flags;
+    memcpy(reply->extn, decInfo.extn_secret_file, sizeof(reply->extn));
+    reply->extn[STEG_MAX_EXTN] = '\0';
+    close_decode_files(&decInfo);
+    return status;
+}
+
+static Status serve_inspect(const int *fds, int nfds, DaemonReply *reply)
+{
+    FILE *fptr = NULL;
+    int fd = nfds == 1 ? dup(fds[0]) : -1;
+    if (fd >= 0 && (fptr = fdopen(fd, "r")) == NULL)
+        close(fd);
+    InspectInfo info;
+    if (fptr == NULL || inspect_stream(fptr, &info) == e_failure)
+    {
+        if (fptr != NULL)
+            fclose(fptr);
+        snprintf(reply->message, sizeof(reply->message), "not a 24/32 bpp uncompressed BMP");
+        return e_failure;
+    }
+    fclose(fptr);
+    reply->capacity = info.steg.bmp.capacity;
+    if (info.header_status == e_success)
+    {
+        reply->payload_size = info.steg.payload_size;
+        reply->depth = info.steg.depth;
+        reply->flags = info.steg.flags;
+        memcpy(reply->extn, info.steg.extn, sizeof(reply->extn));
+    }
+    else
+    {
+        snprintf(reply->message, sizeof(reply->message), "no payload (%s)", info.steg.error);
+    }
+    return e_success;
+}
+
+/* One request and up to DAEMON_MAX_FDS descriptors, returns the bytes read */
+static ssize_t receive_request(int conn, DaemonRequest *request, int *fds, int *nfds)
+{
+    char control[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+    struct iovec iov = {request, sizeof(*request)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *nfds = 0;
+    ssize_t got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *cmsg = got > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count && *nfds < DAEMON_MAX_FDS; i++)
+            memcpy(&fds[(*nfds)++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+    }
+    if (got > 0 && (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+        return 0;
+    return got;
+}
+
+/* Answer requests on one connection until the client hangs up or the daemon stops */
+static void serve_connection(Daemon *daemon, int conn, char *block_buffer, char *chunk_buffer)
+{
+    while (!daemon_stopping)
+    {
+        struct pollfd pfd = {conn, POLLIN, 0};
+        int ready = poll(&pfd, 1, DAEMON_POLL_MILLIS);
+        if (ready == 0 || (ready < 0 && errno == EINTR))
+            continue;
+
+        DaemonRequest request;
+        int fds[DAEMON_MAX_FDS];
+        int nfds;
+        ssize_t got = receive_request(conn, &request, fds, &nfds);
+        if (got <= 0 || ready < 0)
+        {
+            for (int i = 0; i < nfds; i++)
+                close(fds[i]);
+            break;
+        }
+
+        double start = now_millis();
+        DaemonReply reply;
+        memset(&reply, 0, sizeof(reply));
+        Status status = e_failure;
+        if (got != sizeof(request))
+        {
+            request.operation = 0;
+            snprintf(reply.message, sizeof(reply.message), "malformed request");
+        }
+        else
+        {
+            request.extn[STEG_MAX_EXTN] = '\0';
+            switch (request.operation)
+            {
+                case DAEMON_OP_EMBED:
+                    status = serve_embed(daemon, &request, fds, nfds, block_buffer, chunk_buffer, &reply);
+                    break;
+                case DAEMON_OP_EXTRACT:
+                    status = serve_extract(daemon, fds, nfds, block_buffer, chunk_buffer, &reply);
+                    break;
+                case DAEMON_OP_INSPECT:
+                    status = serve_inspect(fds, nfds, &reply);
+                    break;
+                case DAEMON_OP_STATS:
+                    format_stats(daemon, reply.message, sizeof(reply.message));
+                    status = e_success;
+                    break;
+                case DAEMON_OP_STOP:
+                    daemon_stopping = 1;
+                    status = e_success;
+                    break;
+                default:
+                    snprintf(reply.message, sizeof(reply.message), "unknown request %d", request.operation);
+                    break;
+            }
+        }
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+        reply.status = status;
+        reply.service_millis = now_millis() - start;
+        record_latency(daemon, request.operation, reply.service_millis, status);
+        if (send(conn, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+            break;
+    }
+    close(conn);
+}
+
+static void daemon_worker(void *ctx, int index, int nworkers)
+{
+    (void)index;
+    (void)nworkers;
+    Daemon *daemon = ctx;
+
+    // Buffers live as long as the worker and are faulted in before the first request
+    char *block_buffer = malloc(STEG_BLOCK_SIZE);
+    char *chunk_buffer = malloc(STEG_SECRET_CHUNK);
+    if (block_buffer != NULL)
+        memset(block_buffer, 0, STEG_BLOCK_SIZE);
+    if (chunk_buffer != NULL)
+        memset(chunk_buffer, 0, STEG_SECRET_CHUNK);
+
+    while (!daemon_stopping)
+    {
+        struct pollfd pfd = {daemon->listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, DAEMON_POLL_MILLIS) <= 0)
+            continue;
+        // Another worker may have taken the connection already
+        int conn = accept4(daemon->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn >= 0)
+            serve_connection(daemon, conn, block_buffer, chunk_buffer);
+    }
+
+    free(block_buffer);
+    free(chunk_buffer);
+}
+
+Status run_daemon(const char *socket_path, int nworkers, IoMode io_mode, const char *passphrase)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return e_failure;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // A socket left behind by a daemon that died is replaced, anything else is not touched
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path);
+
+    Daemon daemon;
+    memset(&daemon, 0, sizeof(daemon));
+    daemon.io_mode = io_mode;
+    daemon.passphrase = passphrase;
+    daemon.logs[0].name = "embed";
+    daemon.logs[1].name = "extract";
+    daemon.logs[2].name = "inspect";
+    daemon.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (daemon.listen_fd < 0 || bind(daemon.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(daemon.listen_fd, 128) != 0)
+    {
+        perror(socket_path);
+        if (daemon.listen_fd >= 0)
+            close(daemon.listen_fd);
+        return e_failure;
+    }
+    pthread_mutex_init(&daemon.lock, NULL);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_daemon;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    daemon_stopping = 0;
+
+    printf("Daemon listening on %s with %d workers (%s I/O)\n", socket_path, nworkers,
+           io_mode == e_io_mmap ? "mmap" : io_mode == e_io_async ? "async" : "stdio");
+    fflush(stdout);
+    Status status = parallel_run(nworkers, daemon_worker, &daemon);
+
+    close(daemon.listen_fd);
+    unlink(socket_path);
+    char report[512];
+    format_stats(&daemon, report, sizeof(report));
+    printf("Daemon stopped.\n%s", report);
+    pthread_mutex_destroy(&daemon.lock);
+    return status;
+}
+
+/* Client side */
+
+static int connect_daemon(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* Send one request with its descriptors and wait for the reply */
+static Status call_daemon(int sock, const DaemonRequest *request, const int *fds, int nfds, DaemonReply *reply)
+{
+    char control[CMSG_SPACE(DAEMON_MAX_FDS * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {(void *)request, sizeof(*request)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(*request))
+        return e_failure;
+    return recv(sock, reply, sizeof(*reply), 0) == sizeof(*reply) ? e_success : e_failure;
+}
+
+/* "fd:N" passes on an open descriptor (a memfd buffer, say), anything else is opened */
+static int open_request_file(const char *fname, int flags)
+{
+    if (strncmp(fname, "fd:", 3) == 0)
+    {
+        // Rewound for every --repeat, a pipe just stays where it is
+        int fd = fcntl(atoi(fname + 3), F_DUPFD_CLOEXEC, 0);
+        if (fd >= 0 && lseek(fd, 0, SEEK_SET) == 0 && (flags & O_TRUNC))
+            ftruncate(fd, 0);
+        return fd;
+    }
+    return open(fname, flags | O_CLOEXEC, 0644);
+}
+
+/* Open the files of a request, e_failure names the one that failed */
+static Status open_request_files(int operation, char *argv[], int *fds, int *nfds)
+{
+    *nfds = 0;
+    if (operation == DAEMON_OP_EMBED)
+    {
+        fds[(*nfds)++] = open_request_file(argv[1], O_RDONLY);
+        fds[(*nfds)++] = open_request_file(argv[2], O_RDONLY);
+        fds[(*nfds)++] = open_request_file(argv[3], O_RDWR | O_CREAT | O_TRUNC);
+    }
+    else if (operation == DAEMON_OP_EXTRACT)
+    {
+        fds[(*nfds)++] = open_request_file(argv[1], O_RDONLY);
+        fds[(*nfds)++] = open_request_file(argv[2], O_WRONLY | O_CREAT | O_TRUNC);
+    }
+    else if (operation == DAEMON_OP_INSPECT)
+    {
+        fds[(*nfds)++] = open_request_file(argv[1], O_RDONLY);
+    }
+    for (int i = 0; i < *nfds; i++)
+    {
+        if (fds[i] < 0)
+        {
+            perror(argv[i + 1]);
+            for (int j = 0; j < *nfds; j++)
+            {
+                if (fds[j] >= 0)
+                    close(fds[j]);
+            }
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+static void print_reply(int operation, char *argv[], const DaemonReply *reply)
+{
+    if (reply->status == e_failure)
+    {
+        printf("Request failed: %s\n", reply->message);
+        return;
+    }
+    switch (operation)
+    {
+        case DAEMON_OP_EMBED:
+            printf("Embedded %llu bytes into %s (%.3f ms in the daemon)\n", reply->payload_size, argv[3],
+                   reply->service_millis);
+            break;
+        case DAEMON_OP_EXTRACT:
+            printf("Extracted %llu bytes (extension %s) to %s (%.3f ms in the daemon)\n", reply->payload_size,
+                   reply->extn, argv[2], reply->service_millis);
+            break;
+        case DAEMON_OP_INSPECT:
+            printf("Capacity    : %llu carrier bytes\n", reply->capacity);
+            if (reply->message[0] == '\0')
+                printf("Payload     : %llu bytes, extension %s, depth %d, flags 0x%02x\n", reply->payload_size,
+                       reply->extn, reply->depth, reply->flags);
+            else
+                printf("Payload     : %s\n", reply->message);
+            break;
+        case DAEMON_OP_STATS:
+            printf("%s", reply->message);
+            break;
+        default:
+            printf("Daemon stopping.\n");
+            break;
+    }
+}
+
+Status run_client(const char *socket_path, int argc, char *argv[], int depth, int flags, int repeat)
+{
+    DaemonRequest request;
+    memset(&request, 0, sizeof(request));
+    request.depth = depth;
+    request.flags = flags;
+    request.secret_size = -1;
+
+    int want_args;
+    if (strcmp(argv[0], "e") == 0)
+    {
+        request.operation = DAEMON_OP_EMBED;
+        want_args = 4;
+    }
+    else if (strcmp(argv[0], "d") == 0)
+    {
+        request.operation = DAEMON_OP_EXTRACT;
+        want_args = 3;
+    }
+    else if (strcmp(argv[0], "i") == 0)
+    {
+        request.operation = DAEMON_OP_INSPECT;
+        want_args = 2;
+    }
+    else if (strcmp(argv[0], "stats") == 0)
+    {
+        request.operation = DAEMON_OP_STATS;
+        want_args = 1;
+    }
+    else if (strcmp(argv[0], "stop") == 0)
+    {
+        request.operation = DAEMON_OP_STOP;
+        want_args = 1;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown daemon request: %s\n", argv[0]);
+        return e_failure;
+    }
+    if (argc != want_args)
+    {
+        fprintf(stderr, "Usage: e <source.bmp> <secret.txt> <output.bmp> | d <stego.bmp> <output> | i <image.bmp> | stats | stop\n");
+        return e_failure;
+    }
+    if (request.operation == DAEMON_OP_EMBED)
+    {
+        // Extension as -e stores it, an fd:N secret is stored as .txt
+        const char *slash = strrchr(argv[2], '/');
+        const char *dot = strrchr(slash ? slash + 1 : argv[2], '.');
+        if (strncmp(argv[2], "fd:", 3) == 0)
+            dot = ".txt";
+        if (dot != NULL && strlen(dot) > STEG_MAX_EXTN)
+        {
+            fprintf(stderr, "Invalid: secret file extension is longer than %d bytes\n", STEG_MAX_EXTN);
+            return e_failure;
+        }
+        strcpy(request.extn, dot ? dot : "");
+    }
+
+    int sock = connect_daemon(socket_path);
+    if (sock < 0)
+    {
+        perror(socket_path);
+        return e_failure;
+    }
+
+    double *round_trip = malloc(repeat * sizeof(double));
+    double *service = malloc(repeat * sizeof(double));
+    Status status = round_trip && service ? e_success : e_failure;
+    DaemonReply reply;
+    for (int i = 0; status == e_success && i < repeat; i++)
+    {
+        int fds[DAEMON_MAX_FDS];
+        int nfds;
+        if (open_request_files(request.operation, argv, fds, &nfds) == e_failure)
+        {
+            status = e_failure;
+            break;
+        }
+        double start = now_millis();
+        status = call_daemon(sock, &request, fds, nfds, &reply);
+        round_trip[i] = now_millis() - start;
+        service[i] = reply.service_millis;
+        for (int j = 0; j < nfds; j++)
+            close(fds[j]);
+        if (status == e_failure)
+            fprintf(stderr, "Lost the connection to the daemon\n");
+        else if (reply.status == e_failure)
+            status = e_failure;
+    }
+
+    if (status == e_success || reply.status == e_failure)
+        print_reply(request.operation, argv, &reply);
+    // Don't leave a partial output behind, the daemon can't remove it
+    if (status == e_failure && request.operation == DAEMON_OP_EXTRACT)
+        unlink(argv[2]);
+    if (status == e_success && repeat > 1)
+    {
+        double p50, p99, s50, s99;
+        percentiles(round_trip, repeat, &p50, &p99);
+        percentiles(service, repeat, &s50, &s99);
+        printf("%d requests: round trip p50 %.3f ms, p99 %.3f ms; in the daemon p50 %.3f ms, p99 %.3f ms\n",
+               repeat, p50, p99, s50, s99);
+    }
+    free(round_trip);
+    free(service);
+    close(sock);
+    return status;
+}
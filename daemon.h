@@ -0,0 +1,60 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "types.h"
+#include "steg.h"
+
+/*
+ * Daemon mode (-S) and its client (-C)
+ * The daemon listens on a Unix domain SOCK_SEQPACKET socket. Every
+ * message is one DaemonRequest, with the files it works on passed as
+ * open descriptors (SCM_RIGHTS): regular files, pipes or memfd shared
+ * memory buffers, which mmap mode maps in place. Each request gets
+ * one DaemonReply. A connection may carry any number of requests.
+ * Workers are started up front, each with its own pre-faulted work
+ * buffers, and take connections off the listening socket in turn.
+ * The daemon keeps the service time of recent requests and reports
+ * their p50/p99 on a stats request and when it stops.
+ */
+
+/* Requests, and the descriptors each one carries */
+#define DAEMON_OP_EMBED 1       // carrier, secret, output
+#define DAEMON_OP_EXTRACT 2     // stego image, output
+#define DAEMON_OP_INSPECT 3     // image
+#define DAEMON_OP_STATS 4       // none
+#define DAEMON_OP_STOP 5        // none
+
+#define DAEMON_MAX_FDS 3
+
+typedef struct _DaemonRequest
+{
+    int operation;                  // DAEMON_OP_*
+    int depth;                      // embed: payload bits per carrier byte
+    int flags;                      // embed: STEG_FLAG_COMPRESSED, _ENCRYPTED, _SCATTERED, _CHECKSUM
+    char extn[STEG_MAX_EXTN + 1];   // embed: extension stored with the secret
+    long long secret_size;          // embed: size of a streamed secret, -1 to measure it
+} DaemonRequest;
+
+typedef struct _DaemonReply
+{
+    int status;                     // Status of the request
+    int depth;                      // extract, inspect: from the stego header
+    int flags;
+    char extn[STEG_MAX_EXTN + 1];
+    unsigned long long payload_size;
+    unsigned long long capacity;    // inspect: carrier bytes
+    double service_millis;          // Time the worker spent on the request
+    char message[512];              // Why it failed, or the stats report
+} DaemonReply;
+
+/* Serve requests on socket_path with nworkers workers until a stop request or SIGINT/SIGTERM */
+Status run_daemon(const char *socket_path, int nworkers, IoMode io_mode, const char *passphrase);
+
+/*
+ * Client: argv[0] is the request (e, d, i, stats or stop) followed by
+ * its files, as for -e, -d and -i. repeat > 1 sends it that many times
+ * over one connection and reports the round trip p50/p99.
+ */
+Status run_client(const char *socket_path, int argc, char *argv[], int depth, int flags, int repeat);
+
+#endif
@@ -1,225 +1,1270 @@
-#include <stdio.h>
-#include <string.h>
-#include "decode.h"
-#include "types.h"
-#include "common.h"
-
-/* Function Definitions */
-
-Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
-{
-    printf("Read and validate decode arguments started...\n");
-
-    // Step 1: Validate stego image file (.bmp)
-    if (argv[2] == NULL)
-    {
-        printf("INVALID: Missing stego image file.\n");
-        return e_failure;
-    }
-
-    if (strstr(argv[2], ".bmp") == NULL)
-    {
-        printf("INVALID: Stego image must have a .bmp extension.\n");
-        return e_failure;
-    }
-
-    decInfo->stego_image_fname = argv[2];
-
-    // Step 2: Handle output filename (optional)
-    if (argv[3] != NULL)
-    {
-        static char outputBuffer[100];
-        strcpy(outputBuffer, argv[3]);
-
-        char *dot = strrchr(outputBuffer, '.');
-
-        // Check if extension exists
-        if (dot == NULL)
-        {
-            printf("INVALID: The output file must have a valid extension (.txt, .c, or .sh)\n");
-            return e_failure;
-        }
-
-        // Check for valid extensions
-        if (strcmp(dot, ".txt") == 0 || strcmp(dot, ".c") == 0 || strcmp(dot, ".sh") == 0)
-        {
-            // Remove extension safely and store filename
-            *dot = '\0';
-            strcpy(decInfo->output_fname, outputBuffer);
-            printf("Valid output file extension detected: %s\n", dot + 1);
-            printf("Output base filename set to '%s'\n", decInfo->output_fname);
-        }
-        else
-        {
-            printf("INVALID: Unsupported file extension '%s'.\n", dot);
-            printf("Please provide a file with one of the following extensions: .txt, .c, or .sh\n");
-            return e_failure;
-        }
-    }
-    else
-    {
-        printf("No output filename provided. Using default: 'decoded'\n");
-        strcpy(decInfo->output_fname, "decoded");
-    }
-
-    return e_success;
-}
-
-
-/* Open only stego file now (output will be opened later) */
-Status open_decode_files(DecodeInfo *decInfo)
-{
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "r");
-    if (decInfo->fptr_stego_image == NULL)
-    {
-        perror("fopen");
-        fprintf(stderr, "INVALID: Unable to open file %s\n", decInfo->stego_image_fname);
-        return e_failure;
-    }
-
-    printf("Stego image opened successfully: %s\n", decInfo->stego_image_fname);
-    return e_success;
-}
-
-/* Decode Magic String */
-Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
-{
-    fseek(decInfo->fptr_stego_image, 54, SEEK_SET); // Skip BMP header
-
-    char image_buffer[8];
-    char decoded_char;
-    char decoded_magic[10] = {0};
-
-    for (int i = 0; i < strlen(magic_string); i++)
-    {
-        fread(image_buffer, sizeof(char), 8, decInfo->fptr_stego_image);
-        decoded_char = decode_byte_from_lsb(image_buffer);
-        decoded_magic[i] = decoded_char;
-    }
-
-    decoded_magic[strlen(magic_string)] = '\0';
-
-    if (strcmp(decoded_magic, magic_string) == 0)
-    {
-        printf("Magic string verified successfully: %s\n", decoded_magic);
-        return e_success;
-    }
-    else
-    {
-        printf("INVALID: Magic string mismatch. Not a valid stego image.\n");
-        return e_failure;
-    }
-}
-
-/* Decode Extension Size */
-Status decode_secret_file_extn_size(DecodeInfo *decInfo, int *size)
-{
-    char image_buffer[32];
-    fread(image_buffer, sizeof(char), 32, decInfo->fptr_stego_image);
-    *size = decode_size_from_lsb(image_buffer);
-    printf("Decoded secret file extension size = %d\n", *size);
-    return e_success;
-}
-
-/* Decode Extension */
-Status decode_secret_file_extn(DecodeInfo *decInfo, int size)
-{
-    char image_buffer[8];
-    for (int i = 0; i < size; i++)
-    {
-        fread(image_buffer, sizeof(char), 8, decInfo->fptr_stego_image);
-        decInfo->extn_secret_file[i] = decode_byte_from_lsb(image_buffer);
-    }
-    decInfo->extn_secret_file[size] = '\0';
-    printf("Decoded extension = %s\n", decInfo->extn_secret_file);
-
-    // Append extension to output filename
-    strcat(decInfo->output_fname, decInfo->extn_secret_file);
-
-    // Open output file now
-    decInfo->fptr_output = fopen(decInfo->output_fname, "w");
-    if (decInfo->fptr_output == NULL)
-    {
-        perror("fopen");
-        fprintf(stderr, "INVALID: Unable to open output file %s\n", decInfo->output_fname);
-        return e_failure;
-    }
-
-    printf("Output file created: %s\n", decInfo->output_fname);
-    return e_success;
-}
-
-/* Decode Secret File Size */
-Status decode_secret_file_size(DecodeInfo *decInfo, long *size)
-{
-    char image_buffer[32];
-    fread(image_buffer, sizeof(char), 32, decInfo->fptr_stego_image);
-    *size = decode_size_from_lsb(image_buffer);
-    decInfo->size_secret_file = *size;
-    printf("Decoded secret file size = %ld bytes\n", *size);
-    return e_success;
-}
-
-/* Decode Secret File Data */
-Status decode_secret_file_data(DecodeInfo *decInfo, long size)
-{
-    char image_buffer[8];
-    char ch;
-
-    printf("Decoding secret file data...\n");
-    for (long i = 0; i < size; i++)
-    {
-        fread(image_buffer, sizeof(char), 8, decInfo->fptr_stego_image);
-        ch = decode_byte_from_lsb(image_buffer);
-        fputc(ch, decInfo->fptr_output);
-    }
-    printf("Decoded secret data successfully.\n");
-    return e_success;
-}
-
-/* Utility Functions */
-char decode_byte_from_lsb(char *image_buffer)
-{
-    char data = 0;
-    for (int i = 0; i < 8; i++)
-    {
-        data = (data << 1) | (image_buffer[i] & 1);
-    }
-    return data;
-}
-
-int decode_size_from_lsb(char *image_buffer)
-{
-    int size = 0;
-    for (int i = 0; i < 32; i++)
-    {
-        size = (size << 1) | (image_buffer[i] & 1);
-    }
-    return size;
-}
-
-/* Main Decoding Orchestrator */
-Status do_decoding(DecodeInfo *decInfo)
-{
-    printf("<----------- DECODING MODE ----------->\n");
-
-    // Step 1: Open Stego Image
-    if (open_decode_files(decInfo) == e_failure)
-        return e_failure;
-
-    // Step 2: Verify Magic String
-    if (decode_magic_string(MAGIC_STRING, decInfo) == e_failure)
-        return e_failure;
-
-    // Step 3: Decode Secret File Extension and Create Output File
-    int extn_size;
-    decode_secret_file_extn_size(decInfo, &extn_size);
-    decode_secret_file_extn(decInfo, extn_size);
-
-    // Step 4: Decode Secret File Size and Data
-    long secret_size;
-    decode_secret_file_size(decInfo, &secret_size);
-    decode_secret_file_data(decInfo, secret_size);
-
-    return e_success;
-}
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "decode.h"
+#include "types.h"
+#include "common.h"
+#include "lsb.h"
+#include "parallel.h"
+#include "bmp.h"
+#include "bmpio.h"
+#include "steg.h"
+#include "lz.h"
+#include "seal.h"
+#include "ecc.h"
+#include "scatter.h"
+#include "crc32c.h"
+#include "directory.h"
+#include "aio.h"
+
+/* Function Definitions */
+
+/* "-" as output name streams the payload to stdout */
+static int decode_to_stdout(const DecodeInfo *decInfo)
+{
+    return strcmp(decInfo->output_fname, "-") == 0;
+}
+
+/* "fd:N" names a descriptor that is already open (daemon requests), the stream gets its own copy */
+static FILE *open_stream(const char *fname, const char *mode)
+{
+    if (strncmp(fname, "fd:", 3) != 0)
+        return fopen(fname, mode);
+    int fd = dup(atoi(fname + 3));
+    FILE *fptr = fd < 0 ? NULL : fdopen(fd, mode);
+    if (fptr == NULL && fd >= 0)
+        close(fd);
+    return fptr;
+}
+
+/* Progress output, silenced for batch jobs */
+static void decode_log(const DecodeInfo *decInfo, const char *format, ...)
+{
+    if (decInfo->quiet)
+        return;
+    // Keep stdout clean when the payload is streamed there
+    FILE *out = decode_to_stdout(decInfo) ? stderr : stdout;
+    va_list args;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+/* Errors go to stderr, or the first one into decInfo->error for a quiet run */
+static void decode_error(DecodeInfo *decInfo, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!decInfo->quiet)
+    {
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+    }
+    else if (decInfo->error[0] == '\0')
+    {
+        vsnprintf(decInfo->error, sizeof(decInfo->error), format, args);
+    }
+    va_end(args);
+}
+
+Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
+{
+    // Settle a stdout payload first so even this message stays off stdout
+    if (argv[2] != NULL && argv[3] != NULL && strcmp(argv[3], "-") == 0)
+        strcpy(decInfo->output_fname, "-");
+
+    decode_log(decInfo, "Read and validate decode arguments started...\n");
+
+    // Step 1: Validate stego image file (.bmp)
+    if (argv[2] == NULL)
+    {
+        decode_log(decInfo, "INVALID: Missing stego image file.\n");
+        return e_failure;
+    }
+
+    // "-" streams the stego image from stdin
+    if (strstr(argv[2], ".bmp") == NULL && strcmp(argv[2], "-") != 0)
+    {
+        decode_log(decInfo, "INVALID: Stego image must have a .bmp extension.\n");
+        return e_failure;
+    }
+
+    decInfo->stego_image_fname = argv[2];
+
+    // Step 2: Handle output filename (optional), "-" writes to stdout
+    if (argv[3] != NULL && strcmp(argv[3], "-") == 0)
+    {
+        decode_log(decInfo, "Payload will be written to stdout\n");
+    }
+    else if (argv[3] != NULL)
+    {
+        char outputBuffer[sizeof(decInfo->output_fname)];
+        if (strlen(argv[3]) >= sizeof(outputBuffer))
+        {
+            decode_log(decInfo, "INVALID: Output file name is too long.\n");
+            return e_failure;
+        }
+        strcpy(outputBuffer, argv[3]);
+
+        // The stored extension replaces the one given, if any
+        char *slash = strrchr(outputBuffer, '/');
+        char *dot = strrchr(slash ? slash + 1 : outputBuffer, '.');
+        if (dot != NULL)
+        {
+            *dot = '\0';
+            decode_log(decInfo, "Valid output file extension detected: %s\n", dot + 1);
+        }
+        strcpy(decInfo->output_fname, outputBuffer);
+        decode_log(decInfo, "Output base filename set to '%s'\n", decInfo->output_fname);
+    }
+    else if (!decInfo->verify)
+    {
+        decode_log(decInfo, "No output filename provided. Using default: 'decoded'\n");
+        strcpy(decInfo->output_fname, "decoded");
+    }
+
+    return e_success;
+}
+
+
+/* Open only stego file now (output will be opened later) */
+Status open_decode_files(DecodeInfo *decInfo)
+{
+    int stego_stream = strcmp(decInfo->stego_image_fname, "-") == 0;
+    if (decInfo->io_mode == e_io_mmap && stego_stream)
+    {
+        decode_log(decInfo, "INVALID: mmap mode needs a regular file, not stdin\n");
+        return e_failure;
+    }
+
+    decInfo->fptr_stego_image = stego_stream ? stdin : open_stream(decInfo->stego_image_fname, "r");
+    if (decInfo->fptr_stego_image == NULL)
+    {
+        decode_error(decInfo, "INVALID: Unable to open file %s: %s", decInfo->stego_image_fname, strerror(errno));
+        return e_failure;
+    }
+    decInfo->stego_fd = fileno(decInfo->fptr_stego_image);
+    if (decInfo->io_mode == e_io_async && !stego_stream)
+    {
+        // Read-ahead stream (it keeps stego_fd open), anything but a regular file stays on stdio
+        FILE *async = aio_open(decInfo->fptr_stego_image, "r");
+        if (async != NULL)
+            decInfo->fptr_stego_image = async;
+    }
+
+    if (decInfo->io_mode == e_io_mmap)
+    {
+        // Map the whole image read-only; only the pages we decode get faulted in
+        struct stat st;
+        int fd = fileno(decInfo->fptr_stego_image);
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            decode_error(decInfo, "INVALID: Unable to map file %s", decInfo->stego_image_fname);
+            return e_failure;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            decode_error(decInfo, "mmap: %s", strerror(errno));
+            return e_failure;
+        }
+        decInfo->stego_map = map;
+        decInfo->stego_map_size = st.st_size;
+        if (bmp_parse_header(map, st.st_size, &decInfo->bmp) == e_failure)
+        {
+            decode_log(decInfo, "INVALID: Not a 24/32 bpp uncompressed BMP image.\n");
+            return e_failure;
+        }
+    }
+    else
+    {
+        // Parse the headers and stop at the first pixel byte (works on pipes)
+        unsigned char *header;
+        size_t header_size;
+        if (bmp_read_header(decInfo->fptr_stego_image, &header, &header_size, &decInfo->bmp) == e_failure)
+        {
+            decode_log(decInfo, "INVALID: Not a 24/32 bpp uncompressed BMP image.\n");
+            return e_failure;
+        }
+        free(header);
+    }
+    decInfo->stego_pos = decInfo->bmp.pixel_offset;
+    decInfo->carrier_index = 0;
+
+    decode_log(decInfo, "Stego image opened successfully: %s\n", decInfo->stego_image_fname);
+    return e_success;
+}
+
+/*
+ * Get the next n usable stego bytes (padding and alpha bytes skipped)
+ * stdio: read them into buffer
+ * mmap: point straight into the mapped image, or gather them into buffer
+ *       when padding or alpha bytes split them
+ */
+static const char *load_stego_bytes(DecodeInfo *decInfo, char *buffer, size_t n)
+{
+    const BmpInfo *bmp = &decInfo->bmp;
+    if (decInfo->carrier_index + n > bmp->capacity)
+        return NULL;
+    uint64_t first = bmp_carrier_offset(bmp, decInfo->carrier_index);
+    uint64_t end = bmp_span_end(bmp, decInfo->carrier_index, n);
+    const char *bytes = buffer;
+
+    if (decInfo->io_mode == e_io_mmap)
+    {
+        if (end > decInfo->stego_map_size)
+            return NULL;
+        if (end - first == n)
+            bytes = (const char *)decInfo->stego_map + first;
+        else
+            bmp_gather(bmp, decInfo->stego_map, 0, decInfo->carrier_index, n, (unsigned char *)buffer);
+    }
+    else if (first == decInfo->stego_pos && end - first == n)
+    {
+        if (fread(buffer, 1, n, decInfo->fptr_stego_image) != n)
+            return NULL;
+    }
+    else
+    {
+        // Read the raw span from the current position and pick the usable bytes
+        size_t raw_size = end - decInfo->stego_pos;
+        if (raw_size > decInfo->raw_buffer_size)
+        {
+            unsigned char *raw = realloc(decInfo->raw_buffer, raw_size);
+            if (raw == NULL)
+                return NULL;
+            decInfo->raw_buffer = raw;
+            decInfo->raw_buffer_size = raw_size;
+        }
+        if (fread(decInfo->raw_buffer, 1, raw_size, decInfo->fptr_stego_image) != raw_size)
+            return NULL;
+        bmp_gather(bmp, decInfo->raw_buffer, decInfo->stego_pos, decInfo->carrier_index, n, (unsigned char *)buffer);
+    }
+
+    decInfo->stego_pos = end;
+    decInfo->carrier_index += n;
+    return bytes;
+}
+
+/* Next n header bytes, 1 bit per carrier byte */
+static Status load_header_bytes(DecodeInfo *decInfo, unsigned char *out, size_t n)
+{
+    char image_buffer[8 * STEG_MAX_HEADER];
+    const char *bytes = load_stego_bytes(decInfo, image_buffer, 8 * n);
+    if (bytes == NULL)
+        return e_failure;
+    lsb_extract((const unsigned char *)bytes, n, out);
+    return e_success;
+}
+
+/*
+ * Read the first STEG_PROBE_SIZE header bytes into fields and settle the
+ * carrier layout: legacy headers were embedded into the raw pixel array,
+ * version 2 ones skip row padding and alpha bytes. The raw bytes are
+ * read first, then the rest of the span the version 2 bytes take, so
+ * nothing is read twice and a pipe works either way.
+ */
+static Status probe_layout(DecodeInfo *decInfo, unsigned char *fields)
+{
+    const size_t probe_bytes = 8 * STEG_PROBE_SIZE;
+    BmpInfo layout = decInfo->bmp;
+    unsigned char raw[8 * STEG_MAX_HEADER], gathered[8 * STEG_PROBE_SIZE];
+    char buffer[8 * STEG_MAX_HEADER];
+    uint64_t span = layout.capacity < probe_bytes ? 0 : bmp_span_end(&layout, 0, probe_bytes) - layout.pixel_offset;
+    bmp_use_legacy_layout(&decInfo->bmp);
+    const char *bytes = span ? load_stego_bytes(decInfo, buffer, probe_bytes) : NULL;
+    if (bytes == NULL)
+    {
+        decode_log(decInfo, "INVALID: Stego image too small.\n");
+        return e_failure;
+    }
+    memcpy(raw, bytes, probe_bytes);
+    lsb_extract(raw, STEG_PROBE_SIZE, fields);
+    int version = steg_probe_version(fields);
+    if (version == STEG_HEADER_V0 || version == STEG_HEADER_V1)
+        return e_success;
+
+    decInfo->bmp = layout;
+    if (span > probe_bytes)
+    {
+        // Still raw bytes, carrier_index follows the stream position until the layout switches
+        BmpInfo legacy = layout;
+        bmp_use_legacy_layout(&legacy);
+        decInfo->bmp = legacy;
+        bytes = load_stego_bytes(decInfo, buffer, span - probe_bytes);
+        decInfo->bmp = layout;
+        if (bytes == NULL)
+        {
+            decode_log(decInfo, "INVALID: Stego image too small.\n");
+            return e_failure;
+        }
+        memcpy(raw + probe_bytes, bytes, span - probe_bytes);
+    }
+    bmp_gather(&layout, raw, layout.pixel_offset, 0, probe_bytes, gathered);
+    lsb_extract(gathered, STEG_PROBE_SIZE, fields);
+    decInfo->carrier_index = probe_bytes;
+    return e_success;
+}
+
+/*
+ * Decode the stego header, legacy or version 2: the magic string first,
+ * then as many more bytes as steg_header_need() asks for until it is
+ * complete. Every read stays inside the header, so a piped image works.
+ */
+Status decode_stego_header(DecodeInfo *decInfo, off_t *size)
+{
+    // Start at the first pixel byte, open_decode_files() already read up to it
+    // (a pipe can't seek back, a regular file is re-positioned)
+    decInfo->stego_pos = decInfo->bmp.pixel_offset;
+    decInfo->carrier_index = 0;
+    if (decInfo->io_mode != e_io_mmap && decInfo->fptr_stego_image != stdin)
+        fseeko(decInfo->fptr_stego_image, (off_t)decInfo->bmp.pixel_offset, SEEK_SET);
+
+    unsigned char fields[STEG_MAX_HEADER];
+    size_t have = STEG_PROBE_SIZE;
+    if (probe_layout(decInfo, fields) == e_failure)
+        return e_failure;
+    size_t need = steg_header_need(fields, have);
+    if (need == 0)
+    {
+        decode_log(decInfo, "INVALID: Magic string mismatch. Not a valid stego image.\n");
+        return e_failure;
+    }
+    decode_log(decInfo, "Magic string verified successfully: %s\n", MAGIC_STRING);
+    while (need > have)
+    {
+        if (load_header_bytes(decInfo, fields + have, need - have) == e_failure)
+        {
+            decode_log(decInfo, "INVALID: Stego image ended inside the stego header.\n");
+            return e_failure;
+        }
+        have = need;
+        need = steg_header_need(fields, have);
+    }
+
+    StegHeader header;
+    if (steg_parse_header(fields, have, &header) == e_failure)
+    {
+        decode_log(decInfo, "INVALID: Corrupt stego header (%s)\n", header.error);
+        return e_failure;
+    }
+    decInfo->header_version = header.version;
+    decInfo->depth = header.depth;
+    decInfo->flags = header.flags;
+    decInfo->ecc_parity = header.ecc_parity;
+    strcpy(decInfo->extn_secret_file, header.extn);
+    *size = header.payload_size;
+    decInfo->size_secret_file = *size;
+    decInfo->payload_index = decInfo->carrier_index;
+
+    decode_log(decInfo, "Decoded stego header version %d (%zu bytes)\n", header.version, have);
+    if (decInfo->depth > 1)
+        decode_log(decInfo, "Decoded embedding depth = %d bits per byte\n", decInfo->depth);
+    if (decInfo->flags & STEG_FLAG_COMPRESSED)
+        decode_log(decInfo, "Payload is compressed\n");
+    if (decInfo->flags & STEG_FLAG_ENCRYPTED)
+        decode_log(decInfo, "Payload is encrypted\n");
+    if (decInfo->flags & STEG_FLAG_SCATTERED)
+        decode_log(decInfo, "Payload is scattered\n");
+    if (decInfo->flags & STEG_FLAG_DIRECTORY)
+        decode_log(decInfo, "Payload is a directory container\n");
+    if (decInfo->flags & STEG_FLAG_ECC)
+        decode_log(decInfo, "Payload is error corrected (%d parity bytes per %d byte codeword)\n",
+                   decInfo->ecc_parity, ECC_SYMBOLS);
+    decode_log(decInfo, "Decoded extension = %s\n", decInfo->extn_secret_file);
+    decode_log(decInfo, "Decoded secret file size = %lld bytes\n", (long long)*size);
+    if ((decInfo->flags & (STEG_FLAG_ENCRYPTED | STEG_FLAG_SCATTERED)) &&
+        (decInfo->passphrase == NULL || decInfo->passphrase[0] == '\0'))
+    {
+        decode_log(decInfo, "INVALID: Payload is keyed, give a passphrase (--passphrase-file or STEG_PASSPHRASE).\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Name the output after the decoded extension */
+Status decode_secret_file_extn(DecodeInfo *decInfo)
+{
+    if (decode_to_stdout(decInfo))
+    {
+        decInfo->fptr_output = stdout;
+        return e_success;
+    }
+    // -v checks the payload without writing it anywhere, container
+    // entries are opened by decode_directory()
+    if (decInfo->verify || ((decInfo->flags & STEG_FLAG_DIRECTORY) && !decInfo->range))
+        return e_success;
+
+    // Append extension to output filename (an fd:N output is already named),
+    // the file itself is only created once the payload checks out
+    if (strncmp(decInfo->output_fname, "fd:", 3) != 0)
+    {
+        if (strlen(decInfo->output_fname) + strlen(decInfo->extn_secret_file) >= sizeof(decInfo->output_fname))
+        {
+            decode_log(decInfo, "INVALID: Output file name is too long.\n");
+            return e_failure;
+        }
+        strcat(decInfo->output_fname, decInfo->extn_secret_file);
+    }
+    return e_success;
+}
+
+/*
+ * A named output is written to <output>.steg-XXXXXX beside it, which
+ * do_decoding() renames once the payload and its checksum check out
+ */
+static FILE *open_output_temp(DecodeInfo *decInfo)
+{
+    static unsigned counter;
+    int fd = -1;
+    for (int attempt = 0; attempt < 64 && fd < 0; attempt++)
+    {
+        unsigned tag = (unsigned)getpid() ^ __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED) * 0x9E3779B1u;
+        snprintf(decInfo->output_temp, sizeof(decInfo->output_temp), "%s.steg-%06x", decInfo->output_fname,
+                 tag & 0xFFFFFF);
+        // Not mkstemp(): the umask, not 0600, sets the mode of the output
+        fd = open(decInfo->output_temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd < 0 && errno != EEXIST)
+            break;
+    }
+    FILE *fptr = fd < 0 ? NULL : fdopen(fd, "w");
+    if (fptr == NULL)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(decInfo->output_temp);
+        }
+        decInfo->output_temp[0] = '\0';
+    }
+    return fptr;
+}
+
+/*
+ * Create the output file once the payload is known to be in the image,
+ * so a corrupt or truncated header leaves nothing behind. Writes go out
+ * a block of up to STEG_BLOCK_SIZE per syscall, and a regular file gets
+ * the extent of a plain payload allocated up front.
+ */
+static Status open_output(DecodeInfo *decInfo, off_t size)
+{
+    if (decInfo->fptr_output != NULL || decInfo->verify)
+        return e_success;
+
+    if (strncmp(decInfo->output_fname, "fd:", 3) == 0)
+        decInfo->fptr_output = open_stream(decInfo->output_fname, "w");
+    else
+        decInfo->fptr_output = open_output_temp(decInfo);
+    if (decInfo->fptr_output == NULL)
+    {
+        decode_error(decInfo, "INVALID: Unable to open output file %s: %s", decInfo->output_fname, strerror(errno));
+        return e_failure;
+    }
+    if (size > BUFSIZ)
+    {
+        size_t buffer_size = size < STEG_BLOCK_SIZE ? (size_t)size : STEG_BLOCK_SIZE;
+        decInfo->output_buffer = malloc(buffer_size);
+        if (decInfo->output_buffer != NULL)
+            setvbuf(decInfo->fptr_output, decInfo->output_buffer, _IOFBF, buffer_size);
+    }
+    // Best effort: tmpfs, memfds and most disk filesystems take it
+    struct stat st;
+    int fd = fileno(decInfo->fptr_output);
+    if (!(decInfo->flags & (STEG_FLAG_COMPRESSED | STEG_FLAG_ENCRYPTED)) && size > 0 &&
+        fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+
+    decode_log(decInfo, "Output file created: %s\n", decInfo->output_fname);
+    return e_success;
+}
+
+/* Mapped stego span and output file shared by the extract workers */
+typedef struct _ExtractJob
+{
+    const unsigned char *map;   // Mapped stego image
+    const BmpInfo *bmp;
+    uint64_t first_index;       // Carrier index of payload byte 0
+    int depth;                  // Payload bits per carrier byte
+    size_t size;
+    int output_fd;
+    const ScatterMap *scatter;  // Tile permutation, NULL for a sequential payload
+    uint32_t *crc;              // CRC32C of each worker's slice, NULL without a checksum
+    Status *status;             // One per worker
+} ExtractJob;
+
+static void extract_worker(void *ctx, int index, int nthreads)
+{
+    ExtractJob *job = ctx;
+    size_t begin, end;
+    parallel_range(job->size, STEG_PARALLEL_GRAIN, index, nthreads, &begin, &end);
+
+    job->status[index] = e_success;
+    if (job->crc != NULL)
+        job->crc[index] = 0;
+    const size_t per_byte = 8 / job->depth;
+    unsigned char *secret_buffer = malloc(STEG_SECRET_CHUNK);
+    unsigned char *scratch = job->bmp->contiguous ? NULL : malloc(STEG_BLOCK_SIZE);
+    if (secret_buffer == NULL || (scratch == NULL && !job->bmp->contiguous))
+    {
+        free(secret_buffer);
+        free(scratch);
+        job->status[index] = e_failure;
+        return;
+    }
+    // Every thread writes its own slice of the output with pwrite
+    for (size_t done = begin; done < end; )
+    {
+        size_t chunk = end - done < STEG_SECRET_CHUNK ? end - done : STEG_SECRET_CHUNK;
+        uint64_t carrier_index = job->first_index + done * per_byte;
+        if (job->scatter != NULL)
+        {
+            // One tile at a time, wherever the key put it
+            size_t tile_left = scatter_run(done * per_byte) / per_byte;
+            chunk = chunk < tile_left ? chunk : tile_left;
+            carrier_index = scatter_index(job->scatter, done * per_byte);
+        }
+        const unsigned char *carrier = job->map + bmp_carrier_offset(job->bmp, carrier_index);
+        if (scratch != NULL)
+        {
+            // Padding or alpha bytes split the span, gather the usable ones
+            bmp_gather(job->bmp, job->map, 0, carrier_index, chunk * per_byte, scratch);
+            carrier = scratch;
+        }
+        lsb_extract_bits(carrier, chunk, secret_buffer, job->depth);
+        if (job->crc != NULL)
+            job->crc[index] = crc32c_update(job->crc[index], secret_buffer, chunk);
+        if (job->output_fd >= 0 && pwrite(job->output_fd, secret_buffer, chunk, done) != (ssize_t)chunk)
+        {
+            job->status[index] = e_failure;
+            break;
+        }
+        done += chunk;
+    }
+    free(secret_buffer);
+    free(scratch);
+}
+
+/* mmap mode with -j N: extract slices of the payload on several threads */
+static Status decode_secret_file_data_parallel(DecodeInfo *decInfo, off_t size)
+{
+    uint64_t carrier_bytes = (uint64_t)size * 8 / decInfo->depth;
+    if (!(decInfo->flags & STEG_FLAG_SCATTERED) &&
+        (decInfo->carrier_index + carrier_bytes > decInfo->bmp.capacity ||
+         bmp_span_end(&decInfo->bmp, decInfo->carrier_index, carrier_bytes) > decInfo->stego_map_size))
+    {
+        decode_log(decInfo, "INVALID: Stego image ended before the secret data.\n");
+        return e_failure;
+    }
+
+    int checksum = decInfo->flags & STEG_FLAG_CHECKSUM;
+    Status *status = malloc(sizeof(Status) * decInfo->threads);
+    uint32_t *crc = malloc(sizeof(uint32_t) * decInfo->threads);
+    if (status == NULL || crc == NULL)
+    {
+        free(status);
+        free(crc);
+        return e_failure;
+    }
+
+    int output_fd = -1;
+    if (decInfo->fptr_output != NULL)
+    {
+        fflush(decInfo->fptr_output);
+        output_fd = fileno(decInfo->fptr_output);
+    }
+    ExtractJob job = {decInfo->stego_map, &decInfo->bmp, decInfo->carrier_index, decInfo->depth, size, output_fd,
+                      decInfo->flags & STEG_FLAG_SCATTERED ? &decInfo->scatter_map : NULL, checksum ? crc : NULL, status};
+    Status result = parallel_run(decInfo->threads, extract_worker, &job);
+    for (int i = 0; i < decInfo->threads; i++)
+    {
+        if (status[i] == e_failure)
+            result = e_failure;
+        if (checksum)
+        {
+            // Chain the slice CRCs in payload order
+            size_t begin, end;
+            parallel_range(size, STEG_PARALLEL_GRAIN, i, decInfo->threads, &begin, &end);
+            decInfo->payload_crc = crc32c_combine(decInfo->payload_crc, crc[i], end - begin);
+        }
+    }
+    free(status);
+    free(crc);
+    decInfo->stego_pos = bmp_span_end(&decInfo->bmp, decInfo->carrier_index, carrier_bytes);
+    decInfo->carrier_index += carrier_bytes;
+
+    if (result == e_success)
+        decode_log(decInfo, "Decoded secret data successfully.\n");
+    return result;
+}
+
+/* DataSink writing the payload (decompressed blocks or raw chunks) to the output */
+static Status write_output(void *ctx, const unsigned char *data, size_t n)
+{
+    DecodeInfo *decInfo = ctx;
+    if (decInfo->fptr_output == NULL)
+        return e_success;
+    return fwrite(data, 1, n, decInfo->fptr_output) == n ? e_success : e_failure;
+}
+
+/* The stages behind the extraction, each one present only when the payload flags call for it */
+typedef struct
+{
+    SealDecoder *seal;
+    LzDecoder *lz;
+    DecodeInfo *decInfo;
+} UnpackStages;
+
+/* DataSink between the seal and lz stages: opened segments go on to be inflated */
+static Status inflate_output(void *ctx, const unsigned char *data, size_t n)
+{
+    UnpackStages *stages = ctx;
+    return lz_decoder_feed(stages->lz, data, n, write_output, stages->decInfo);
+}
+
+/* DataSink taking the payload as embedded (or as corrected by ecc.h) through seal and lz to the output */
+static Status unpack_output(void *ctx, const unsigned char *data, size_t n)
+{
+    UnpackStages *stages = ctx;
+    if (stages->seal != NULL)
+        return stages->lz ? seal_decoder_feed(stages->seal, data, n, inflate_output, stages)
+                          : seal_decoder_feed(stages->seal, data, n, write_output, stages->decInfo);
+    if (stages->lz != NULL)
+        return inflate_output(stages, data, n);
+    return write_output(stages->decInfo, data, n);
+}
+
+/*
+ * Scatter mode: move the reader to the carrier byte the key put payload
+ * carrier byte offset at (a stdio stego image has to be seekable)
+ */
+static Status seek_scattered(DecodeInfo *decInfo, uint64_t offset)
+{
+    uint64_t index = scatter_index(&decInfo->scatter_map, offset);
+    if (decInfo->io_mode != e_io_mmap)
+    {
+        uint64_t pos = bmp_carrier_offset(&decInfo->bmp, index);
+        if (fseeko(decInfo->fptr_stego_image, pos, SEEK_SET) != 0)
+        {
+            decode_log(decInfo, "INVALID: A scattered payload needs a seekable stego image.\n");
+            return e_failure;
+        }
+        decInfo->stego_pos = pos;
+    }
+    decInfo->carrier_index = index;
+    return e_success;
+}
+
+/*
+ * Fail before extracting anything when the payload the header promises
+ * can't be in the image: past the pixel array, or past the end of a
+ * truncated file
+ */
+static Status check_payload_extent(DecodeInfo *decInfo, off_t size)
+{
+    uint64_t stored = (uint64_t)size + (decInfo->flags & STEG_FLAG_CHECKSUM ? STEG_CHECKSUM_SIZE : 0);
+    uint64_t carrier_bytes = stored * 8 / decInfo->depth;
+    uint64_t end;
+    if (decInfo->flags & STEG_FLAG_SCATTERED)
+    {
+        if (scatter_init(&decInfo->scatter_map, decInfo->passphrase, &decInfo->bmp, decInfo->payload_index) == e_failure ||
+            carrier_bytes > scatter_capacity(&decInfo->scatter_map))
+        {
+            decode_log(decInfo, "INVALID: Stego image ended before the secret data.\n");
+            return e_failure;
+        }
+        end = bmp_span_end(&decInfo->bmp, decInfo->scatter_map.base, scatter_capacity(&decInfo->scatter_map));
+    }
+    else
+    {
+        if (decInfo->payload_index + carrier_bytes > decInfo->bmp.capacity)
+        {
+            decode_log(decInfo, "INVALID: Stego image ended before the secret data.\n");
+            return e_failure;
+        }
+        end = bmp_span_end(&decInfo->bmp, decInfo->payload_index, carrier_bytes);
+    }
+
+    struct stat st;
+    if (fstat(decInfo->stego_fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size < end)
+    {
+        decode_log(decInfo, "INVALID: Stego image is truncated, the payload needs %llu bytes but the file has %llu.\n",
+                   (unsigned long long)end, (unsigned long long)st.st_size);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Decode Secret File Data */
+Status decode_secret_file_data(DecodeInfo *decInfo, off_t size)
+{
+    int scattered = decInfo->flags & STEG_FLAG_SCATTERED;
+    int checksum = decInfo->flags & STEG_FLAG_CHECKSUM;
+    if (check_payload_extent(decInfo, size) == e_failure)
+        return e_failure;
+
+    // A compressed, sealed or error corrected payload can't be split into
+    // output slices (unknown plain size, segments and codewords must be
+    // verified in order), so it is always unpacked sequentially
+    int compressed = decInfo->flags & STEG_FLAG_COMPRESSED;
+    int encrypted = decInfo->flags & STEG_FLAG_ENCRYPTED;
+    int corrected = decInfo->flags & STEG_FLAG_ECC;
+    uint64_t output_size = size;
+    if (corrected)
+        ecc_data_size(size, decInfo->ecc_parity, &output_size);
+    if (open_output(decInfo, output_size) == e_failure)
+        return e_failure;
+    if (decInfo->io_mode == e_io_mmap && decInfo->threads > 1 && !decode_to_stdout(decInfo) && !compressed && !encrypted &&
+        !corrected)
+    {
+        decode_log(decInfo, "Decoding secret file data on %d threads...\n", decInfo->threads);
+        return decode_secret_file_data_parallel(decInfo, size);
+    }
+
+    // Use the caller's work buffers when given, mmap mode on a contiguous
+    // pixel array needs no carrier buffer
+    char *image_buffer = NULL;
+    int need_image_buffer = decInfo->io_mode != e_io_mmap || !decInfo->bmp.contiguous;
+    if (need_image_buffer)
+        image_buffer = decInfo->block_buffer ? decInfo->block_buffer : malloc(STEG_BLOCK_SIZE);
+    unsigned char *secret_buffer = decInfo->chunk_buffer ? (unsigned char *)decInfo->chunk_buffer : malloc(STEG_SECRET_CHUNK);
+    LzDecoder *lz = compressed ? malloc(sizeof(LzDecoder)) : NULL;
+    SealDecoder *seal = encrypted ? malloc(sizeof(SealDecoder)) : NULL;
+    EccDecoder *ecc = corrected ? malloc(sizeof(EccDecoder)) : NULL;
+    if ((image_buffer == NULL && need_image_buffer) || secret_buffer == NULL || (lz == NULL && compressed) ||
+        (seal == NULL && encrypted) || (ecc == NULL && corrected))
+    {
+        if (image_buffer != decInfo->block_buffer)
+            free(image_buffer);
+        if (secret_buffer != (unsigned char *)decInfo->chunk_buffer)
+            free(secret_buffer);
+        free(lz);
+        free(seal);
+        free(ecc);
+        return e_failure;
+    }
+    if (lz != NULL)
+        lz_decoder_init(lz);
+    UnpackStages stages = {seal, lz, decInfo};
+
+    Status status = e_success;
+    if (ecc != NULL && ecc_decoder_init(ecc, decInfo->ecc_parity, size) == e_failure)
+    {
+        decode_log(decInfo, "INVALID: Error corrected payload is truncated.\n");
+        status = e_failure;
+    }
+    if (status == e_success && seal != NULL && seal_decoder_init(seal, decInfo->passphrase, output_size) == e_failure)
+    {
+        decode_log(decInfo, "INVALID: Encrypted payload is truncated.\n");
+        status = e_failure;
+    }
+    decode_log(decInfo, "Decoding secret file data...\n");
+    const size_t per_byte = 8 / decInfo->depth;
+    for (off_t done = 0; status == e_success && done < size; )
+    {
+        size_t chunk = size - done < STEG_SECRET_CHUNK ? (size_t)(size - done) : STEG_SECRET_CHUNK;
+        if (scattered)
+        {
+            size_t tile_left = scatter_run(done * per_byte) / per_byte;
+            chunk = chunk < tile_left ? chunk : tile_left;
+            if (seek_scattered(decInfo, done * per_byte) == e_failure)
+            {
+                status = e_failure;
+                break;
+            }
+        }
+        const char *bytes = load_stego_bytes(decInfo, image_buffer, chunk * 8 / decInfo->depth);
+        if (bytes == NULL)
+        {
+            decode_log(decInfo, "INVALID: Stego image ended before the secret data.\n");
+            status = e_failure;
+            break;
+        }
+        lsb_extract_bits((const unsigned char *)bytes, chunk, secret_buffer, decInfo->depth);
+        // The ecc stage checksums the stream once it is corrected
+        if (checksum && ecc == NULL)
+            decInfo->payload_crc = crc32c_update(decInfo->payload_crc, secret_buffer, chunk);
+        // Extracted bytes -> ecc (correct) -> seal (verify, decrypt) -> lz (inflate) -> output
+        Status written = ecc ? ecc_decoder_feed(ecc, secret_buffer, chunk, unpack_output, &stages)
+                             : unpack_output(&stages, secret_buffer, chunk);
+        if (written == e_failure)
+        {
+            if (seal != NULL)
+                decode_log(decInfo, "INVALID: Wrong passphrase or tampered payload.\n");
+            else if (lz != NULL)
+                decode_log(decInfo, "INVALID: Corrupt compressed payload.\n");
+            status = e_failure;
+            break;
+        }
+        done += chunk;
+    }
+    if (ecc != NULL)
+    {
+        decode_log(decInfo, "Error correction: %llu of %llu codewords repaired (%llu bytes), %llu beyond repair\n",
+                   (unsigned long long)ecc->repaired, (unsigned long long)ecc->codewords,
+                   (unsigned long long)ecc->repaired_bytes, (unsigned long long)ecc->failed);
+        if (ecc->failed > 0 && status == e_success)
+        {
+            decode_log(decInfo, "INVALID: Payload is damaged past what its parity can repair.\n");
+            status = e_failure;
+        }
+        if (status == e_success && ecc_decoder_finish(ecc) == e_failure)
+        {
+            decode_log(decInfo, "INVALID: Error corrected payload is truncated.\n");
+            status = e_failure;
+        }
+        decInfo->payload_crc = ecc->crc;
+    }
+    if (seal != NULL && seal_decoder_finish(seal) == e_failure && status == e_success)
+    {
+        decode_log(decInfo, "INVALID: Encrypted payload is truncated.\n");
+        status = e_failure;
+    }
+    if (status == e_success && lz != NULL && lz_decoder_finish(lz) == e_failure)
+    {
+        decode_log(decInfo, "INVALID: Compressed payload is truncated.\n");
+        status = e_failure;
+    }
+    if (image_buffer != decInfo->block_buffer)
+        free(image_buffer);
+    if (secret_buffer != (unsigned char *)decInfo->chunk_buffer)
+        free(secret_buffer);
+    free(lz);
+    free(seal);
+    free(ecc);
+
+    if (status == e_success)
+        decode_log(decInfo, "Decoded secret data successfully.\n");
+    return status;
+}
+
+/*
+ * Move the reader to payload byte offset, straight behind the header
+ * or in its scattered tile (a stdio stego image has to be seekable)
+ */
+static Status seek_payload(DecodeInfo *decInfo, uint64_t offset)
+{
+    uint64_t carrier_offset = offset * 8 / decInfo->depth;
+    if (decInfo->flags & STEG_FLAG_SCATTERED)
+        return seek_scattered(decInfo, carrier_offset);
+
+    uint64_t index = decInfo->payload_index + carrier_offset;
+    if (decInfo->io_mode != e_io_mmap && index != decInfo->carrier_index)
+    {
+        uint64_t pos = bmp_carrier_offset(&decInfo->bmp, index);
+        if (fseeko(decInfo->fptr_stego_image, pos, SEEK_SET) != 0)
+        {
+            // A pipe can still be read forward up to the entry
+            char skipped[64 * 1024];
+            while (pos > decInfo->stego_pos)
+            {
+                size_t n = pos - decInfo->stego_pos < sizeof(skipped) ? pos - decInfo->stego_pos : sizeof(skipped);
+                if (fread(skipped, 1, n, decInfo->fptr_stego_image) != n)
+                    break;
+                decInfo->stego_pos += n;
+            }
+            if (pos != decInfo->stego_pos)
+            {
+                decode_log(decInfo, "INVALID: Seeking back in the payload needs a seekable stego image.\n");
+                return e_failure;
+            }
+        }
+        decInfo->stego_pos = pos;
+    }
+    decInfo->carrier_index = index;
+    return e_success;
+}
+
+/*
+ * Extract payload bytes [offset, offset + n) of an untransformed
+ * payload into sink, seeking straight to the first one, and return
+ * their CRC32C in crc
+ */
+static Status extract_payload_range(DecodeInfo *decInfo, uint64_t offset, uint64_t n,
+                                    DataSink sink, void *ctx, uint32_t *crc)
+{
+    int scattered = decInfo->flags & STEG_FLAG_SCATTERED;
+    char *image_buffer = decInfo->block_buffer ? decInfo->block_buffer : malloc(STEG_BLOCK_SIZE);
+    unsigned char *secret_buffer = decInfo->chunk_buffer ? (unsigned char *)decInfo->chunk_buffer : malloc(STEG_SECRET_CHUNK);
+    Status status = image_buffer && secret_buffer ? e_success : e_failure;
+
+    const size_t per_byte = 8 / decInfo->depth;
+    *crc = 0;
+    for (uint64_t done = offset; status == e_success && done < offset + n; )
+    {
+        size_t chunk = offset + n - done < STEG_SECRET_CHUNK ? (size_t)(offset + n - done) : STEG_SECRET_CHUNK;
+        if (scattered)
+        {
+            size_t tile_left = scatter_run(done * per_byte) / per_byte;
+            chunk = chunk < tile_left ? chunk : tile_left;
+        }
+        if ((scattered || done == offset) && seek_payload(decInfo, done) == e_failure)
+        {
+            status = e_failure;
+            break;
+        }
+        const char *bytes = load_stego_bytes(decInfo, image_buffer, chunk * per_byte);
+        if (bytes == NULL)
+        {
+            decode_log(decInfo, "INVALID: Stego image ended before the secret data.\n");
+            status = e_failure;
+            break;
+        }
+        lsb_extract_bits((const unsigned char *)bytes, chunk, secret_buffer, decInfo->depth);
+        *crc = crc32c_update(*crc, secret_buffer, chunk);
+        status = sink(ctx, secret_buffer, chunk);
+        done += chunk;
+    }
+    if (image_buffer != decInfo->block_buffer)
+        free(image_buffer);
+    if (secret_buffer != (unsigned char *)decInfo->chunk_buffer)
+        free(secret_buffer);
+    return status;
+}
+
+/* DataSink collecting a directory in memory */
+typedef struct
+{
+    unsigned char *data;
+    size_t used;
+} BufferSink;
+
+static Status fill_buffer(void *ctx, const unsigned char *data, size_t n)
+{
+    BufferSink *buffer = ctx;
+    memcpy(buffer->data + buffer->used, data, n);
+    buffer->used += n;
+    return e_success;
+}
+
+/* Read just the directory at the front of a container payload */
+static Status read_directory(DecodeInfo *decInfo, off_t size, Directory *dir)
+{
+    unsigned char prefix[DIR_PREFIX_SIZE];
+    BufferSink sink = {prefix, 0};
+    uint32_t dir_size, count;
+    uint32_t crc;
+    if (size < DIR_PREFIX_SIZE ||
+        extract_payload_range(decInfo, 0, DIR_PREFIX_SIZE, fill_buffer, &sink, &crc) == e_failure ||
+        dir_parse_prefix(prefix, &dir_size, &count) == e_failure || dir_size > (uint64_t)size)
+    {
+        decode_log(decInfo, "INVALID: Corrupt container directory.\n");
+        return e_failure;
+    }
+
+    unsigned char *data = malloc(dir_size);
+    if (data == NULL)
+        return e_failure;
+    memcpy(data, prefix, DIR_PREFIX_SIZE);
+    sink.data = data;
+    Status status = extract_payload_range(decInfo, DIR_PREFIX_SIZE, dir_size - DIR_PREFIX_SIZE, fill_buffer, &sink, &crc);
+    if (status == e_success && dir_parse(data, dir_size, size, dir) == e_failure)
+    {
+        decode_log(decInfo, "INVALID: Corrupt container directory.\n");
+        status = e_failure;
+    }
+    free(data);
+    return status;
+}
+
+/* Extract one entry to the output through its directory offset, checking its CRC32C */
+static Status decode_entry(DecodeInfo *decInfo, const DirEntry *entry)
+{
+    uint32_t crc;
+    if (extract_payload_range(decInfo, entry->offset, entry->length, write_output, decInfo, &crc) == e_failure)
+        return e_failure;
+    if (crc != entry->crc)
+    {
+        decode_log(decInfo, "INVALID: Entry %s checksum mismatch (stored %08x, computed %08x).\n",
+                   entry->name, entry->crc, crc);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/*
+ * Container payloads: list the directory (-l), extract the entry
+ * named entry_name (-x) or, for -v, check every entry against its
+ * CRC32C. Only the directory and the bytes of the wanted entry are read.
+ */
+Status decode_directory(DecodeInfo *decInfo, off_t size)
+{
+    if (check_payload_extent(decInfo, size) == e_failure)
+        return e_failure;
+    Directory dir;
+    if (read_directory(decInfo, size, &dir) == e_failure)
+        return e_failure;
+
+    Status status = e_success;
+    if (decInfo->list)
+    {
+        decode_log(decInfo, "%zu entries:\n", dir.count);
+        for (size_t i = 0; i < dir.count; i++)
+        {
+            decode_log(decInfo, "  %12llu  %08x  %s\n", (unsigned long long)dir.entries[i].length,
+                       dir.entries[i].crc, dir.entries[i].name);
+        }
+    }
+    else if (decInfo->verify)
+    {
+        for (size_t i = 0; status == e_success && i < dir.count; i++)
+            status = decode_entry(decInfo, &dir.entries[i]);
+        if (status == e_success)
+            decode_log(decInfo, "All %zu entries verified\n", dir.count);
+    }
+    else if (decInfo->entry_name == NULL)
+    {
+        decode_log(decInfo, "INVALID: Image holds a directory of %zu entries, list it with -l and extract one with -x.\n",
+                   dir.count);
+        status = e_failure;
+    }
+    else
+    {
+        const DirEntry *entry = dir_find(&dir, decInfo->entry_name);
+        if (entry == NULL)
+        {
+            decode_log(decInfo, "INVALID: No entry named %s.\n", decInfo->entry_name);
+            status = e_failure;
+        }
+        else
+        {
+            if (decode_to_stdout(decInfo))
+                decInfo->fptr_output = stdout;
+            else
+                decInfo->fptr_output = open_stream(decInfo->output_fname, "w");
+            if (decInfo->fptr_output == NULL)
+            {
+                decode_error(decInfo, "INVALID: Unable to open output file %s: %s", decInfo->output_fname,
+                             strerror(errno));
+                status = e_failure;
+            }
+            else
+            {
+                decode_log(decInfo, "Extracting %s (%llu bytes at payload offset %llu)\n", entry->name,
+                           (unsigned long long)entry->length, (unsigned long long)entry->offset);
+                status = decode_entry(decInfo, entry);
+                if (status == e_success)
+                    decode_log(decInfo, "Entry %s extracted to %s\n", entry->name, decInfo->output_fname);
+            }
+        }
+    }
+    dir_free(&dir);
+    return status;
+}
+
+/*
+ * --range: extract only payload bytes [range_offset, range_offset +
+ * range_length), cut at the end of the payload. The reader seeks
+ * straight to the first carrier byte, so a preview of a large payload
+ * costs as much as the preview.
+ */
+Status decode_secret_file_range(DecodeInfo *decInfo, off_t size)
+{
+    if (decInfo->flags & (STEG_FLAG_COMPRESSED | STEG_FLAG_ENCRYPTED | STEG_FLAG_ECC))
+    {
+        decode_log(decInfo, "INVALID: A compressed, encrypted or error corrected payload can't be cut by byte range.\n");
+        return e_failure;
+    }
+    if (decInfo->range_offset > (uint64_t)size)
+    {
+        decode_log(decInfo, "INVALID: Range starts at byte %llu, past the %lld byte payload.\n",
+                   (unsigned long long)decInfo->range_offset, (long long)size);
+        return e_failure;
+    }
+    if (check_payload_extent(decInfo, size) == e_failure)
+        return e_failure;
+
+    uint64_t length = (uint64_t)size - decInfo->range_offset;
+    if (decInfo->range_length < length)
+        length = decInfo->range_length;
+    if (open_output(decInfo, length) == e_failure)
+        return e_failure;
+    decode_log(decInfo, "Decoding %llu bytes of secret data from byte %llu...\n",
+               (unsigned long long)length, (unsigned long long)decInfo->range_offset);
+    uint32_t crc;
+    if (extract_payload_range(decInfo, decInfo->range_offset, length, write_output, decInfo, &crc) == e_failure)
+        return e_failure;
+    decode_log(decInfo, "Decoded secret data range successfully.\n");
+    return e_success;
+}
+
+/* Compare the CRC32C taken while extracting with the one stored behind the payload */
+Status decode_checksum(DecodeInfo *decInfo, off_t size)
+{
+    const size_t per_byte = 8 / decInfo->depth;
+    char image_buffer[8];
+    unsigned char stored[STEG_CHECKSUM_SIZE];
+    for (int i = 0; i < STEG_CHECKSUM_SIZE; i++)
+    {
+        // Byte by byte, a scattered checksum may straddle two tiles
+        if ((decInfo->flags & STEG_FLAG_SCATTERED) &&
+            seek_scattered(decInfo, ((uint64_t)size + i) * per_byte) == e_failure)
+            return e_failure;
+        const char *bytes = load_stego_bytes(decInfo, image_buffer, per_byte);
+        if (bytes == NULL)
+        {
+            decode_log(decInfo, "INVALID: Stego image ended before the payload checksum.\n");
+            return e_failure;
+        }
+        lsb_extract_bits((const unsigned char *)bytes, 1, stored + i, decInfo->depth);
+    }
+    uint32_t expected = ((uint32_t)stored[0] << 24) | ((uint32_t)stored[1] << 16) | ((uint32_t)stored[2] << 8) | stored[3];
+    if (expected != decInfo->payload_crc)
+    {
+        decode_log(decInfo, "INVALID: Payload checksum mismatch (stored %08x, computed %08x).\n",
+                   expected, decInfo->payload_crc);
+        return e_failure;
+    }
+    decode_log(decInfo, "Payload checksum verified (crc32c %08x)\n", expected);
+    return e_success;
+}
+
+/* Utility Functions */
+char decode_byte_from_lsb(char *image_buffer)
+{
+    unsigned char data;
+    lsb_extract((unsigned char *)image_buffer, 1, &data);
+    return (char)data;
+}
+
+int decode_size_from_lsb(char *image_buffer)
+{
+    // Sizes are stored MSB first, i.e. as 4 big endian bytes
+    unsigned char bytes[4];
+    lsb_extract((unsigned char *)image_buffer, 4, bytes);
+    uint size = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        size = (size << 8) | bytes[i];
+    }
+    return (int)size;
+}
+
+/* Main Decoding Orchestrator */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    decode_log(decInfo, "<----------- DECODING MODE ----------->\n");
+
+    // Step 1: Open Stego Image
+    if (open_decode_files(decInfo) == e_failure)
+        return e_failure;
+    stats_mark(decInfo->stats, "open");
+
+    // Step 2: Verify Magic String and Decode the Header
+    off_t secret_size;
+    if (decode_stego_header(decInfo, &secret_size) == e_failure)
+        return e_failure;
+    stats_mark(decInfo->stats, "header");
+    if ((decInfo->list || decInfo->entry_name != NULL) && !(decInfo->flags & STEG_FLAG_DIRECTORY))
+    {
+        decode_log(decInfo, "INVALID: Image holds a single file, not a directory container, decode it with -d.\n");
+        return e_failure;
+    }
+
+    // Step 3: Name the Output File after the Extension
+    if (decode_secret_file_extn(decInfo) == e_failure)
+        return e_failure;
+
+    // Step 4: Decode Secret File Data
+    Status status;
+    if (decInfo->range)
+    {
+        status = decode_secret_file_range(decInfo, secret_size);
+        stats_mark(decInfo->stats, "range");
+    }
+    else if ((decInfo->flags & STEG_FLAG_DIRECTORY) && !decInfo->verify)
+    {
+        status = decode_directory(decInfo, secret_size);
+        stats_mark(decInfo->stats, "directory");
+    }
+    else
+    {
+        status = decode_secret_file_data(decInfo, secret_size);
+        stats_mark(decInfo->stats, "data");
+        if (status == e_success && (decInfo->flags & STEG_FLAG_CHECKSUM))
+        {
+            status = decode_checksum(decInfo, secret_size);
+            stats_mark(decInfo->stats, "checksum");
+        }
+        else if (status == e_success && decInfo->verify && !(decInfo->flags & (STEG_FLAG_ENCRYPTED | STEG_FLAG_DIRECTORY)))
+            decode_log(decInfo, "No checksum stored, only the payload extent was checked.\n");
+        // Containers also check every entry on their own
+        if (status == e_success && decInfo->verify && (decInfo->flags & STEG_FLAG_DIRECTORY))
+        {
+            status = decode_directory(decInfo, secret_size);
+            stats_mark(decInfo->stats, "directory");
+        }
+    }
+
+    // The payload checked out, only now does it take the output's name
+    if (status == e_success && decInfo->output_temp[0] != '\0')
+    {
+        if (fflush(decInfo->fptr_output) != 0 || rename(decInfo->output_temp, decInfo->output_fname) != 0)
+        {
+            decode_error(decInfo, "INVALID: Unable to write output file %s: %s", decInfo->output_fname,
+                         strerror(errno));
+            status = e_failure;
+        }
+        else
+            decInfo->output_temp[0] = '\0';
+    }
+
+    // Don't leave a partial, undecryptable or corrupt file behind (an
+    // fd:N or stdout output has been streamed already)
+    if (status == e_failure && !decode_to_stdout(decInfo) && decInfo->fptr_output != NULL)
+    {
+        fclose(decInfo->fptr_output);
+        decInfo->fptr_output = NULL;
+        free(decInfo->output_buffer);
+        decInfo->output_buffer = NULL;
+        if (decInfo->output_temp[0] != '\0')
+            remove(decInfo->output_temp);
+        else if (strncmp(decInfo->output_fname, "fd:", 3) != 0)
+            remove(decInfo->output_fname);
+        decInfo->output_temp[0] = '\0';
+    }
+
+    if (decInfo->io_mode == e_io_mmap)
+    {
+        munmap(decInfo->stego_map, decInfo->stego_map_size);
+        decInfo->stego_map = NULL;
+    }
+    return status;
+}
+
+/* Release everything open_decode_files() and do_decoding() acquired */
+void close_decode_files(DecodeInfo *decInfo)
+{
+    free(decInfo->raw_buffer);
+    decInfo->raw_buffer = NULL;
+    decInfo->raw_buffer_size = 0;
+    if (decInfo->stego_map != NULL)
+    {
+        munmap(decInfo->stego_map, decInfo->stego_map_size);
+        decInfo->stego_map = NULL;
+    }
+    if (decInfo->fptr_stego_image != NULL && decInfo->fptr_stego_image != stdin)
+    {
+        fclose(decInfo->fptr_stego_image);
+    }
+    decInfo->fptr_stego_image = NULL;
+    if (decInfo->fptr_output == stdout)
+    {
+        fflush(stdout);
+        decInfo->fptr_output = NULL;
+    }
+    else if (decInfo->fptr_output != NULL)
+    {
+        fclose(decInfo->fptr_output);
+        decInfo->fptr_output = NULL;
+    }
+    free(decInfo->output_buffer);
+    decInfo->output_buffer = NULL;
+}
@@ -1,44 +1,90 @@
-#ifndef DECODE_H
-#define DECODE_H
-
-#include "types.h"  // For Status, etc.
-
-#define MAGIC_STRING "#*"  // Must match your encode magic string
-
-typedef struct _DecodeInfo
-{
-    /* Source Stego Image */
-    char *stego_image_fname;
-    FILE *fptr_stego_image;
-
-    /* Output File */
-    char output_fname[100];
-    FILE *fptr_output;
-
-    /* Data extracted */
-    char extn_secret_file[8];
-    long size_secret_file;
-} DecodeInfo;
-
-/* Function Prototypes */
-Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
-
-Status open_decode_files(DecodeInfo *decInfo);
-
-Status do_decoding(DecodeInfo *decInfo);
-
-Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
-
-Status decode_secret_file_extn_size(DecodeInfo *decInfo, int *size);
-
-Status decode_secret_file_extn(DecodeInfo *decInfo, int size);
-
-Status decode_secret_file_size(DecodeInfo *decInfo, long *size);
-
-Status decode_secret_file_data(DecodeInfo *decInfo, long size);
-
-char decode_byte_from_lsb(char *image_buffer);
-
-int decode_size_from_lsb(char *image_buffer);
-
-#endif
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"  // For Status, etc.
+#include "bmp.h"
+#include "steg.h"
+#include "scatter.h"
+#include "directory.h"
+#include "stats.h"
+#include "common.h"
+
+typedef struct _DecodeInfo
+{
+    /* Source Stego Image */
+    char *stego_image_fname;
+    FILE *fptr_stego_image;
+    int stego_fd;               // Descriptor under it (an --io=async stream has none of its own)
+    BmpInfo bmp;                // Parsed header and pixel span descriptor
+
+    /* Carrier I/O */
+    IoMode io_mode;             // stdio stream or memory mapped stego image
+    unsigned char *stego_map;   // Mapped stego image (mmap mode)
+    size_t stego_map_size;      // Length of the mapping
+    size_t stego_pos;           // File offset of the next stego byte to read
+    uint64_t carrier_index;     // Usable carrier bytes consumed so far
+    unsigned char *raw_buffer;  // Raw pixel span incl. padding/alpha (stdio mode)
+    size_t raw_buffer_size;
+    int threads;                // Extraction threads, > 1 only in mmap mode
+    int depth;                  // Payload bits per carrier byte, read from the header
+    int header_version;         // STEG_HEADER_V0/V1 (legacy layout) or V2
+    int flags;                  // STEG_FLAG_* bits of the payload
+    int ecc_parity;             // Parity bytes per ecc.h codeword of an STEG_FLAG_ECC payload
+    const char *passphrase;     // Opens STEG_FLAG_ENCRYPTED and STEG_FLAG_SCATTERED payloads
+    ScatterMap scatter_map;     // Tile permutation of a scattered payload
+    uint32_t payload_crc;       // CRC32C of the payload bytes extracted so far
+    int verify;                 // -v: run every check but write no output
+    uint64_t payload_index;     // Carrier index of payload byte 0
+    const char *entry_name;     // -x: container entry to extract
+    int list;                   // -l: print the container directory
+    int range;                  // --range: extract only the bytes below
+    uint64_t range_offset;
+    uint64_t range_length;
+
+    /* Caller owned work buffers, allocated per call when NULL */
+    char *block_buffer;         // STEG_BLOCK_SIZE bytes
+    char *chunk_buffer;         // STEG_SECRET_CHUNK bytes
+    int quiet;                  // Suppress progress output, keep the first error in error
+    char error[STEG_ERROR_SIZE];
+    Stats *stats;               // --stats: per-stage timers, NULL when off
+
+    /* Output File */
+    char output_fname[DIR_NAME_MAX + 1];
+    FILE *fptr_output;
+    char *output_buffer;        // Block sized stdio buffer of fptr_output
+    char output_temp[DIR_NAME_MAX + 16];    // Where a named output is written until it checks out
+
+    /* Data extracted */
+    char extn_secret_file[STEG_MAX_EXTN + 1];
+    off_t size_secret_file;
+} DecodeInfo;
+
+/* Function Prototypes */
+Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
+
+Status open_decode_files(DecodeInfo *decInfo);
+
+void close_decode_files(DecodeInfo *decInfo);
+
+Status do_decoding(DecodeInfo *decInfo);
+
+Status decode_stego_header(DecodeInfo *decInfo, off_t *size);
+
+Status decode_secret_file_extn(DecodeInfo *decInfo);
+
+Status decode_secret_file_data(DecodeInfo *decInfo, off_t size);
+
+Status decode_secret_file_range(DecodeInfo *decInfo, off_t size);
+
+Status decode_checksum(DecodeInfo *decInfo, off_t size);
+
+Status decode_directory(DecodeInfo *decInfo, off_t size);
+
+char decode_byte_from_lsb(char *image_buffer);
+
+int decode_size_from_lsb(char *image_buffer);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include "directory.h"
+
+/* Fixed part of an entry: name length, offset, length, crc, flags */
+#define DIR_ENTRY_FIXED (1 + 8 + 8 + 4 + 1)
+
+static void put_be(unsigned char *p, uint64_t v, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        p[i] = v >> (8 * (n - 1 - i));
+}
+
+static uint64_t get_be(const unsigned char *p, size_t n)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+Status dir_valid_name(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > DIR_NAME_MAX || strchr(name, '/') != NULL || strchr(name, '\\') != NULL ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return e_failure;
+    return e_success;
+}
+
+Status dir_add(Directory *dir, const char *name, uint64_t length, uint32_t crc)
+{
+    if (dir_valid_name(name) == e_failure || dir_find(dir, name) != NULL)
+        return e_failure;
+    DirEntry *entries = realloc(dir->entries, (dir->count + 1) * sizeof(DirEntry));
+    if (entries == NULL)
+        return e_failure;
+    dir->entries = entries;
+    DirEntry *entry = &entries[dir->count++];
+    strcpy(entry->name, name);
+    entry->offset = 0;
+    entry->length = length;
+    entry->crc = crc;
+    entry->flags = 0;
+    return e_success;
+}
+
+void dir_layout(Directory *dir)
+{
+    dir->size = DIR_PREFIX_SIZE;
+    for (size_t i = 0; i < dir->count; i++)
+        dir->size += DIR_ENTRY_FIXED + strlen(dir->entries[i].name);
+    uint64_t offset = dir->size;
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        dir->entries[i].offset = offset;
+        offset += dir->entries[i].length;
+    }
+}
+
+void dir_serialize(const Directory *dir, unsigned char *out)
+{
+    put_be(out, dir->size, 4);
+    put_be(out + 4, dir->count, 4);
+    out += DIR_PREFIX_SIZE;
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        const DirEntry *entry = &dir->entries[i];
+        size_t len = strlen(entry->name);
+        *out++ = len;
+        memcpy(out, entry->name, len);
+        out += len;
+        put_be(out, entry->offset, 8);
+        put_be(out + 8, entry->length, 8);
+        put_be(out + 16, entry->crc, 4);
+        out[20] = entry->flags;
+        out += DIR_ENTRY_FIXED - 1;
+    }
+}
+
+Status dir_parse_prefix(const unsigned char *prefix, uint32_t *size, uint32_t *count)
+{
+    *size = get_be(prefix, 4);
+    *count = get_be(prefix + 4, 4);
+    // Every entry needs its fixed part and at least a 1 byte name
+    if (*size < DIR_PREFIX_SIZE || *size > DIR_MAX_SIZE ||
+        *count > (*size - DIR_PREFIX_SIZE) / (DIR_ENTRY_FIXED + 1))
+        return e_failure;
+    return e_success;
+}
+
+Status dir_parse(const unsigned char *data, size_t size, uint64_t payload_size, Directory *dir)
+{
+    memset(dir, 0, sizeof(*dir));
+    uint32_t stored_size, count;
+    if (size < DIR_PREFIX_SIZE || dir_parse_prefix(data, &stored_size, &count) == e_failure ||
+        stored_size != size || size > payload_size)
+        return e_failure;
+    dir->entries = count ? malloc(count * sizeof(DirEntry)) : NULL;
+    if (count && dir->entries == NULL)
+        return e_failure;
+    dir->size = size;
+
+    size_t pos = DIR_PREFIX_SIZE;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        DirEntry *entry = &dir->entries[i];
+        size_t len = pos < size ? data[pos] : 0;
+        if (len == 0 || size - pos < DIR_ENTRY_FIXED + len)
+            break;
+        memcpy(entry->name, data + pos + 1, len);
+        entry->name[len] = '\0';
+        const unsigned char *fields = data + pos + 1 + len;
+        entry->offset = get_be(fields, 8);
+        entry->length = get_be(fields + 8, 8);
+        entry->crc = get_be(fields + 16, 4);
+        entry->flags = fields[20];
+        pos += DIR_ENTRY_FIXED + len;
+        // Names are written out as files, keep them inside the current directory
+        if (strlen(entry->name) != len || dir_valid_name(entry->name) == e_failure ||
+            (entry->flags & ~DIR_KNOWN_FLAGS) || entry->offset < size || entry->offset > payload_size ||
+            entry->length > payload_size - entry->offset)
+            break;
+        dir->count++;
+    }
+    if (dir->count != count || pos != size)
+    {
+        dir_free(dir);
+        return e_failure;
+    }
+    return e_success;
+}
+
+const DirEntry *dir_find(const Directory *dir, const char *name)
+{
+    for (size_t i = 0; i < dir->count; i++)
+    {
+        if (strcmp(dir->entries[i].name, name) == 0)
+            return &dir->entries[i];
+    }
+    return NULL;
+}
+
+void dir_free(Directory *dir)
+{
+    free(dir->entries);
+    dir->entries = NULL;
+    dir->count = 0;
+}
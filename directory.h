@@ -0,0 +1,71 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Directory container for -m (STEG_FLAG_DIRECTORY payloads)
+ * The payload starts with a directory of its entries and the entry
+ * data follows back to back. The directory is a 4 byte size (of the
+ * whole directory, this field included) and a 4 byte entry count,
+ * then per entry a 1 byte name length, the name, an 8 byte offset
+ * from the start of the payload, an 8 byte length, the CRC32C of the
+ * entry data and a flags byte. All integers are big endian. Listing
+ * reads just the directory, extracting an entry seeks straight to
+ * its first byte.
+ */
+
+/* Names are a plain file name: no path separators, not "." or ".." */
+#define DIR_NAME_MAX 255
+
+/* Size and count fields in front of the entries */
+#define DIR_PREFIX_SIZE 8
+
+/* Largest directory a reader loads */
+#define DIR_MAX_SIZE (16 << 20)
+
+/* Entry flags this build understands (none defined yet) */
+#define DIR_KNOWN_FLAGS 0x00
+
+typedef struct _DirEntry
+{
+    char name[DIR_NAME_MAX + 1];
+    uint64_t offset;            // First payload byte of the entry
+    uint64_t length;
+    uint32_t crc;               // CRC32C of the entry data
+    int flags;
+} DirEntry;
+
+typedef struct _Directory
+{
+    DirEntry *entries;
+    size_t count;
+    size_t size;                // Serialized size, entry offsets start here
+} Directory;
+
+/* e_success if name can be stored and later written out as is */
+Status dir_valid_name(const char *name);
+
+/* Append an entry, offsets are assigned by dir_layout() */
+Status dir_add(Directory *dir, const char *name, uint64_t length, uint32_t crc);
+
+/* Size the directory and place the entries behind it in order */
+void dir_layout(Directory *dir);
+
+/* Write the dir->size byte directory to out */
+void dir_serialize(const Directory *dir, unsigned char *out);
+
+/* Directory size and entry count from the first DIR_PREFIX_SIZE bytes */
+Status dir_parse_prefix(const unsigned char *prefix, uint32_t *size, uint32_t *count);
+
+/* Load a serialized directory, every entry must lie inside payload_size bytes */
+Status dir_parse(const unsigned char *data, size_t size, uint64_t payload_size, Directory *dir);
+
+/* Entry called name, NULL if there is none */
+const DirEntry *dir_find(const Directory *dir, const char *name);
+
+void dir_free(Directory *dir);
+
+#endif
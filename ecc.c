@@ -0,0 +1,549 @@
+#include <string.h>
+#include "ecc.h"
+#include "crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ECC_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* x^8 + x^4 + x^3 + x^2 + 1, 2 generates its multiplicative group */
+#define ECC_POLY 0x11d
+
+static unsigned char gf_mul(const EccCode *code, unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return code->exp[code->log[a] + code->log[b]];
+}
+
+static unsigned char gf_div(const EccCode *code, unsigned char a, unsigned char b)
+{
+    if (a == 0)
+        return 0;
+    return code->exp[code->log[a] + ECC_SYMBOLS - code->log[b]];
+}
+
+/* 2^e for any e >= 0 */
+static unsigned char gf_alpha(const EccCode *code, unsigned e)
+{
+    return code->exp[e % ECC_SYMBOLS];
+}
+
+Status ecc_check_parity(int parity)
+{
+    return parity >= ECC_MIN_PARITY && parity <= ECC_MAX_PARITY && parity % 2 == 0 ? e_success : e_failure;
+}
+
+Status ecc_init(EccCode *code, int parity)
+{
+    if (ecc_check_parity(parity) == e_failure)
+        return e_failure;
+    code->parity = parity;
+    unsigned x = 1;
+    for (int i = 0; i < ECC_SYMBOLS; i++)
+    {
+        code->exp[i] = code->exp[i + ECC_SYMBOLS] = (unsigned char)x;
+        code->log[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= ECC_POLY;
+    }
+    code->log[0] = 0;
+
+    // Generator (x + 2^0)(x + 2^1)..., highest coefficient first
+    unsigned char generator[ECC_MAX_PARITY + 1] = {1};
+    for (int i = 0; i < parity; i++)
+    {
+        for (int j = i + 1; j > 0; j--)
+            generator[j] ^= gf_mul(code, code->exp[i], generator[j - 1]);
+    }
+    memset(code->rows, 0, sizeof(code->rows));
+    for (int v = 0; v < 256; v++)
+    {
+        for (int i = 0; i < parity; i++)
+            code->rows[v][i / 8] |= (uint64_t)gf_mul(code, (unsigned char)v, generator[i + 1]) << (8 * (i % 8));
+    }
+    for (int i = 0; i < parity; i++)
+    {
+        for (int x = 0; x < 16; x++)
+        {
+            code->nibbles[i][x] = gf_mul(code, (unsigned char)x, generator[i + 1]);
+            code->nibbles[i][16 + x] = gf_mul(code, (unsigned char)(x << 4), generator[i + 1]);
+        }
+    }
+    return e_success;
+}
+
+uint64_t ecc_encoded_size(uint64_t data_size, int parity)
+{
+    uint64_t k = ECC_SYMBOLS - parity;
+    uint64_t rest = data_size % k;
+    return data_size / k * ECC_SYMBOLS + (rest ? rest + parity : 0);
+}
+
+Status ecc_data_size(uint64_t encoded_size, int parity, uint64_t *data_size)
+{
+    uint64_t rest = encoded_size % ECC_SYMBOLS;
+    if (rest != 0 && rest <= (uint64_t)parity)
+        return e_failure;
+    *data_size = encoded_size / ECC_SYMBOLS * (ECC_SYMBOLS - parity) + (rest ? rest - parity : 0);
+    return e_success;
+}
+
+size_t ecc_group_data(int parity)
+{
+    return (size_t)ECC_INTERLEAVE * (ECC_SYMBOLS - parity);
+}
+
+/*
+ * Parity bytes of n data bytes: their remainder modulo the generator.
+ * The remainder is held in 64 bit words, byte i of it in bits 8 * (i % 8)
+ * of word i / 8, so the shift by one coefficient per data byte and the
+ * XOR of the table row take a few word operations (bytes past parity
+ * stay zero). Each step waits for the table row the last one picked,
+ * so up to ECC_LANES codewords at a stride of ECC_SYMBOLS are divided
+ * in lockstep to overlap those lookups.
+ */
+#define ECC_LANES 4
+
+static inline void divide(const EccCode *code, const unsigned char *data, size_t n,
+                          uint64_t check[][ECC_MAX_PARITY / 8], int lanes, int words)
+{
+    for (size_t j = 0; j < n; j++)
+    {
+        for (int l = 0; l < lanes; l++)
+        {
+            uint64_t *lane = check[l];
+            const uint64_t *row = code->rows[(lane[0] & 0xFF) ^ data[l * ECC_SYMBOLS + j]];
+            for (int w = 0; w < words - 1; w++)
+                lane[w] = (lane[w] >> 8 | lane[w + 1] << 56) ^ row[w];
+            lane[words - 1] = lane[words - 1] >> 8 ^ row[words - 1];
+        }
+    }
+}
+
+/* Parity of lanes codewords, written stride bytes apart from out */
+static void parity_of(const EccCode *code, const unsigned char *data, size_t n, int lanes,
+                      unsigned char *out, size_t stride)
+{
+    const int words = (code->parity + 7) / 8;
+    uint64_t check[ECC_LANES][ECC_MAX_PARITY / 8] = {{0}};
+    // Fixed counts for the common cases so the inner loops unroll
+    if (lanes == ECC_LANES && words == 1)
+        divide(code, data, n, check, ECC_LANES, 1);
+    else if (lanes == ECC_LANES && words == 2)
+        divide(code, data, n, check, ECC_LANES, 2);
+    else if (lanes == ECC_LANES && words == 4)
+        divide(code, data, n, check, ECC_LANES, 4);
+    else
+        divide(code, data, n, check, lanes, words);
+    for (int l = 0; l < lanes; l++)
+    {
+        for (int i = 0; i < code->parity; i++)
+            out[l * stride + i] = (unsigned char)(check[l][i / 8] >> (8 * (i % 8)));
+    }
+}
+
+/*
+ * Parity of a full group in its interleaved layout: data byte j of
+ * codeword c at data[j * ECC_INTERLEAVE + c], parity byte i written to
+ * out[i * ECC_INTERLEAVE + c]. The same division as divide(), run on
+ * 16 or 32 codewords per vector; a product x * g splits into
+ * (x & 0x0f) * g ^ (x & 0xf0) * g, two 16 entry lookups.
+ */
+typedef void (*GroupParity)(const EccCode *code, const unsigned char *data, unsigned char *out);
+
+#ifdef ECC_HAVE_X86
+
+__attribute__((target("ssse3")))
+static void group_parity_ssse3(const EccCode *code, const unsigned char *data, unsigned char *out)
+{
+    const int parity = code->parity;
+    const size_t k = ECC_SYMBOLS - parity;
+    const __m128i low = _mm_set1_epi8(0x0F);
+    for (int c = 0; c < ECC_INTERLEAVE; c += 16)
+    {
+        __m128i check[ECC_MAX_PARITY];
+        for (int i = 0; i < parity; i++)
+            check[i] = _mm_setzero_si128();
+        for (size_t j = 0; j < k; j++)
+        {
+            __m128i feedback = _mm_xor_si128(check[0], _mm_loadu_si128((const __m128i *)(data + j * ECC_INTERLEAVE + c)));
+            __m128i lo = _mm_and_si128(feedback, low);
+            __m128i hi = _mm_and_si128(_mm_srli_epi64(feedback, 4), low);
+            for (int i = 0; i < parity; i++)
+            {
+                const __m128i *table = (const __m128i *)code->nibbles[i];
+                __m128i product = _mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128(table), lo),
+                                                _mm_shuffle_epi8(_mm_loadu_si128(table + 1), hi));
+                check[i] = i + 1 < parity ? _mm_xor_si128(check[i + 1], product) : product;
+            }
+        }
+        for (int i = 0; i < parity; i++)
+            _mm_storeu_si128((__m128i *)(out + i * ECC_INTERLEAVE + c), check[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void group_parity_avx2(const EccCode *code, const unsigned char *data, unsigned char *out)
+{
+    const int parity = code->parity;
+    const size_t k = ECC_SYMBOLS - parity;
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    for (int c = 0; c < ECC_INTERLEAVE; c += 32)
+    {
+        __m256i check[ECC_MAX_PARITY];
+        for (int i = 0; i < parity; i++)
+            check[i] = _mm256_setzero_si256();
+        for (size_t j = 0; j < k; j++)
+        {
+            __m256i feedback = _mm256_xor_si256(check[0],
+                                                _mm256_loadu_si256((const __m256i *)(data + j * ECC_INTERLEAVE + c)));
+            __m256i lo = _mm256_and_si256(feedback, low);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi64(feedback, 4), low);
+            for (int i = 0; i < parity; i++)
+            {
+                const __m128i *table = (const __m128i *)code->nibbles[i];
+                __m256i product = _mm256_xor_si256(
+                    _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(table)), lo),
+                    _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128(table + 1)), hi));
+                check[i] = i + 1 < parity ? _mm256_xor_si256(check[i + 1], product) : product;
+            }
+        }
+        for (int i = 0; i < parity; i++)
+            _mm256_storeu_si256((__m256i *)(out + i * ECC_INTERLEAVE + c), check[i]);
+    }
+}
+
+#endif /* ECC_HAVE_X86 */
+
+/* Full group kernels best first, scalar (parity_of() per codeword) last */
+typedef struct
+{
+    const char *name;
+    int (*supported)(void);
+    GroupParity group_parity;
+} EccKernel;
+
+#ifdef ECC_HAVE_X86
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static int have_ssse3(void)
+{
+    return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+static int have_scalar(void)
+{
+    return 1;
+}
+
+static const EccKernel kernels[] = {
+#ifdef ECC_HAVE_X86
+    {"avx2", have_avx2, group_parity_avx2},
+    {"ssse3", have_ssse3, group_parity_ssse3},
+#endif
+    {"scalar", have_scalar, NULL},
+};
+
+/* Picked on first use; threads racing on that all store the same kernel */
+static const EccKernel *selected;
+
+static const EccKernel *select_kernel(void)
+{
+    const EccKernel *kernel = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (kernel == NULL)
+    {
+        kernel = &kernels[0];
+        while (!kernel->supported())
+            kernel++;
+        __atomic_store_n(&selected, kernel, __ATOMIC_RELEASE);
+    }
+    return kernel;
+}
+
+const char *ecc_kernel_name(void)
+{
+    return select_kernel()->name;
+}
+
+/* Group geometry: codewords at a stride of ECC_SYMBOLS, the last one last_len bytes long */
+static void interleave(const unsigned char *codewords, size_t count, size_t last_len, unsigned char *stored)
+{
+    size_t width = count > 1 ? ECC_SYMBOLS : last_len;
+    for (size_t j = 0; j < width; j++)
+    {
+        size_t rows = j < last_len ? count : count - 1;
+        for (size_t i = 0; i < rows; i++)
+            *stored++ = codewords[i * ECC_SYMBOLS + j];
+    }
+}
+
+static void deinterleave(const unsigned char *stored, size_t count, size_t last_len, unsigned char *codewords)
+{
+    size_t width = count > 1 ? ECC_SYMBOLS : last_len;
+    for (size_t j = 0; j < width; j++)
+    {
+        size_t rows = j < last_len ? count : count - 1;
+        for (size_t i = 0; i < rows; i++)
+            codewords[i * ECC_SYMBOLS + j] = *stored++;
+    }
+}
+
+size_t ecc_encode_group(EccEncoder *enc, const unsigned char *in, size_t n, unsigned char *out)
+{
+    const size_t parity = enc->code.parity, k = ECC_SYMBOLS - parity;
+    if (n == 0)
+        return 0;
+    size_t count = (n + k - 1) / k, full = n / k;
+    GroupParity group_parity = select_kernel()->group_parity;
+    if (group_parity != NULL && full == ECC_INTERLEAVE)
+    {
+        // Interleave the data as it comes, the parity rows land behind it
+        for (size_t i = 0; i < ECC_INTERLEAVE; i++)
+        {
+            for (size_t j = 0; j < k; j++)
+                out[j * ECC_INTERLEAVE + i] = in[i * k + j];
+        }
+        group_parity(&enc->code, out, out + k * ECC_INTERLEAVE);
+        return ECC_GROUP_SIZE;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t data = n - i * k < k ? n - i * k : k;
+        memcpy(enc->codewords + i * ECC_SYMBOLS, in + i * k, data);
+    }
+    // Parity goes straight behind the data of each codeword
+    for (size_t i = 0; i < count; )
+    {
+        unsigned char *codeword = enc->codewords + i * ECC_SYMBOLS;
+        int lanes = i + ECC_LANES <= full ? ECC_LANES : 1;
+        size_t data = n - i * k < k ? n - i * k : k;
+        parity_of(&enc->code, codeword, data, lanes, codeword + data, ECC_SYMBOLS);
+        i += lanes;
+    }
+    interleave(enc->codewords, count, n - (count - 1) * k + parity, out);
+    return n + count * parity;
+}
+
+/*
+ * Repair a codeword of len bytes in place, check holds the parity of
+ * its data as received. Returns the bytes put right, or -1 (codeword
+ * untouched) when the damage is more than the parity can locate.
+ */
+static int correct_codeword(const EccCode *code, unsigned char *codeword, size_t len, unsigned char *check)
+{
+    const int parity = code->parity;
+    int clean = 1;
+    for (int i = 0; i < parity; i++)
+    {
+        check[i] ^= codeword[len - parity + i];
+        clean &= check[i] == 0;
+    }
+    if (clean)
+        return 0;
+
+    // Syndromes: the received word at 2^j equals remainder + parity at 2^j
+    unsigned char syndromes[ECC_MAX_PARITY];
+    for (int j = 0; j < parity; j++)
+    {
+        unsigned char value = 0;
+        for (int i = 0; i < parity; i++)
+            value = gf_mul(code, value, code->exp[j]) ^ check[i];
+        syndromes[j] = value;
+    }
+
+    // Berlekamp-Massey: error locator, lowest coefficient first
+    unsigned char locator[ECC_MAX_PARITY + 1] = {1}, previous[ECC_MAX_PARITY + 1] = {1};
+    unsigned char saved[ECC_MAX_PARITY + 1];
+    int errors = 0, shift = 1;
+    unsigned char last = 1;
+    for (int n = 0; n < parity; n++)
+    {
+        unsigned char delta = syndromes[n];
+        for (int i = 1; i <= errors; i++)
+            delta ^= gf_mul(code, locator[i], syndromes[n - i]);
+        if (delta == 0)
+        {
+            shift++;
+            continue;
+        }
+        unsigned char scale = gf_div(code, delta, last);
+        int grow = 2 * errors <= n;
+        if (grow)
+            memcpy(saved, locator, sizeof(saved));
+        for (int i = 0; i + shift <= parity; i++)
+            locator[i + shift] ^= gf_mul(code, scale, previous[i]);
+        if (grow)
+        {
+            memcpy(previous, saved, sizeof(previous));
+            errors = n + 1 - errors;
+            last = delta;
+            shift = 1;
+        }
+        else
+            shift++;
+    }
+    if (errors > parity / 2)
+        return -1;
+
+    // Evaluator: syndromes times locator, modulo x^parity
+    unsigned char evaluator[ECC_MAX_PARITY] = {0};
+    for (int i = 0; i < parity; i++)
+    {
+        for (int k = 0; k <= i && k <= errors; k++)
+            evaluator[i] ^= gf_mul(code, syndromes[i - k], locator[k]);
+    }
+
+    // Chien search over the positions inside the codeword, Forney for the values
+    size_t positions[ECC_MAX_PARITY / 2];
+    unsigned char values[ECC_MAX_PARITY / 2];
+    int found = 0;
+    for (size_t pos = 0; pos < len && found < errors; pos++)
+    {
+        unsigned degree = len - 1 - pos;
+        unsigned inverse = (ECC_SYMBOLS - degree) % ECC_SYMBOLS;   // log of 2^-degree
+        unsigned char sum = 0;
+        for (int i = 0; i <= errors; i++)
+            sum ^= gf_mul(code, locator[i], gf_alpha(code, inverse * i));
+        if (sum != 0)
+            continue;
+        unsigned char numerator = 0, denominator = 0;
+        for (int i = 0; i < parity; i++)
+            numerator ^= gf_mul(code, evaluator[i], gf_alpha(code, inverse * i));
+        for (int i = 1; i <= errors; i += 2)
+            denominator ^= gf_mul(code, locator[i], gf_alpha(code, inverse * (i - 1)));
+        if (denominator == 0)
+            return -1;
+        positions[found] = pos;
+        values[found++] = gf_mul(code, code->exp[degree], gf_div(code, numerator, denominator));
+    }
+    if (found != errors)
+        return -1;
+
+    // More damage than the parity covers can still look solvable, check the result
+    for (int i = 0; i < found; i++)
+        codeword[positions[i]] ^= values[i];
+    parity_of(code, codeword, len - parity, 1, check, ECC_MAX_PARITY);
+    if (memcmp(check, codeword + len - parity, parity) != 0)
+    {
+        for (int i = 0; i < found; i++)
+            codeword[positions[i]] ^= values[i];
+        return -1;
+    }
+    return found;
+}
+
+Status ecc_decoder_init(EccDecoder *dec, int parity, uint64_t encoded_size)
+{
+    uint64_t data_size;
+    if (ecc_init(&dec->code, parity) == e_failure || ecc_data_size(encoded_size, parity, &data_size) == e_failure)
+        return e_failure;
+    dec->remaining = encoded_size;
+    dec->group_size = 0;
+    dec->have = 0;
+    dec->crc = 0;
+    dec->codewords = dec->repaired = dec->repaired_bytes = dec->failed = 0;
+    return e_success;
+}
+
+/* A full group whose parity rows all match, taken apart straight from its interleaved layout */
+static int clean_group(EccDecoder *dec, GroupParity group_parity)
+{
+    const size_t k = ECC_SYMBOLS - dec->code.parity;
+    unsigned char rows[ECC_MAX_PARITY * ECC_INTERLEAVE];
+    group_parity(&dec->code, dec->group, rows);
+    if (memcmp(rows, dec->group + k * ECC_INTERLEAVE, dec->code.parity * ECC_INTERLEAVE) != 0)
+        return 0;
+    for (size_t i = 0; i < ECC_INTERLEAVE; i++)
+    {
+        for (size_t j = 0; j < k; j++)
+            dec->data[i * k + j] = dec->group[j * ECC_INTERLEAVE + i];
+    }
+    return 1;
+}
+
+static Status decode_group(EccDecoder *dec, DataSink sink, void *ctx)
+{
+    const size_t parity = dec->code.parity;
+    GroupParity group_parity = select_kernel()->group_parity;
+    if (group_parity != NULL && dec->group_size == ECC_GROUP_SIZE && clean_group(dec, group_parity))
+    {
+        dec->codewords += ECC_INTERLEAVE;
+        dec->crc = crc32c_update(dec->crc, dec->group, dec->group_size);
+        return sink(ctx, dec->data, ecc_group_data(parity));
+    }
+
+    size_t count = (dec->group_size + ECC_SYMBOLS - 1) / ECC_SYMBOLS;
+    size_t last_len = dec->group_size - (count - 1) * ECC_SYMBOLS;
+    deinterleave(dec->group, count, last_len, dec->codewords_buffer);
+
+    // Codewords whose data divides to their parity bytes pass straight through
+    unsigned char checks[ECC_LANES][ECC_MAX_PARITY];
+    size_t full = last_len == ECC_SYMBOLS ? count : count - 1;
+    int repaired = 0;
+    size_t used = 0;
+    for (size_t i = 0; i < count; )
+    {
+        unsigned char *codeword = dec->codewords_buffer + i * ECC_SYMBOLS;
+        size_t len = i < full ? ECC_SYMBOLS : last_len;
+        int lanes = i + ECC_LANES <= full ? ECC_LANES : 1;
+        parity_of(&dec->code, codeword, len - parity, lanes, checks[0], ECC_MAX_PARITY);
+        for (int l = 0; l < lanes; l++, codeword += ECC_SYMBOLS)
+        {
+            int fixed = correct_codeword(&dec->code, codeword, len, checks[l]);
+            if (fixed < 0)
+                dec->failed++;
+            else if (fixed > 0)
+            {
+                dec->repaired++;
+                dec->repaired_bytes += fixed;
+                repaired = 1;
+            }
+            memcpy(dec->data + used, codeword, len - parity);
+            used += len - parity;
+        }
+        i += lanes;
+    }
+    dec->codewords += count;
+
+    // The checksum covers the stream as the encoder stored it
+    if (repaired)
+        interleave(dec->codewords_buffer, count, last_len, dec->group);
+    dec->crc = crc32c_update(dec->crc, dec->group, dec->group_size);
+    return sink(ctx, dec->data, used);
+}
+
+Status ecc_decoder_feed(EccDecoder *dec, const unsigned char *in, size_t n, DataSink sink, void *ctx)
+{
+    while (n > 0)
+    {
+        if (dec->have == 0)
+            dec->group_size = dec->remaining < ECC_GROUP_SIZE ? (size_t)dec->remaining : ECC_GROUP_SIZE;
+        if (dec->group_size == 0)
+            return e_failure;
+        size_t take = dec->group_size - dec->have < n ? dec->group_size - dec->have : n;
+        memcpy(dec->group + dec->have, in, take);
+        dec->have += take;
+        dec->remaining -= take;
+        in += take;
+        n -= take;
+        if (dec->have == dec->group_size)
+        {
+            dec->have = 0;
+            if (decode_group(dec, sink, ctx) == e_failure)
+                return e_failure;
+        }
+    }
+    return e_success;
+}
+
+Status ecc_decoder_finish(const EccDecoder *dec)
+{
+    return dec->remaining == 0 && dec->have == 0 && dec->failed == 0 ? e_success : e_failure;
+}
@@ -0,0 +1,112 @@
+#ifndef ECC_H
+#define ECC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Reed-Solomon error correction for --ecc
+ * The payload is cut into codewords of up to ECC_SYMBOLS bytes over
+ * GF(2^8) (polynomial 0x11d, generator roots 2^0 .. 2^(parity-1)):
+ * 255 - parity data bytes followed by parity check bytes, so up to
+ * parity / 2 damaged bytes per codeword are repaired. Only the last
+ * codeword may be shorter (fewer data bytes, same parity).
+ *
+ * Codewords are stored interleaved in groups of ECC_INTERLEAVE: byte 0
+ * of every codeword of the group, then byte 1 and so on, which spreads
+ * a run of damaged carrier bytes over the whole group. Every group but
+ * the last is full, so the encoded size alone gives the layout.
+ *
+ * Encoding divides by the generator one byte at a time with a 256 row
+ * table of its multiples, packed in 64 bit words (one shift and one
+ * table row XORed into the remainder per data byte). A full group is
+ * divided in its interleaved layout instead when the CPU has SSSE3 or
+ * AVX2: byte j of 16 or 32 codewords is one vector, and each remainder
+ * byte takes its generator multiple by two PSHUFB lookups (low and high
+ * nibble). Decoding runs the same division over each received codeword
+ * and only solves for the errors (Berlekamp-Massey, Chien search,
+ * Forney) when the remainder doesn't match the parity bytes.
+ */
+
+#define ECC_SYMBOLS 255
+#define ECC_MIN_PARITY 2
+#define ECC_MAX_PARITY 128
+#define ECC_DEFAULT_PARITY 16
+
+/* Codewords per interleaved group, and the encoded size of a full group */
+#define ECC_INTERLEAVE 64
+#define ECC_GROUP_SIZE (ECC_INTERLEAVE * ECC_SYMBOLS)
+
+/* Field tables and the generator multiples for one parity count, about 37 KiB */
+typedef struct _EccCode
+{
+    int parity;                         // Check bytes per codeword
+    unsigned char exp[2 * ECC_SYMBOLS];
+    unsigned char log[256];
+    uint64_t rows[256][ECC_MAX_PARITY / 8];     // x * generator, packed as in parity_of()
+    unsigned char nibbles[ECC_MAX_PARITY][32];  // x * generator coefficient i + 1 for x = 0..15, then x = 0x00..0xf0
+} EccCode;
+
+/* e_failure unless parity is even and in [ECC_MIN_PARITY, ECC_MAX_PARITY] */
+Status ecc_check_parity(int parity);
+
+/* Build the tables, e_failure for a parity ecc_check_parity() turns down */
+Status ecc_init(EccCode *code, int parity);
+
+/* Encoded size of data_size bytes */
+uint64_t ecc_encoded_size(uint64_t data_size, int parity);
+
+/* Data bytes behind encoded_size encoded bytes, e_failure if no payload encodes to that size */
+Status ecc_data_size(uint64_t encoded_size, int parity, uint64_t *data_size);
+
+/* Data bytes of a full group */
+size_t ecc_group_data(int parity);
+
+typedef struct _EccEncoder
+{
+    EccCode code;
+    unsigned char codewords[ECC_GROUP_SIZE];
+} EccEncoder;
+
+/*
+ * Encode n <= ecc_group_data() bytes into one interleaved group in out
+ * (ECC_GROUP_SIZE bytes), returns its size. Only the last group of a
+ * payload may be short.
+ */
+size_t ecc_encode_group(EccEncoder *enc, const unsigned char *in, size_t n, unsigned char *out);
+
+/* Name of the kernel dividing full groups for this CPU */
+const char *ecc_kernel_name(void);
+
+/* Incremental decoder, the encoded stream may arrive in any pieces */
+typedef struct _EccDecoder
+{
+    EccCode code;
+    uint64_t remaining;                 // Encoded bytes not yet fed
+    size_t group_size;                  // Encoded bytes of the group being buffered
+    size_t have;
+    uint32_t crc;                       // CRC32C of the encoded stream as corrected
+    uint64_t codewords;                 // Codewords decoded
+    uint64_t repaired;                  // ... of which had damaged bytes put right
+    uint64_t repaired_bytes;
+    uint64_t failed;                    // ... of which had more damage than parity / 2 bytes
+    unsigned char group[ECC_GROUP_SIZE];
+    unsigned char codewords_buffer[ECC_GROUP_SIZE];
+    unsigned char data[ECC_GROUP_SIZE];
+} EccDecoder;
+
+/* e_failure if the parity count is unsupported or encoded_size can't be an encoded stream */
+Status ecc_decoder_init(EccDecoder *dec, int parity, uint64_t encoded_size);
+
+/*
+ * Correct the groups completed by n more bytes and hand their data to
+ * sink. A codeword beyond repair is passed on as received and counted
+ * in failed. e_failure on a sink error or bytes past the encoded size.
+ */
+Status ecc_decoder_feed(EccDecoder *dec, const unsigned char *in, size_t n, DataSink sink, void *ctx);
+
+/* e_failure if the stream stopped early or a codeword couldn't be repaired */
+Status ecc_decoder_finish(const EccDecoder *dec);
+
+#endif
@@ -1,40 +1,106 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include "encode.h"
 #include "types.h"
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "common.h"
+#include "lsb.h"
+#include "parallel.h"
+#include "bmp.h"
+#include "bmpio.h"
+#include "steg.h"
+#include "lz.h"
+#include "seal.h"
+#include "ecc.h"
+#include "scatter.h"
+#include "crc32c.h"
+#include "directory.h"
+#include "aio.h"
+#include "inplace.h"
 
 /* Function Definitions */
 
-/* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
- */
-uint get_image_size_for_bmp(FILE *fptr_image)
-{
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    // Return image capacity
-    return width * height * 3;
+/* Progress output, silenced for batch jobs */
+static void encode_log(const EncodeInfo *encInfo, const char *format, ...)
+{
+    if(encInfo->quiet)
+    {
+        return;
+    }
+    // Keep stdout clean when the stego image is streamed there
+    FILE *out = stdout;
+    if(encInfo->stego_image_fname != NULL && strcmp(encInfo->stego_image_fname, "-") == 0)
+    {
+        out = stderr;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+/* perror(), or keep the message in encInfo->error for a quiet run */
+static void encode_perror(EncodeInfo *encInfo, const char *what)
+{
+    if(!encInfo->quiet)
+    {
+        perror(what);
+    }
+    else if(encInfo->error[0] == '\0')
+    {
+        snprintf(encInfo->error, sizeof(encInfo->error), "%s: %s", what, strerror(errno));
+    }
 }
+
 // Find the size of secret file data
-uint get_file_size(FILE *fptr)
+off_t get_file_size(FILE *fptr)
 {
     
-    fseek(fptr, 0, SEEK_END);      // Move to end of file
-    uint size = ftell(fptr);       // Get current file position (end = size)
+    fseeko(fptr, 0, SEEK_END);     // Move to end of file
+    off_t size = ftello(fptr);     // Get current file position (end = size)
     rewind(fptr);                  // Reset to start
     return size;
 }
 
 
+/*
+ * fopen(), except that "fd:N" names a descriptor that is already open
+ * (a streamed secret, or the files of a daemon request). The stream
+ * gets its own copy of the descriptor, so closing it leaves N open.
+ */
+static FILE *open_stream(const char *fname, const char *mode)
+{
+    if(strncmp(fname, "fd:", 3) != 0)
+    {
+        return fopen(fname, mode);
+    }
+    int fd = dup(atoi(fname + 3));
+    FILE *fptr = fd < 0 ? NULL : fdopen(fd, mode);
+    if(fptr == NULL && fd >= 0)
+    {
+        close(fd);
+    }
+    return fptr;
+}
+
+/* Extension of a secret: from the last dot of the file name on, "" without one */
+static const char *secret_extension(const char *fname)
+{
+    const char *slash = strrchr(fname, '/');
+    const char *dot = strrchr(slash ? slash + 1 : fname, '.');
+    return dot ? dot : "";
+}
 
 /*
  * Get File pointers for i/p and o/p files
@@ -47,45 +113,44 @@ uint get_file_size(FILE *fptr)
 
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    // 1. Validate BMP source file
-    if(strstr(argv[2], ".bmp") != NULL)
+    // 1. Validate BMP source file ("-" streams it from stdin)
+    if(strstr(argv[2], ".bmp") != NULL || strcmp(argv[2], "-") == 0)
     {
         encInfo->src_image_fname = argv[2];
     }
     else
     {
-        printf("Invalid: source file must be a .bmp file\n");
-        return e_failure;
-    }
-
-    // 2. Validate secret file (must have a dot)
-    char *dot = strrchr(argv[3], '.');
-    if(dot == NULL)
-    {
-        printf("Invalid: secret file must have an extension (.txt/.c/.sh)\n");
+        encode_log(encInfo, "Invalid: source file must be a .bmp file\n");
         return e_failure;
     }
 
-    if(strcmp(dot, ".txt") == 0 || strcmp(dot, ".c") == 0 || strcmp(dot, ".sh") == 0)
+    // 2. Any file can be the secret, its extension (from the last dot of
+    // the file name, none without one) is stored with it. "fd:N" reads it
+    // from an open descriptor and takes the extension from secret_extn
+    const char *dot = secret_extension(argv[3]);
+    if(strncmp(argv[3], "fd:", 3) == 0)
     {
-        encInfo->secret_fname = argv[3];
+        dot = encInfo->secret_extn ? encInfo->secret_extn : ".txt";
     }
-    else
+    if(strlen(dot) > STEG_MAX_EXTN)
     {
-        printf("Invalid: secret file must be a .txt, .c, or .sh file\n");
+        encode_log(encInfo, "Invalid: secret file extension is longer than %d bytes\n", STEG_MAX_EXTN);
         return e_failure;
     }
+    encInfo->secret_fname = argv[3];
+    encInfo->secret_extn = dot;
 
     // 3. Validate optional output BMP file (check if argv[4] exists first)
     if(argv[4] == NULL)
     {
-        encInfo->stego_image_fname = "output.bmp";  // default
+        // --in-place without an output hides the secret in the source image itself
+        encInfo->stego_image_fname = encInfo->in_place ? encInfo->src_image_fname : "output.bmp";  // default
     }
     else
     {
-        if(strstr(argv[4], ".bmp") == NULL)
+        if(strstr(argv[4], ".bmp") == NULL && strcmp(argv[4], "-") != 0)
         {
-            printf("Invalid: output file must be a .bmp file\n");
+            encode_log(encInfo, "Invalid: output file must be a .bmp file\n");
             return e_failure;
         }
         else
@@ -97,32 +162,337 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     return e_success;
 }
 
+/* -m <source.bmp> <output.bmp> <secret>...: every secret becomes a directory entry */
+Status read_and_validate_bundle_args(int argc, char *argv[], EncodeInfo *encInfo)
+{
+    if(strstr(argv[2], ".bmp") == NULL && strcmp(argv[2], "-") != 0)
+    {
+        encode_log(encInfo, "Invalid: source file must be a .bmp file\n");
+        return e_failure;
+    }
+    encInfo->src_image_fname = argv[2];
+
+    if(strstr(argv[3], ".bmp") == NULL && strcmp(argv[3], "-") != 0)
+    {
+        encode_log(encInfo, "Invalid: output file must be a .bmp file\n");
+        return e_failure;
+    }
+    encInfo->stego_image_fname = argv[3];
+
+    // Entries are named after the file name part of each path
+    for(int i = 4; i < argc; i++)
+    {
+        const char *slash = strrchr(argv[i], '/');
+        if(dir_valid_name(slash ? slash + 1 : argv[i]) == e_failure || strncmp(argv[i], "fd:", 3) == 0)
+        {
+            encode_log(encInfo, "Invalid: %s can't be stored as a directory entry\n", argv[i]);
+            return e_failure;
+        }
+    }
+    encInfo->bundle_fnames = argv + 4;
+    encInfo->bundle_count = argc - 4;
+    encInfo->secret_extn = "";
+    return e_success;
+}
+
+/*
+ * Read side of -m: a stdio stream that yields the directory and then
+ * each member file in turn, so the container is embedded like one
+ * secret. Members are opened one at a time as the stream reaches them.
+ */
+typedef struct
+{
+    unsigned char *dir;                 // Serialized directory
+    size_t dir_size, dir_pos;
+    Directory entries;
+    char **fnames;
+    size_t current;                     // Member being read
+    FILE *member;
+    uint64_t remaining;                 // Bytes of the current member still to hand out
+} BundleStream;
+
+static ssize_t bundle_stream_read(void *cookie, char *buffer, size_t size)
+{
+    BundleStream *stream = cookie;
+    size_t copied = 0;
+    if(stream->dir_pos < stream->dir_size)
+    {
+        copied = stream->dir_size - stream->dir_pos < size ? stream->dir_size - stream->dir_pos : size;
+        memcpy(buffer, stream->dir + stream->dir_pos, copied);
+        stream->dir_pos += copied;
+    }
+    while(copied < size && stream->current < stream->entries.count)
+    {
+        if(stream->member == NULL)
+        {
+            stream->member = fopen(stream->fnames[stream->current], "r");
+            stream->remaining = stream->entries.entries[stream->current].length;
+            if(stream->member == NULL)
+            {
+                return -1;
+            }
+        }
+        size_t want = size - copied < stream->remaining ? size - copied : (size_t)stream->remaining;
+        size_t bytes_read = want ? fread(buffer + copied, 1, want, stream->member) : 0;
+        if(bytes_read < want)
+        {
+            // The file shrank since it was measured
+            return -1;
+        }
+        copied += bytes_read;
+        stream->remaining -= bytes_read;
+        if(stream->remaining == 0)
+        {
+            fclose(stream->member);
+            stream->member = NULL;
+            stream->current++;
+        }
+    }
+    return copied;
+}
+
+static int bundle_stream_close(void *cookie)
+{
+    BundleStream *stream = cookie;
+    if(stream->member != NULL)
+    {
+        fclose(stream->member);
+    }
+    dir_free(&stream->entries);
+    free(stream->dir);
+    free(stream);
+    return 0;
+}
+
+/* Measure and checksum one member for its directory entry */
+static Status measure_member(const char *fname, uint64_t *length, uint32_t *crc, unsigned char *buffer)
+{
+    FILE *fptr = fopen(fname, "r");
+    struct stat st;
+    if(fptr == NULL || fstat(fileno(fptr), &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if(fptr != NULL)
+        {
+            fclose(fptr);
+        }
+        return e_failure;
+    }
+    *length = 0;
+    *crc = 0;
+    size_t bytes_read;
+    while((bytes_read = fread(buffer, 1, STEG_SECRET_CHUNK, fptr)) > 0)
+    {
+        *crc = crc32c_update(*crc, buffer, bytes_read);
+        *length += bytes_read;
+    }
+    Status status = ferror(fptr) ? e_failure : e_success;
+    fclose(fptr);
+    return status;
+}
+
+/*
+ * -m: build the directory of the member files (one read of each for
+ * its size and CRC32C) and put the container stream in place of the
+ * secret file
+ */
+static Status open_bundle(EncodeInfo *encInfo)
+{
+    BundleStream *stream = calloc(1, sizeof(BundleStream));
+    unsigned char *buffer = malloc(STEG_SECRET_CHUNK);
+    Status status = stream && buffer ? e_success : e_failure;
+    for(int i = 0; status == e_success && i < encInfo->bundle_count; i++)
+    {
+        const char *fname = encInfo->bundle_fnames[i];
+        const char *slash = strrchr(fname, '/');
+        uint64_t length;
+        uint32_t crc;
+        if(measure_member(fname, &length, &crc, buffer) == e_failure)
+        {
+            encode_log(encInfo, "Invalid: %s is not a readable regular file\n", fname);
+            status = e_failure;
+        }
+        else if(dir_add(&stream->entries, slash ? slash + 1 : fname, length, crc) == e_failure)
+        {
+            encode_log(encInfo, "Invalid: directory entry %s is given twice\n", slash ? slash + 1 : fname);
+            status = e_failure;
+        }
+    }
+    free(buffer);
+    if(status == e_success)
+    {
+        dir_layout(&stream->entries);
+        stream->dir_size = stream->entries.size;
+        stream->dir = malloc(stream->dir_size);
+        status = stream->dir ? e_success : e_failure;
+    }
+
+    cookie_io_functions_t io = {bundle_stream_read, NULL, NULL, bundle_stream_close};
+    FILE *bundle = status == e_success ? fopencookie(stream, "r", io) : NULL;
+    if(bundle == NULL)
+    {
+        if(stream != NULL)
+        {
+            dir_free(&stream->entries);
+            free(stream->dir);
+        }
+        free(stream);
+        return e_failure;
+    }
+    dir_serialize(&stream->entries, stream->dir);
+    stream->fnames = encInfo->bundle_fnames;
+
+    uint64_t size = stream->dir_size;
+    for(size_t i = 0; i < stream->entries.count; i++)
+    {
+        size += stream->entries.entries[i].length;
+    }
+    encInfo->fptr_secret = bundle;
+    encInfo->size_secret_file = size;
+    encInfo->secret_size_known = 1;
+    encode_log(encInfo, "Building directory Done (%d entries, %llu bytes)\n", encInfo->bundle_count,
+               (unsigned long long)stream->dir_size);
+    return e_success;
+}
+
+/*
+ * Take the carrier from encInfo->carrier_cache: its header is copied
+ * and the source stream is left at the first pixel byte, either on the
+ * file or, when the cache holds the whole image (and outside mmap mode,
+ * which copies it in map_stego_image()), on that image in memory.
+ * e_failure leaves the source untouched for the usual read.
+ */
+static Status open_cached_carrier(EncodeInfo *encInfo)
+{
+    Carrier *carrier = &encInfo->carrier;
+    if(carrier_cache_get(encInfo->carrier_cache, fileno(encInfo->fptr_src_image), carrier) == e_failure)
+    {
+        return e_failure;
+    }
+    FILE *image = NULL;
+    if(carrier->image != NULL && encInfo->io_mode != e_io_mmap)
+    {
+        image = fmemopen((void *)carrier->image, carrier->image_size, "r");
+    }
+    encInfo->bmp_header = malloc(carrier->header_size);
+    if(encInfo->bmp_header == NULL || fseeko(image ? image : encInfo->fptr_src_image, carrier->header_size, SEEK_SET) != 0)
+    {
+        free(encInfo->bmp_header);
+        encInfo->bmp_header = NULL;
+        if(image != NULL)
+        {
+            fclose(image);
+        }
+        carrier_cache_release(encInfo->carrier_cache, carrier);
+        return e_failure;
+    }
+    memcpy(encInfo->bmp_header, carrier->header, carrier->header_size);
+    encInfo->bmp_header_size = carrier->header_size;
+    encInfo->bmp = carrier->bmp;
+    if(image != NULL)
+    {
+        fclose(encInfo->fptr_src_image);
+        encInfo->fptr_src_image = image;
+    }
+    return e_success;
+}
 
 Status open_files(EncodeInfo *encInfo)
 {
+    int src_stream = strcmp(encInfo->src_image_fname, "-") == 0;
+    int stego_stream = strcmp(encInfo->stego_image_fname, "-") == 0;
+    if(encInfo->io_mode == e_io_mmap && (src_stream || stego_stream))
+    {
+        encode_log(encInfo, "Invalid: mmap mode needs regular files, not stdin/stdout\n");
+        return e_failure;
+    }
+
     // Open source BMP file
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    encInfo->fptr_src_image = src_stream ? stdin : open_stream(encInfo->src_image_fname, "r");
     if(encInfo->fptr_src_image == NULL)
     {
-        perror("Error opening source BMP file");
+        encode_perror(encInfo, "Error opening source BMP file");
+        return e_failure;
+    }
+    int cached = encInfo->carrier_cache != NULL && !src_stream && open_cached_carrier(encInfo) == e_success;
+    if(encInfo->io_mode == e_io_async && !src_stream)
+    {
+        // Read-ahead stream, a source that isn't a regular file (or is cached) stays on stdio
+        FILE *async = aio_open(encInfo->fptr_src_image, "r");
+        if(async != NULL)
+        {
+            encInfo->fptr_src_image = async;
+        }
+    }
+
+    // Read and parse the BMP headers once, so nothing needs to seek back on a pipe
+    if(!cached &&
+       bmp_read_header(encInfo->fptr_src_image, &encInfo->bmp_header, &encInfo->bmp_header_size, &encInfo->bmp) == e_failure)
+    {
+        encode_log(encInfo, "Invalid: source image is not a 24/32 bpp uncompressed BMP\n");
         return e_failure;
     }
+    encInfo->stego_pos = encInfo->bmp.pixel_offset;
+    encInfo->carrier_index = 0;
 
-    // Open secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    // Open secret file, the -m container, or the descriptor given as fd:N
+    if(encInfo->bundle_count > 0)
+    {
+        if(open_bundle(encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        encInfo->fptr_secret = open_stream(encInfo->secret_fname, "r");
+    }
     if(encInfo->fptr_secret == NULL)
     {
-        perror("Error opening secret file");
+        encode_perror(encInfo, "Error opening secret file");
         return e_failure;
     }
 
-    // Open stego image file (output BMP)
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    // Open stego image file (output BMP), mmap mode also needs to map it writable
+    if(stego_stream)
+    {
+        encInfo->fptr_stego_image = stdout;
+    }
+    else if(encInfo->in_place)
+    {
+        // A clone of the source, or the source itself, instead of a new file
+        if(inplace_open(&encInfo->inplace, fileno(encInfo->fptr_src_image), encInfo->stego_image_fname) == e_failure)
+        {
+            encode_perror(encInfo, "Error preparing output BMP file for --in-place");
+            return e_failure;
+        }
+        if(encInfo->inplace.rolled_back)
+        {
+            encode_log(encInfo, "Rolled back an interrupted --in-place run on %s\n", encInfo->stego_image_fname);
+        }
+        int fd = dup(encInfo->inplace.fd);
+        encInfo->fptr_stego_image = fd >= 0 ? fdopen(fd, "r+") : NULL;
+        if(encInfo->fptr_stego_image == NULL && fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    else
+    {
+        encInfo->fptr_stego_image = open_stream(encInfo->stego_image_fname, encInfo->io_mode == e_io_mmap ? "w+" : "w");
+    }
     if(encInfo->fptr_stego_image == NULL)
     {
-        perror("Error opening output BMP file");
+        encode_perror(encInfo, "Error opening output BMP file");
         return e_failure;
     }
+    if(encInfo->io_mode == e_io_async && !stego_stream)
+    {
+        FILE *async = aio_open(encInfo->fptr_stego_image, "w");
+        if(async != NULL)
+        {
+            encInfo->fptr_stego_image = async;
+        }
+    }
 
     return e_success;
 }
@@ -130,13 +500,48 @@ Status open_files(EncodeInfo *encInfo)
 
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    encInfo->image_capacity = encInfo->bmp.capacity;
+
+    // A streamed secret can't be measured by seeking, its size comes up front
+    if(!encInfo->secret_size_known)
+    {
+        struct stat st;
+        if(fstat(fileno(encInfo->fptr_secret), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            encode_log(encInfo, "Invalid: secret size must be given (--secret-size) for a stream\n");
+            return e_failure;
+        }
+        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    }
     
-    /* capacity = (magic string size(2*8) + secret extn size(4*8) + secret file extn(4*8) + secret file size(4*8) + secret file data size*8; */
-    int capacity = 16 + 32 + 32 + 32 + (encInfo -> size_secret_file * 8);
+    /* capacity = header size*8 (1 bit per carrier byte) + secret file data size*8/depth; */
+    // The header is laid out here, once the payload size and flags are known
+    int flags = (encInfo->compress ? STEG_FLAG_COMPRESSED : 0) | (encInfo->encrypt ? STEG_FLAG_ENCRYPTED : 0) |
+                (encInfo->scatter ? STEG_FLAG_SCATTERED : 0) | (encInfo->checksum ? STEG_FLAG_CHECKSUM : 0) |
+                (encInfo->bundle_count > 0 ? STEG_FLAG_DIRECTORY : 0) | (encInfo->ecc ? STEG_FLAG_ECC : 0);
+    encInfo->header_version = encInfo->legacy_header ? steg_header_version(encInfo->size_secret_file) : STEG_HEADER_V2;
+    if(encInfo->header_version != STEG_HEADER_V2)
+    {
+        // Older readers take the pixel array as one run of bytes
+        bmp_use_legacy_layout(&encInfo->bmp);
+    }
+    encInfo->header_size = steg_write_header(encInfo->header, encInfo->header_version, encInfo->secret_extn,
+                                             encInfo->depth, flags, encInfo->ecc, encInfo->size_secret_file);
+    uint64_t stored = (uint64_t)encInfo->size_secret_file + (encInfo->checksum ? STEG_CHECKSUM_SIZE : 0);
+    uint64_t capacity = 8 * encInfo->header_size + (stored * 8 / encInfo->depth);
 
-    if(encInfo->image_capacity > capacity)
+    if(encInfo->scatter)
+    {
+        // Only whole tiles behind the header can take scattered payload
+        uint64_t header_end = 8 * encInfo->header_size;
+        if(scatter_init(&encInfo->scatter_map, encInfo->passphrase, &encInfo->bmp, header_end) == e_failure)
+        {
+            encode_log(encInfo, "Invalid: --scatter needs a passphrase (--passphrase-file or STEG_PASSPHRASE)\n");
+            return e_failure;
+        }
+        return stored * 8 / encInfo->depth <= scatter_capacity(&encInfo->scatter_map) ? e_success : e_failure;
+    }
+    if(encInfo->bmp.capacity > capacity)
     {
         return e_success;   
     }
@@ -147,16 +552,11 @@ Status check_capacity(EncodeInfo *encInfo)
     }
 }
         
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+Status copy_bmp_header(const unsigned char *header, size_t size, FILE *fptr_dest_image)
 {
-    // Setting pointer to point to 0th position
-    rewind(fptr_src_image);
-    char header[54];
-    // Reading 54 bytes of header from source.bmp
-    fread(header, 54, 1, fptr_src_image);
-    // Writing the 54 bytes header to destination.bmp
-    fwrite(header, 54, 1, fptr_dest_image);
-    if(ftell(fptr_src_image) == ftell(fptr_dest_image))
+    // Writing everything in front of the pixel array (headers, palette, gap)
+    // read by open_files() to destination.bmp
+    if(fwrite(header, size, 1, fptr_dest_image) == 1)
     {
         return e_success;
     }
@@ -168,145 +568,1149 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 }
 Status encode_byte_to_lsb(char data, char *image_buffer)
 {
-    for (int i = 0; i < 8; i++)
-    {
-        image_buffer[i] &= 0xFE;                   // clear LSB
-        image_buffer[i] |= ((data >> (7 - i)) & 1); // set bit
-    }
+    lsb_embed((unsigned char *)&data, 1, (unsigned char *)image_buffer);
     return e_success;
 }
 Status encode_size_to_lsb(int size, char *imageBuffer)
 {
-    for (int i = 0; i < 32; i++)
-    {
-        imageBuffer[i] &= 0xFE;
-        imageBuffer[i] |= ((size >> (31 - i)) & 1);
-    }
-    return e_success;
-}
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
-{
-    char imageBuffer[8];
-    for (int i = 0; i < strlen(magic_string); i++)
+    // Sizes are stored MSB first, i.e. as 4 big endian bytes
+    unsigned char bytes[4];
+    for (int i = 0; i < 4; i++)
     {
-        fread(imageBuffer, 8, 1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(magic_string[i], imageBuffer);
-        fwrite(imageBuffer, 8, 1, encInfo->fptr_stego_image);
+        bytes[i] = (unsigned char)((uint)size >> (24 - 8 * i));
     }
+    lsb_embed(bytes, 4, (unsigned char *)imageBuffer);
     return e_success;
 }
-Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+/* The next n usable carrier bytes sit back to back at the current position */
+static int carrier_is_direct(const EncodeInfo *encInfo, size_t n)
 {
-    char imageBuffer[32];
-    fread(imageBuffer, 32, 1, encInfo->fptr_src_image);
-    encode_size_to_lsb(size, imageBuffer);
-    fwrite(imageBuffer, 32, 1, encInfo->fptr_stego_image);
-    return e_success;
+    return bmp_carrier_run(&encInfo->bmp, encInfo->carrier_index) >= n &&
+           bmp_carrier_offset(&encInfo->bmp, encInfo->carrier_index) == encInfo->stego_pos;
 }
 
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/*
+ * Get the next n usable carrier bytes to embed into
+ * stdio: read them from the source image into buffer, padding and alpha
+ *        bytes in between are kept aside in raw_buffer
+ * mmap: point straight into the mapped stego image (or gather them into
+ *       buffer when padding or alpha bytes split them)
+ */
+static char *load_carrier(EncodeInfo *encInfo, char *buffer, size_t n)
 {
-    char imageBuffer[8];
-    for(int i=0; i<strlen(file_extn); i++)
+    const BmpInfo *bmp = &encInfo->bmp;
+    uint64_t first = bmp_carrier_offset(bmp, encInfo->carrier_index);
+    uint64_t end = bmp_span_end(bmp, encInfo->carrier_index, n);
+    if(encInfo->carrier_index + n > bmp->capacity)
     {
-        fread(imageBuffer,8 ,1, encInfo->fptr_src_image);
-        encode_byte_to_lsb(file_extn[i],imageBuffer);
-        fwrite(imageBuffer,8 ,1 ,encInfo->fptr_stego_image);
+        return NULL;
     }
-    return e_success;
-
-}
 
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
-{
-    char imageBuffer[32];
-    fread(imageBuffer, 32, 1,encInfo->fptr_src_image);
-    encode_size_to_lsb(file_size, imageBuffer);
-    fwrite(imageBuffer,32 ,1 ,encInfo->fptr_stego_image);
-    return e_success;
-}
+    if(encInfo->io_mode == e_io_mmap)
+    {
+        if(end > encInfo->stego_map_size)
+        {
+            return NULL;
+        }
+        if(end - first == n)
+        {
+            return (char *)encInfo->stego_map + first;
+        }
+        bmp_gather(bmp, encInfo->stego_map, 0, encInfo->carrier_index, n, (unsigned char *)buffer);
+        return buffer;
+    }
 
-Status encode_secret_file_data(EncodeInfo *encInfo)
-{
-    if(!encInfo || !encInfo->fptr_secret || !encInfo->fptr_src_image || !encInfo->fptr_stego_image)
+    if(carrier_is_direct(encInfo, n))
     {
-        return e_failure;
+        if(fread(buffer, 1, n, encInfo->fptr_src_image) != n)
+        {
+            return NULL;
+        }
+        return buffer;
     }
-   
 
-    rewind(encInfo->fptr_secret);
+    // Read the raw span from the current position and pick the usable bytes
+    size_t raw_size = end - encInfo->stego_pos;
+    if(raw_size > encInfo->raw_buffer_size)
+    {
+        unsigned char *raw = realloc(encInfo->raw_buffer, raw_size);
+        if(raw == NULL)
+        {
+            return NULL;
+        }
+        encInfo->raw_buffer = raw;
+        encInfo->raw_buffer_size = raw_size;
+    }
+    if(fread(encInfo->raw_buffer, 1, raw_size, encInfo->fptr_src_image) != raw_size)
+    {
+        return NULL;
+    }
+    bmp_gather(bmp, encInfo->raw_buffer, encInfo->stego_pos, encInfo->carrier_index, n, (unsigned char *)buffer);
+    return buffer;
+}
 
-    int byte_read;
-    char imageBuffer[8];
+/* Hand back carrier bytes from load_carrier() once the secret bits are in */
+static Status store_carrier(EncodeInfo *encInfo, char *carrier, size_t n)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    uint64_t first = bmp_carrier_offset(bmp, encInfo->carrier_index);
+    uint64_t end = bmp_span_end(bmp, encInfo->carrier_index, n);
+    Status status = e_success;
 
-    // Read secret file one byte at a time to avoid large memory use
-    while(fread(&byte_read, 1, 1, encInfo->fptr_secret) == 1)
+    if(encInfo->io_mode == e_io_mmap)
     {
-        if(fread(imageBuffer, 8, 1, encInfo->fptr_src_image) != 1)
+        if(carrier != (char *)encInfo->stego_map + first)
         {
-            return e_failure; 
+            bmp_scatter(bmp, encInfo->stego_map, 0, encInfo->carrier_index, n, (unsigned char *)carrier);
         }
-        encode_byte_to_lsb((char)byte_read, imageBuffer);
-
-        if (fwrite(imageBuffer, 8, 1, encInfo->fptr_stego_image) != 1)
+    }
+    else if(carrier_is_direct(encInfo, n))
+    {
+        if(fwrite(carrier, 1, n, encInfo->fptr_stego_image) != n)
+        {
+            status = e_failure;
+        }
+    }
+    else
+    {
+        size_t raw_size = end - encInfo->stego_pos;
+        bmp_scatter(bmp, encInfo->raw_buffer, encInfo->stego_pos, encInfo->carrier_index, n, (unsigned char *)carrier);
+        if(fwrite(encInfo->raw_buffer, 1, raw_size, encInfo->fptr_stego_image) != raw_size)
         {
-            return e_failure; 
+            status = e_failure;
         }
-            
     }
 
-    return e_success;
+    encInfo->stego_pos = end;
+    encInfo->carrier_index += n;
+    return status;
 }
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+
+/* Store the header laid out by check_capacity(), 1 bit per carrier byte */
+Status encode_stego_header(EncodeInfo *encInfo)
 {
-    char ch;
-    while(fread(&ch, 1, 1, fptr_src) > 0)
+    char imageBuffer[8 * STEG_MAX_HEADER];
+    size_t n = 8 * encInfo->header_size;
+    char *carrier = load_carrier(encInfo, imageBuffer, n);
+    if(carrier == NULL)
     {
-        fwrite(&ch, 1, 1, fptr_dest);
+        return e_failure;
     }
-    return e_success;
+    lsb_embed(encInfo->header, encInfo->header_size, (unsigned char *)carrier);
+    return store_carrier(encInfo, carrier, n);
 }
-Status do_encoding(EncodeInfo *encInfo)
+
+/* Secret and carrier spans shared by the embed workers */
+typedef struct _EmbedJob
 {
-    printf("Opening files Done\n");
-    if(open_files(encInfo) == e_failure)
+    const unsigned char *secret;
+    unsigned char *map;         // Mapped stego image
+    const BmpInfo *bmp;
+    uint64_t first_index;       // Carrier index of secret byte 0
+    int depth;                  // Payload bits per carrier byte
+    size_t size;
+    const ScatterMap *scatter;  // Tile permutation, NULL for a sequential payload
+    uint32_t *crc;              // CRC32C of each worker's slice, NULL without --checksum
+    Status *status;             // One per worker
+} EmbedJob;
+
+static void embed_worker(void *ctx, int index, int nthreads)
+{
+    EmbedJob *job = ctx;
+    size_t begin, end;
+    parallel_range(job->size, STEG_PARALLEL_GRAIN, index, nthreads, &begin, &end);
+    job->status[index] = e_success;
+    if(job->crc != NULL)
     {
-        return e_failure;
+        job->crc[index] = 0;
     }
-    printf("Checking capacity Done\n");
-    if(check_capacity(encInfo) == e_failure)
+    const size_t per_byte = 8 / job->depth;
+
+    // Padding or alpha bytes split the span: gather, embed and scatter back
+    unsigned char *scratch = job->bmp->contiguous ? NULL : malloc(STEG_BLOCK_SIZE);
+    if(scratch == NULL && !job->bmp->contiguous)
     {
-        return e_failure;
+        job->status[index] = e_failure;
+        return;
     }
-    printf("Copying BMP header Done\n");
-    if(copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    for(size_t done = begin; done < end; )
     {
-        return e_failure;
+        size_t chunk = end - done < STEG_SECRET_CHUNK ? end - done : STEG_SECRET_CHUNK;
+        uint64_t carrier_index = job->first_index + done * per_byte;
+        if(job->scatter != NULL)
+        {
+            // One tile at a time, wherever the key puts it
+            size_t tile_left = scatter_run(done * per_byte) / per_byte;
+            chunk = chunk < tile_left ? chunk : tile_left;
+            carrier_index = scatter_index(job->scatter, done * per_byte);
+        }
+        if(job->crc != NULL)
+        {
+            job->crc[index] = crc32c_update(job->crc[index], job->secret + done, chunk);
+        }
+        if(scratch == NULL)
+        {
+            uint64_t offset = bmp_carrier_offset(job->bmp, carrier_index);
+            lsb_embed_bits(job->secret + done, chunk, job->map + offset, job->depth);
+        }
+        else
+        {
+            bmp_gather(job->bmp, job->map, 0, carrier_index, chunk * per_byte, scratch);
+            lsb_embed_bits(job->secret + done, chunk, scratch, job->depth);
+            bmp_scatter(job->bmp, job->map, 0, carrier_index, chunk * per_byte, scratch);
+        }
+        done += chunk;
     }
-    printf("Encoding magic string Done\n");
-    if(encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
+    free(scratch);
+}
+
+/*
+ * mmap mode with -j N: map the secret as well and let every thread embed
+ * its own slice. Bit i still lands in the same carrier byte as in the
+ * serial path, so the output is identical.
+ */
+static Status encode_secret_file_data_parallel(EncodeInfo *encInfo, const unsigned char *secret)
+{
+    size_t size = encInfo->size_secret_file;
+    uint64_t carrier_bytes = (uint64_t)size * 8 / encInfo->depth;
+    if(!encInfo->scatter &&
+       (encInfo->carrier_index + carrier_bytes > encInfo->bmp.capacity ||
+        bmp_span_end(&encInfo->bmp, encInfo->carrier_index, carrier_bytes) > encInfo->stego_map_size))
     {
         return e_failure;
     }
-    // Get secret file extension (.txt)
-    char *extn = strstr(encInfo->secret_fname, ".");
-    int extn_size = strlen(extn);
 
-    printf("Encoding file extension size Done\n");
-    encode_secret_file_extn_size(extn_size, encInfo);
-
-    printf("Encoding file extension Done\n");
-    encode_secret_file_extn(extn, encInfo);
-
-    printf("Encoding secret file size Done\n");
-    encode_secret_file_size(encInfo->size_secret_file, encInfo);
+    Status *worker_status = malloc(sizeof(Status) * encInfo->threads);
+    uint32_t *worker_crc = malloc(sizeof(uint32_t) * encInfo->threads);
+    if(worker_status == NULL || worker_crc == NULL)
+    {
+        free(worker_status);
+        free(worker_crc);
+        return e_failure;
+    }
 
-    printf("Encoding secret file data Done\n");
-    encode_secret_file_data(encInfo);
+    EmbedJob job = {secret, encInfo->stego_map, &encInfo->bmp, encInfo->carrier_index, encInfo->depth, size,
+                    encInfo->scatter ? &encInfo->scatter_map : NULL, encInfo->checksum ? worker_crc : NULL,
+                    worker_status};
+    Status status = parallel_run(encInfo->threads, embed_worker, &job);
+    for(int i = 0; i < encInfo->threads; i++)
+    {
+        if(worker_status[i] == e_failure)
+        {
+            status = e_failure;
+        }
+        if(encInfo->checksum)
+        {
+            // Chain the slice CRCs in payload order
+            size_t begin, end;
+            parallel_range(size, STEG_PARALLEL_GRAIN, i, encInfo->threads, &begin, &end);
+            encInfo->payload_crc = crc32c_combine(encInfo->payload_crc, worker_crc[i], end - begin);
+        }
+    }
+    free(worker_status);
+    free(worker_crc);
 
-    printf("Copying remaining image data Done\n");
-    copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image);
+    encInfo->stego_pos = bmp_span_end(&encInfo->bmp, encInfo->carrier_index, carrier_bytes);
+    encInfo->carrier_index += carrier_bytes;
+    return status;
+}
 
-    printf("Encoding complete! Stego image saved as %s\n", encInfo->stego_image_fname);
+/*
+ * Map the secret bytes still to be read from the secret stream, for the
+ * -j workers. NULL unless the stream is a regular file holding all of
+ * them (a pipe or a --compress/--encrypt stream is read serially).
+ * *map and *map_size are what to munmap() afterwards.
+ */
+static const unsigned char *map_secret(EncodeInfo *encInfo, void **map, size_t *map_size)
+{
+    int fd = fileno(encInfo->fptr_secret);
+    struct stat st;
+    off_t position = fd >= 0 ? ftello(encInfo->fptr_secret) : -1;
+    if(position < 0 || encInfo->size_secret_file == 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+       st.st_size - position < encInfo->size_secret_file)
+    {
+        return NULL;
+    }
+    // mmap takes a page aligned offset, the payload starts further in
+    off_t start = position & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    *map_size = encInfo->size_secret_file + (position - start);
+    *map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, start);
+    return *map == MAP_FAILED ? NULL : (const unsigned char *)*map + (position - start);
+}
+
+/*
+ * --scatter: embed n secret bytes tile by tile at the carrier bytes the
+ * key picks, offset counts the payload carrier bytes already placed
+ */
+static Status embed_scattered(EncodeInfo *encInfo, const char *secret, size_t n, uint64_t *offset, char *imageBuffer)
+{
+    const size_t per_byte = 8 / encInfo->depth;
+    while(n > 0)
+    {
+        size_t tile_left = scatter_run(*offset) / per_byte;
+        size_t chunk = n < tile_left ? n : tile_left;
+        encInfo->carrier_index = scatter_index(&encInfo->scatter_map, *offset);
+        char *carrier = load_carrier(encInfo, imageBuffer, chunk * per_byte);
+        if(carrier == NULL)
+        {
+            return e_failure;
+        }
+        lsb_embed_bits((const unsigned char *)secret, chunk, (unsigned char *)carrier, encInfo->depth);
+        if(store_carrier(encInfo, carrier, chunk * per_byte) == e_failure)
+        {
+            return e_failure;
+        }
+        secret += chunk;
+        n -= chunk;
+        *offset += chunk * per_byte;
+    }
+    return e_success;
+}
+
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    if(!encInfo || !encInfo->fptr_secret || !encInfo->fptr_src_image || !encInfo->fptr_stego_image)
+    {
+        return e_failure;
+    }
+
+    // A sealed secret is produced on the fly and can't be mapped
+    if(encInfo->io_mode == e_io_mmap && encInfo->threads > 1)
+    {
+        void *map;
+        size_t map_size;
+        const unsigned char *secret = map_secret(encInfo, &map, &map_size);
+        if(secret != NULL)
+        {
+            Status status = encode_secret_file_data_parallel(encInfo, secret);
+            munmap(map, map_size);
+            return status;
+        }
+    }
+   
+
+    // Embed exactly size_secret_file bytes, a stream may not be rewound
+    off_t remaining = encInfo->size_secret_file;
+
+    // Use the caller's work buffers when given, mmap mode on a contiguous
+    // pixel array needs no carrier buffer
+    char *secretBuffer = encInfo->chunk_buffer ? encInfo->chunk_buffer : malloc(STEG_SECRET_CHUNK);
+    char *imageBuffer = NULL;
+    int need_image_buffer = encInfo->io_mode != e_io_mmap || !encInfo->bmp.contiguous;
+    if(need_image_buffer)
+    {
+        imageBuffer = encInfo->block_buffer ? encInfo->block_buffer : malloc(STEG_BLOCK_SIZE);
+    }
+    if(secretBuffer == NULL || (imageBuffer == NULL && need_image_buffer))
+    {
+        if(secretBuffer != encInfo->chunk_buffer)
+            free(secretBuffer);
+        if(imageBuffer != encInfo->block_buffer)
+            free(imageBuffer);
+        return e_failure;
+    }
+
+    Status status = e_success;
+    size_t bytes_read;
+    uint64_t offset = 0;
+
+    // Read the secret a chunk at a time and embed it into the matching carrier block
+    while(remaining > 0)
+    {
+        size_t want = remaining < STEG_SECRET_CHUNK ? (size_t)remaining : STEG_SECRET_CHUNK;
+        bytes_read = fread(secretBuffer, 1, want, encInfo->fptr_secret);
+        if(bytes_read == 0)
+        {
+            encode_log(encInfo, "Invalid: secret ended before its declared size\n");
+            status = e_failure;
+            break;
+        }
+        remaining -= bytes_read;
+        if(encInfo->checksum)
+        {
+            encInfo->payload_crc = crc32c_update(encInfo->payload_crc, secretBuffer, bytes_read);
+        }
+        if(encInfo->scatter)
+        {
+            if(embed_scattered(encInfo, secretBuffer, bytes_read, &offset, imageBuffer) == e_failure)
+            {
+                status = e_failure;
+                break;
+            }
+            continue;
+        }
+        size_t block_size = bytes_read * 8 / encInfo->depth;
+        char *carrier = load_carrier(encInfo, imageBuffer, block_size);
+        if(carrier == NULL)
+        {
+            status = e_failure;
+            break;
+        }
+        lsb_embed_bits((unsigned char *)secretBuffer, bytes_read, (unsigned char *)carrier, encInfo->depth);
+
+        if(store_carrier(encInfo, carrier, block_size) == e_failure)
+        {
+            status = e_failure;
+            break;
+        }
+    }
+
+    if(secretBuffer != encInfo->chunk_buffer)
+        free(secretBuffer);
+    if(imageBuffer != encInfo->block_buffer)
+        free(imageBuffer);
+    return status;
+}
+
+/* --checksum: CRC32C of the stored payload, 4 bytes big endian right behind it */
+static Status encode_checksum(EncodeInfo *encInfo)
+{
+    char crc_bytes[STEG_CHECKSUM_SIZE];
+    char imageBuffer[8 * STEG_CHECKSUM_SIZE];
+    for(int i = 0; i < STEG_CHECKSUM_SIZE; i++)
+    {
+        crc_bytes[i] = (char)(encInfo->payload_crc >> (24 - 8 * i));
+    }
+    if(encInfo->scatter)
+    {
+        uint64_t offset = (uint64_t)encInfo->size_secret_file * 8 / encInfo->depth;
+        return embed_scattered(encInfo, crc_bytes, STEG_CHECKSUM_SIZE, &offset, imageBuffer);
+    }
+    size_t carrier_size = STEG_CHECKSUM_SIZE * 8 / encInfo->depth;
+    char *carrier = load_carrier(encInfo, imageBuffer, carrier_size);
+    if(carrier == NULL)
+    {
+        return e_failure;
+    }
+    lsb_embed_bits((unsigned char *)crc_bytes, STEG_CHECKSUM_SIZE, (unsigned char *)carrier, encInfo->depth);
+    return store_carrier(encInfo, carrier, carrier_size);
+}
+
+/* Copy the rest of the image through a STEG_BLOCK_SIZE buffer */
+static Status copy_image_blocks(FILE *fptr_src, FILE *fptr_dest, char *buffer)
+{
+    Status status = e_success;
+    size_t bytes_read;
+    while((bytes_read = fread(buffer, 1, STEG_BLOCK_SIZE, fptr_src)) > 0)
+    {
+        if(fwrite(buffer, 1, bytes_read, fptr_dest) != bytes_read)
+        {
+            status = e_failure;
+            break;
+        }
+    }
+    return status;
+}
+
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+{
+    char *buffer = malloc(STEG_BLOCK_SIZE);
+    if(buffer == NULL)
+    {
+        return e_failure;
+    }
+    Status status = copy_image_blocks(fptr_src, fptr_dest, buffer);
+    free(buffer);
+    return status;
+}
+/*
+ * --compress: squeeze the secret into an anonymous temporary file a
+ * block at a time and embed that instead. The rest of the pipeline
+ * only sees a smaller regular file of known size, and a streamed
+ * secret no longer needs --secret-size since it is read to EOF.
+ */
+static Status compress_secret_file(EncodeInfo *encInfo)
+{
+    FILE *packed = tmpfile();
+    LzEncoder *lz = malloc(sizeof(LzEncoder));
+    unsigned char *block = malloc(LZ_BLOCK_SIZE);
+    unsigned char *frame = malloc(LZ_FRAME_MAX);
+    Status status = packed && lz && block && frame ? e_success : e_failure;
+
+    off_t remaining = encInfo->secret_size_known ? encInfo->size_secret_file : -1;
+    off_t raw_size = 0, packed_size = 0;
+    while(status == e_success && remaining != 0)
+    {
+        size_t want = remaining < 0 || remaining > LZ_BLOCK_SIZE ? LZ_BLOCK_SIZE : (size_t)remaining;
+        size_t bytes_read = fread(block, 1, want, encInfo->fptr_secret);
+        if(bytes_read == 0)
+        {
+            if(remaining > 0)
+            {
+                encode_log(encInfo, "Invalid: secret ended before its declared size\n");
+                status = e_failure;
+            }
+            break;
+        }
+        size_t frame_size = lz_compress_block(lz, block, bytes_read, frame);
+        if(fwrite(frame, 1, frame_size, packed) != frame_size)
+        {
+            status = e_failure;
+        }
+        raw_size += bytes_read;
+        packed_size += frame_size;
+        if(remaining > 0)
+        {
+            remaining -= bytes_read;
+        }
+    }
+    free(lz);
+    free(block);
+    free(frame);
+
+    if(status == e_failure || fflush(packed) != 0)
+    {
+        if(packed != NULL)
+        {
+            fclose(packed);
+        }
+        return e_failure;
+    }
+    rewind(packed);
+    fclose(encInfo->fptr_secret);
+    encInfo->fptr_secret = packed;
+    encInfo->raw_secret_size = raw_size;
+    encInfo->size_secret_file = packed_size;
+    encInfo->secret_size_known = 1;
+    return e_success;
+}
+
+/*
+ * Drain the transformed secret stream into an anonymous temporary file
+ * block_size bytes at a time and embed that instead, for a streamed
+ * secret whose transformed size the header needs up front
+ */
+static Status spool_secret_file(EncodeInfo *encInfo, size_t block_size)
+{
+    FILE *stream = encInfo->fptr_secret;
+    FILE *spool = tmpfile();
+    char *block = malloc(block_size);
+    Status status = spool && block ? e_success : e_failure;
+    off_t spooled_size = 0;
+    size_t bytes_read;
+    while(status == e_success && (bytes_read = fread(block, 1, block_size, stream)) > 0)
+    {
+        if(fwrite(block, 1, bytes_read, spool) != bytes_read)
+        {
+            status = e_failure;
+        }
+        spooled_size += bytes_read;
+    }
+    if(status == e_success && (ferror(stream) || fflush(spool) != 0))
+    {
+        status = e_failure;
+    }
+    free(block);
+    if(status == e_failure)
+    {
+        if(spool != NULL)
+        {
+            fclose(spool);
+        }
+        return e_failure;
+    }
+    rewind(spool);
+    fclose(stream);
+    encInfo->fptr_secret = spool;
+    encInfo->size_secret_file = spooled_size;
+    encInfo->secret_size_known = 1;
+    return e_success;
+}
+
+/*
+ * Read side of --encrypt: a stdio stream that yields the seal.h stream
+ * of the secret a segment at a time, so sealing costs no extra pass
+ * over the data. A secret of unknown size is peeked one byte ahead to
+ * find its last segment.
+ */
+typedef struct
+{
+    FILE *plain;
+    off_t remaining;                    // Plain bytes still to seal, -1 until EOF
+    int done;                           // Last segment produced
+    SealEncoder seal;
+    size_t frame_size, frame_pos;       // Sealed bytes buffered and already handed out
+    unsigned char frame[SEAL_FRAME_MAX];
+    unsigned char segment[SEAL_SEGMENT_SIZE];
+} SealStream;
+
+static int seal_next_frame(SealStream *stream)
+{
+    size_t want = stream->remaining < 0 || stream->remaining > SEAL_SEGMENT_SIZE
+                  ? SEAL_SEGMENT_SIZE : (size_t)stream->remaining;
+    size_t bytes_read = fread(stream->segment, 1, want, stream->plain);
+    int last;
+    if(stream->remaining >= 0)
+    {
+        if(bytes_read < want)
+        {
+            return -1;
+        }
+        stream->remaining -= bytes_read;
+        last = stream->remaining == 0;
+    }
+    else
+    {
+        int next = bytes_read < want ? EOF : getc(stream->plain);
+        last = next == EOF || ungetc(next, stream->plain) == EOF;
+    }
+    stream->frame_size = seal_segment(&stream->seal, stream->segment, bytes_read, last, stream->frame);
+    stream->frame_pos = 0;
+    stream->done = last;
+    return 0;
+}
+
+static ssize_t seal_stream_read(void *cookie, char *buffer, size_t size)
+{
+    SealStream *stream = cookie;
+    size_t copied = 0;
+    while(copied < size)
+    {
+        if(stream->frame_pos == stream->frame_size)
+        {
+            if(stream->done)
+            {
+                break;
+            }
+            if(seal_next_frame(stream) != 0)
+            {
+                return -1;
+            }
+        }
+        size_t take = stream->frame_size - stream->frame_pos;
+        if(take > size - copied)
+        {
+            take = size - copied;
+        }
+        memcpy(buffer + copied, stream->frame + stream->frame_pos, take);
+        stream->frame_pos += take;
+        copied += take;
+    }
+    return copied;
+}
+
+static int seal_stream_close(void *cookie)
+{
+    SealStream *stream = cookie;
+    int status = fclose(stream->plain);
+    seal_encoder_clear(&stream->seal);
+    secure_wipe(stream->segment, sizeof(stream->segment));
+    free(stream);
+    return status;
+}
+
+/*
+ * --encrypt: swap the (possibly compressed) secret for its sealed
+ * stream. A secret of known size is sealed on the fly while it is
+ * embedded, a streamed one is sealed into an anonymous temporary file
+ * first since the header needs the final size up front.
+ */
+static Status encrypt_secret_file(EncodeInfo *encInfo)
+{
+    if(encInfo->passphrase == NULL || encInfo->passphrase[0] == '\0')
+    {
+        encode_log(encInfo, "Invalid: --encrypt needs a passphrase (--passphrase-file or STEG_PASSPHRASE)\n");
+        return e_failure;
+    }
+    // A regular file is measured now so it can be sealed on the fly
+    struct stat st;
+    if(!encInfo->secret_size_known && fstat(fileno(encInfo->fptr_secret), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+        encInfo->secret_size_known = 1;
+    }
+    SealStream *stream = malloc(sizeof(SealStream));
+    if(stream == NULL)
+    {
+        return e_failure;
+    }
+    if(seal_encoder_init(&stream->seal, encInfo->passphrase, SEAL_ITERATIONS) == e_failure)
+    {
+        encode_log(encInfo, "Invalid: could not derive the encryption key\n");
+        free(stream);
+        return e_failure;
+    }
+    stream->plain = encInfo->fptr_secret;
+    stream->remaining = encInfo->secret_size_known ? encInfo->size_secret_file : -1;
+    stream->done = 0;
+    memcpy(stream->frame, stream->seal.header, SEAL_HEADER_SIZE);
+    stream->frame_size = SEAL_HEADER_SIZE;
+    stream->frame_pos = 0;
+
+    cookie_io_functions_t io = {seal_stream_read, NULL, NULL, seal_stream_close};
+    FILE *sealed = fopencookie(stream, "r", io);
+    if(sealed == NULL)
+    {
+        seal_encoder_clear(&stream->seal);
+        free(stream);
+        return e_failure;
+    }
+    encInfo->fptr_secret = sealed;
+    if(encInfo->secret_size_known)
+    {
+        encInfo->size_secret_file = seal_sealed_size(encInfo->size_secret_file);
+        return e_success;
+    }
+    return spool_secret_file(encInfo, SEAL_FRAME_MAX);
+}
+
+/*
+ * Read side of --ecc: a stdio stream that yields the ecc.h codewords of
+ * the (compressed, sealed) secret one interleaved group at a time, like
+ * the sealed stream above
+ */
+typedef struct
+{
+    FILE *plain;
+    off_t remaining;                    // Bytes still to encode, -1 until EOF
+    int done;                           // Last group produced
+    EccEncoder ecc;
+    size_t group_size, group_pos;       // Encoded bytes buffered and already handed out
+    unsigned char group[ECC_GROUP_SIZE];
+    unsigned char data[ECC_GROUP_SIZE];
+} EccStream;
+
+static int ecc_next_group(EccStream *stream)
+{
+    size_t full = ecc_group_data(stream->ecc.code.parity);
+    size_t want = stream->remaining < 0 || stream->remaining > (off_t)full ? full : (size_t)stream->remaining;
+    size_t bytes_read = fread(stream->data, 1, want, stream->plain);
+    if(stream->remaining >= 0)
+    {
+        if(bytes_read < want)
+        {
+            return -1;
+        }
+        stream->remaining -= bytes_read;
+        stream->done = stream->remaining == 0;
+    }
+    else
+    {
+        if(ferror(stream->plain))
+        {
+            return -1;
+        }
+        stream->done = bytes_read < want;
+    }
+    stream->group_size = ecc_encode_group(&stream->ecc, stream->data, bytes_read, stream->group);
+    stream->group_pos = 0;
+    return 0;
+}
+
+static ssize_t ecc_stream_read(void *cookie, char *buffer, size_t size)
+{
+    EccStream *stream = cookie;
+    size_t copied = 0;
+    while(copied < size)
+    {
+        if(stream->group_pos == stream->group_size)
+        {
+            if(stream->done)
+            {
+                break;
+            }
+            if(ecc_next_group(stream) != 0)
+            {
+                return -1;
+            }
+        }
+        size_t take = stream->group_size - stream->group_pos;
+        if(take > size - copied)
+        {
+            take = size - copied;
+        }
+        memcpy(buffer + copied, stream->group + stream->group_pos, take);
+        stream->group_pos += take;
+        copied += take;
+    }
+    return copied;
+}
+
+static int ecc_stream_close(void *cookie)
+{
+    EccStream *stream = cookie;
+    int status = fclose(stream->plain);
+    free(stream);
+    return status;
+}
+
+/*
+ * --ecc: swap the (compressed, sealed) secret for its Reed-Solomon
+ * codewords, last so they protect exactly the bytes that are embedded.
+ * A secret of known size is encoded on the fly, a streamed one is
+ * spooled first.
+ */
+static Status ecc_secret_file(EncodeInfo *encInfo)
+{
+    struct stat st;
+    if(!encInfo->secret_size_known && fstat(fileno(encInfo->fptr_secret), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+        encInfo->secret_size_known = 1;
+    }
+    EccStream *stream = malloc(sizeof(EccStream));
+    if(stream == NULL)
+    {
+        return e_failure;
+    }
+    if(ecc_init(&stream->ecc.code, encInfo->ecc) == e_failure)
+    {
+        encode_log(encInfo, "Invalid: --ecc takes an even number of parity bytes from %d to %d\n", ECC_MIN_PARITY,
+                   ECC_MAX_PARITY);
+        free(stream);
+        return e_failure;
+    }
+    stream->plain = encInfo->fptr_secret;
+    stream->remaining = encInfo->secret_size_known ? encInfo->size_secret_file : -1;
+    stream->done = 0;
+    stream->group_size = 0;
+    stream->group_pos = 0;
+
+    cookie_io_functions_t io = {ecc_stream_read, NULL, NULL, ecc_stream_close};
+    FILE *coded = fopencookie(stream, "r", io);
+    if(coded == NULL)
+    {
+        free(stream);
+        return e_failure;
+    }
+    encInfo->fptr_secret = coded;
+    if(encInfo->secret_size_known)
+    {
+        encInfo->size_secret_file = ecc_encoded_size(encInfo->size_secret_file, encInfo->ecc);
+        return e_success;
+    }
+    return spool_secret_file(encInfo, ECC_GROUP_SIZE);
+}
+
+/*
+ * Copy the whole source image into the stego file inside the kernel
+ * (copy_file_range, then sendfile, then a plain read/write loop)
+ */
+static Status clone_image_file(int src_fd, int dest_fd, off_t size)
+{
+    off_t in_off = 0, out_off = 0;
+#ifdef __linux__
+    while(in_off < size)
+    {
+        ssize_t copied = copy_file_range(src_fd, &in_off, dest_fd, &out_off, size - in_off, 0);
+        if(copied <= 0)
+        {
+            break;
+        }
+    }
+    if(in_off < size && lseek(dest_fd, out_off, SEEK_SET) == out_off)
+    {
+        while(in_off < size)
+        {
+            ssize_t copied = sendfile(dest_fd, src_fd, &in_off, size - in_off);
+            if(copied <= 0)
+            {
+                break;
+            }
+            out_off += copied;
+        }
+    }
+#endif
+    char buffer[64 * 1024];
+    while(in_off < size)
+    {
+        ssize_t bytes_read = pread(src_fd, buffer, sizeof(buffer), in_off);
+        if(bytes_read <= 0 || pwrite(dest_fd, buffer, bytes_read, out_off) != bytes_read)
+        {
+            return e_failure;
+        }
+        in_off += bytes_read;
+        out_off += bytes_read;
+    }
+    return e_success;
+}
+
+/* Write a whole carrier image held in memory into the stego file */
+static Status write_image_file(int dest_fd, const unsigned char *image, size_t size)
+{
+    size_t written = 0;
+    while(written < size)
+    {
+        ssize_t n = pwrite(dest_fd, image + written, size - written, written);
+        if(n <= 0)
+        {
+            return e_failure;
+        }
+        written += n;
+    }
+    return e_success;
+}
+
+/*
+ * mmap mode: clone the carrier into the stego file and map only the
+ * leading region that will carry payload bits
+ */
+static Status map_stego_image(EncodeInfo *encInfo, size_t payload_end)
+{
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int dest_fd = fileno(encInfo->fptr_stego_image);
+    struct stat st;
+    if(fstat(src_fd, &st) != 0 || (size_t)st.st_size < payload_end)
+    {
+        return e_failure;
+    }
+    if(encInfo->in_place)
+    {
+        // A reflink clone or the source itself already holds the image
+        if(encInfo->inplace.mode == e_inplace_copy && clone_image_file(src_fd, dest_fd, st.st_size) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else if(encInfo->carrier.image != NULL)
+    {
+        // Cached carrier: write it out from memory, the file isn't read again
+        if(write_image_file(dest_fd, encInfo->carrier.image, encInfo->carrier.image_size) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else if(clone_image_file(src_fd, dest_fd, st.st_size) == e_failure)
+    {
+        return e_failure;
+    }
+
+    void *map = mmap(NULL, payload_end, PROT_READ | PROT_WRITE, MAP_SHARED, dest_fd, 0);
+    if(map == MAP_FAILED)
+    {
+        encode_perror(encInfo, "mmap");
+        return e_failure;
+    }
+    encInfo->stego_map = map;
+    encInfo->stego_map_size = payload_end;
+    if(encInfo->in_place && inplace_protect(&encInfo->inplace, encInfo->bmp.pixel_offset,
+                                            payload_end - encInfo->bmp.pixel_offset) == e_failure)
+    {
+        encode_perror(encInfo, "Error journaling the carrier bytes for --in-place");
+        return e_failure;
+    }
+    encInfo->stego_pos = encInfo->bmp.pixel_offset;
+    encInfo->carrier_index = 0;
+    return e_success;
+}
+
+Status do_encoding(EncodeInfo *encInfo)
+{
+    if(encInfo->depth == 0)
+    {
+        encInfo->depth = 1;
+    }
+    if(encInfo->depth != 1 && encInfo->depth != 2 && encInfo->depth != 4)
+    {
+        encode_log(encInfo, "Invalid: depth must be 1, 2 or 4 bits per byte\n");
+        return e_failure;
+    }
+    if(encInfo->in_place && encInfo->io_mode != e_io_mmap)
+    {
+        encode_log(encInfo, "Invalid: --in-place writes through the mapping of --io=mmap\n");
+        return e_failure;
+    }
+    if(encInfo->scatter && encInfo->io_mode != e_io_mmap)
+    {
+        encode_log(encInfo, "Invalid: --scatter writes tiles out of order and needs --io=mmap\n");
+        return e_failure;
+    }
+    if(encInfo->bundle_count > 0 && (encInfo->compress || encInfo->encrypt || encInfo->ecc))
+    {
+        // Entries are read in place by their offset, which a transformed stream would hide
+        encode_log(encInfo, "Invalid: a directory container can't be combined with --compress, --encrypt or --ecc\n");
+        return e_failure;
+    }
+    if(encInfo->ecc && encInfo->legacy_header)
+    {
+        encode_log(encInfo, "Invalid: --ecc needs the version 2 header, drop --legacy-header\n");
+        return e_failure;
+    }
+    encode_log(encInfo, "Opening files Done\n");
+    if(open_files(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    stats_mark(encInfo->stats, "open");
+    if(encInfo->compress)
+    {
+        if(compress_secret_file(encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        encode_log(encInfo, "Compressing secret file Done (%lld -> %lld bytes)\n",
+                   (long long)encInfo->raw_secret_size, (long long)encInfo->size_secret_file);
+        stats_mark(encInfo->stats, "compress");
+    }
+    if(encInfo->encrypt)
+    {
+        if(encrypt_secret_file(encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        encode_log(encInfo, "Encrypting secret file Done (%lld bytes sealed)\n", (long long)encInfo->size_secret_file);
+        stats_mark(encInfo->stats, "encrypt");
+    }
+    if(encInfo->ecc)
+    {
+        if(ecc_secret_file(encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        encode_log(encInfo, "Adding error correction Done (%d parity bytes per %d byte codeword, %lld bytes stored)\n",
+                   encInfo->ecc, ECC_SYMBOLS, (long long)encInfo->size_secret_file);
+        stats_mark(encInfo->stats, "ecc");
+    }
+    encode_log(encInfo, "Checking capacity Done\n");
+    if(check_capacity(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    stats_mark(encInfo->stats, "capacity");
+    if(encInfo->io_mode == e_io_mmap)
+    {
+        uint64_t stored = (uint64_t)encInfo->size_secret_file + (encInfo->checksum ? STEG_CHECKSUM_SIZE : 0);
+        uint64_t payload_bits = 8 * encInfo->header_size + stored * 8 / encInfo->depth;
+        if(encInfo->scatter)
+        {
+            // Scattered tiles may land anywhere in the pixel array
+            payload_bits = encInfo->scatter_map.base + scatter_capacity(&encInfo->scatter_map);
+        }
+        size_t payload_end = bmp_span_end(&encInfo->bmp, 0, payload_bits);
+        if(map_stego_image(encInfo, payload_end) == e_failure)
+        {
+            return e_failure;
+        }
+        if(encInfo->in_place)
+        {
+            encode_log(encInfo, "Preparing %s in place Done (%s)\n", encInfo->stego_image_fname,
+                       inplace_mode_name(encInfo->inplace.mode));
+        }
+        else
+        {
+            encode_log(encInfo, "Cloning source image Done\n");
+        }
+        stats_mark(encInfo->stats, "clone");
+    }
+    else
+    {
+        encode_log(encInfo, "Copying BMP header Done\n");
+        if(copy_bmp_header(encInfo->bmp_header, encInfo->bmp_header_size, encInfo->fptr_stego_image) == e_failure)
+        {
+            return e_failure;
+        }
+        stats_mark(encInfo->stats, "bmp_header");
+    }
+    // Magic string, extension, size, depth and flags in one store
+    encode_log(encInfo, "Encoding stego header Done (version %d, %zu bytes)\n", encInfo->header_version,
+               encInfo->header_size);
+    if(encode_stego_header(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    stats_mark(encInfo->stats, "header");
+
+    encode_log(encInfo, "Encoding secret file data Done\n");
+    if(encode_secret_file_data(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    stats_mark(encInfo->stats, "data");
+    if(encInfo->checksum)
+    {
+        encode_log(encInfo, "Encoding payload checksum Done (crc32c %08x)\n", encInfo->payload_crc);
+        if(encode_checksum(encInfo) == e_failure)
+        {
+            return e_failure;
+        }
+        stats_mark(encInfo->stats, "checksum");
+    }
+
+    if(encInfo->io_mode == e_io_mmap)
+    {
+        munmap(encInfo->stego_map, encInfo->stego_map_size);
+        encInfo->stego_map = NULL;
+        stats_mark(encInfo->stats, "unmap");
+        if(encInfo->in_place)
+        {
+            // On disk before it replaces the target (or before the journal goes)
+            if(inplace_commit(&encInfo->inplace) == e_failure)
+            {
+                encode_perror(encInfo, "Error committing output BMP file");
+                return e_failure;
+            }
+            stats_mark(encInfo->stats, "commit");
+        }
+    }
+    else
+    {
+        encode_log(encInfo, "Copying remaining image data Done\n");
+        Status status = encInfo->block_buffer
+                        ? copy_image_blocks(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->block_buffer)
+                        : copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image);
+        if(status == e_failure)
+        {
+            return e_failure;
+        }
+        stats_mark(encInfo->stats, "copy");
+    }
+    if(encInfo->io_mode == e_io_async && encInfo->fptr_stego_image != stdout)
+    {
+        // Write-behind blocks are only waited for on close, that's where a write error shows
+        int closed = fclose(encInfo->fptr_stego_image);
+        encInfo->fptr_stego_image = NULL;
+        if(closed != 0)
+        {
+            encode_perror(encInfo, "Error writing output BMP file");
+            return e_failure;
+        }
+        stats_mark(encInfo->stats, "close");
+    }
+
+    encode_log(encInfo, "Encoding complete! Stego image saved as %s\n", encInfo->stego_image_fname);
     return e_success;
-}
\ No newline at end of file
+}
+
+/* Release everything open_files() and do_encoding() acquired */
+void close_files(EncodeInfo *encInfo)
+{
+    free(encInfo->bmp_header);
+    encInfo->bmp_header = NULL;
+    free(encInfo->raw_buffer);
+    encInfo->raw_buffer = NULL;
+    encInfo->raw_buffer_size = 0;
+    if(encInfo->stego_map != NULL)
+    {
+        munmap(encInfo->stego_map, encInfo->stego_map_size);
+        encInfo->stego_map = NULL;
+    }
+    if(encInfo->in_place)
+    {
+        // Not committed: drop the clone or roll the source back
+        inplace_abort(&encInfo->inplace);
+    }
+    if(encInfo->fptr_src_image != NULL && encInfo->fptr_src_image != stdin)
+    {
+        fclose(encInfo->fptr_src_image);
+        encInfo->fptr_src_image = NULL;
+    }
+    if(encInfo->carrier.entry != NULL)
+    {
+        carrier_cache_release(encInfo->carrier_cache, &encInfo->carrier);
+    }
+    if(encInfo->fptr_secret != NULL)
+    {
+        fclose(encInfo->fptr_secret);
+        encInfo->fptr_secret = NULL;
+    }
+    if(encInfo->fptr_stego_image == stdout)
+    {
+        fflush(stdout);
+        encInfo->fptr_stego_image = NULL;
+    }
+    else if(encInfo->fptr_stego_image != NULL)
+    {
+        fclose(encInfo->fptr_stego_image);
+        encInfo->fptr_stego_image = NULL;
+    }
+}
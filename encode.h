@@ -1,8 +1,17 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "steg.h"
+#include "scatter.h"
+#include "stats.h"
+#include "cache.h"
+#include "inplace.h"
+#include "common.h"
 
 /*
  * Structure to store information required for
@@ -16,19 +25,59 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname; // To store the src image name
     FILE *fptr_src_image;  // To store the address of the src image
-    uint image_capacity;   // To store the size of image
+    unsigned char *bmp_header; // Everything before the pixel array, read once by open_files()
+    size_t bmp_header_size;    // bfOffBits
+    BmpInfo bmp;               // Parsed header and pixel span descriptor
+    uint64_t image_capacity;   // To store the size of image
+    CarrierCache *carrier_cache;   // Shared cache.h cache to take the carrier from, NULL for none
+    Carrier carrier;               // Held from carrier_cache until close_files()
 
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
     FILE *fptr_secret;        // To store the secret file address
-    char extn_secret_file[5]; // To store the Secret file extension
-    char secret_data[100];    // To store the secret data
-    long size_secret_file;    // To store the size of the secret data
+    off_t size_secret_file;   // To store the size of the secret data
+    const char *secret_extn;  // Extension stored in the image (preset for fd:N secrets)
+    int secret_size_known;    // size_secret_file given up front (streamed secret)
+    char **bundle_fnames;     // -m: files packed into a directory container instead
+    int bundle_count;
 
     /* Stego Image Info */
     char *stego_image_fname; // To store the dest file name
     FILE *fptr_stego_image;  // To store the address of stego image
 
+    /* Carrier I/O */
+    IoMode io_mode;             // stdio streams or memory mapped stego image
+    unsigned char *stego_map;   // Mapped payload region of the stego image (mmap mode)
+    size_t stego_map_size;      // Length of the mapped region
+    size_t stego_pos;           // File offset of the next carrier byte to read/embed into
+    uint64_t carrier_index;     // Usable carrier bytes consumed so far
+    unsigned char *raw_buffer;  // Raw pixel span incl. padding/alpha (stdio mode)
+    size_t raw_buffer_size;
+    int threads;                // Embedding threads, > 1 only in mmap mode
+    int depth;                  // Payload bits per carrier byte: 1, 2 or 4 (0 means 1)
+    int header_version;         // STEG_HEADER_V2, or V0/V1 with legacy_header
+    int legacy_header;          // --legacy-header: the layout older readers know
+    int in_place;               // --in-place: rewrite only the payload bytes of the stego file (inplace.h)
+    InPlace inplace;            // Set up by open_files() for in_place
+    unsigned char header[STEG_MAX_HEADER];  // Laid out by check_capacity()
+    size_t header_size;
+    int compress;               // --compress: embed the lz.h stream of the secret
+    off_t raw_secret_size;      // Secret size before compression
+    int encrypt;                // --encrypt: embed the seal.h stream of the secret
+    const char *passphrase;     // Key material for --encrypt and --scatter
+    int scatter;                // --scatter: place the payload tiles by a keyed permutation
+    ScatterMap scatter_map;     // Set up by check_capacity() for --scatter
+    int ecc;                    // --ecc: parity bytes per ecc.h codeword, 0 for none
+    int checksum;               // --checksum: store a CRC32C of the payload behind it
+    uint32_t payload_crc;       // CRC32C of the payload bytes embedded so far
+
+    /* Caller owned work buffers, allocated per call when NULL */
+    char *block_buffer;         // STEG_BLOCK_SIZE bytes
+    char *chunk_buffer;         // STEG_SECRET_CHUNK bytes
+    int quiet;                  // Suppress progress output, keep the first error in error
+    char error[STEG_ERROR_SIZE];
+    Stats *stats;               // --stats: per-stage timers, NULL when off
+
 } EncodeInfo;
 
 /* Encoding function prototype */
@@ -36,35 +85,29 @@ typedef struct _EncodeInfo
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
+/* Read and validate -m args: source, output and the member files */
+Status read_and_validate_bundle_args(int argc, char *argv[], EncodeInfo *encInfo);
+
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close files and mappings left open by do_encoding */
+void close_files(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
-
 /* Get file size */
-uint get_file_size(FILE *fptr);
+off_t get_file_size(FILE *fptr);
 
 /* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
-
-/* Store Magic String */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
-
-/*Encode extension size*/
-Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
-
-/* Encode secret file extenstion */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
+Status copy_bmp_header(const unsigned char *header, size_t size, FILE *fptr_dest_image);
 
-/* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+/* Store the stego header: magic string, extension, size, depth and flags */
+Status encode_stego_header(EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include "inplace.h"
+#include "common.h"
+#include "crc32c.h"
+
+/* Journal layout: magic, offset, length, CRC32C of the saved bytes, then the bytes */
+#define JOURNAL_MAGIC "STEGJRNL"
+#define JOURNAL_HEADER_SIZE (8 + 8 + 8 + 4)
+
+static void put_le(unsigned char *p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = value >> (8 * i);
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+static char *journal_name(const char *target)
+{
+    char *name;
+    return asprintf(&name, "%s.steg-journal", target) < 0 ? NULL : name;
+}
+
+/* malloc'd name of the directory holding path */
+static char *directory_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+}
+
+/* fsync the directory holding path, so a create, rename or unlink in it is on disk */
+static Status sync_directory(const char *path)
+{
+    char *dir = directory_of(path);
+    int fd = dir ? open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    free(dir);
+    if (fd < 0)
+        return e_failure;
+    int synced = fsync(fd);
+    close(fd);
+    return synced == 0 ? e_success : e_failure;
+}
+
+/* Copy length bytes from in at in_offset to out at out_offset, returning their CRC32C */
+static Status copy_span(int in, uint64_t in_offset, int out, uint64_t out_offset, uint64_t length, uint32_t *crc)
+{
+    unsigned char *buffer = malloc(STEG_BLOCK_SIZE);
+    Status status = buffer ? e_success : e_failure;
+    *crc = 0;
+    for (uint64_t done = 0; done < length && status == e_success;)
+    {
+        size_t n = length - done < STEG_BLOCK_SIZE ? length - done : STEG_BLOCK_SIZE;
+        if (pread(in, buffer, n, in_offset + done) != (ssize_t)n ||
+            pwrite(out, buffer, n, out_offset + done) != (ssize_t)n)
+            status = e_failure;
+        *crc = crc32c_update(*crc, buffer, n);
+        done += n;
+    }
+    free(buffer);
+    return status;
+}
+
+/* Check a journal's saved bytes against its CRC */
+static Status journal_intact(int fd, uint64_t length, uint32_t expected)
+{
+    unsigned char *buffer = malloc(STEG_BLOCK_SIZE);
+    Status status = buffer ? e_success : e_failure;
+    uint32_t crc = 0;
+    for (uint64_t done = 0; done < length && status == e_success;)
+    {
+        size_t n = length - done < STEG_BLOCK_SIZE ? length - done : STEG_BLOCK_SIZE;
+        if (pread(fd, buffer, n, JOURNAL_HEADER_SIZE + done) != (ssize_t)n)
+            status = e_failure;
+        else
+            crc = crc32c_update(crc, buffer, n);
+        done += n;
+    }
+    free(buffer);
+    return status == e_success && crc == expected ? e_success : e_failure;
+}
+
+/* Unlink the clone and copy temp files (<target>.steg-XXXXXX) a crashed run left behind, best effort */
+static void remove_stale_temps(const char *target)
+{
+    char *dir = directory_of(target);
+    DIR *entries = dir ? opendir(dir) : NULL;
+    free(dir);
+    if (entries == NULL)
+        return;
+    const char *slash = strrchr(target, '/');
+    const char *base = slash ? slash + 1 : target;
+    size_t base_len = strlen(base);
+    int removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(entries)) != NULL)
+    {
+        // Exactly the mkostemp() suffix, so the journal is left alone
+        const char *suffix = entry->d_name + base_len;
+        if (strncmp(entry->d_name, base, base_len) == 0 && strncmp(suffix, ".steg-", 6) == 0 &&
+            strlen(suffix + 6) == 6 && unlinkat(dirfd(entries), entry->d_name, 0) == 0)
+            removed++;
+    }
+    closedir(entries);
+    if (removed)
+        sync_directory(target);
+}
+
+Status inplace_recover(const char *target, int *rolled_back)
+{
+    *rolled_back = 0;
+    remove_stale_temps(target);
+    char *journal = journal_name(target);
+    if (journal == NULL)
+        return e_failure;
+    int fd = open(journal, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        free(journal);
+        return e_success;
+    }
+
+    // A journal that isn't complete was cut short before the target was touched
+    unsigned char header[JOURNAL_HEADER_SIZE];
+    Status status = e_success;
+    if (pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        memcmp(header, JOURNAL_MAGIC, 8) == 0 &&
+        journal_intact(fd, get_le(header + 16, 8), get_le(header + 24, 4)) == e_success)
+    {
+        uint64_t offset = get_le(header + 8, 8), length = get_le(header + 16, 8);
+        uint32_t crc;
+        int target_fd = open(target, O_WRONLY | O_CLOEXEC);
+        status = target_fd >= 0 && copy_span(fd, JOURNAL_HEADER_SIZE, target_fd, offset, length, &crc) == e_success &&
+                 fsync(target_fd) == 0 ? e_success : e_failure;
+        if (target_fd >= 0)
+            close(target_fd);
+        *rolled_back = status == e_success;
+    }
+    close(fd);
+
+    // Keep the journal while the target isn't restored, the next run tries again
+    if (status == e_success && (unlink(journal) != 0 || sync_directory(journal) == e_failure))
+        status = e_failure;
+    free(journal);
+    return status;
+}
+
+Status inplace_open(InPlace *ip, int source_fd, const char *target)
+{
+    memset(ip, 0, sizeof(*ip));
+    ip->fd = -1;
+    struct stat src, dest;
+    if (fstat(source_fd, &src) != 0 || !S_ISREG(src.st_mode) ||
+        inplace_recover(target, &ip->rolled_back) == e_failure)
+        return e_failure;
+    ip->target = strdup(target);
+    if (ip->target == NULL || asprintf(&ip->temp, "%s.steg-XXXXXX", target) < 0)
+    {
+        ip->temp = NULL;
+        inplace_abort(ip);
+        return e_failure;
+    }
+
+    ip->fd = mkostemp(ip->temp, O_CLOEXEC);
+    if (ip->fd < 0 || fchmod(ip->fd, src.st_mode & 0777) != 0)
+    {
+        inplace_abort(ip);
+        return e_failure;
+    }
+    ip->mode = e_inplace_copy;
+#ifdef FICLONE
+    if (ioctl(ip->fd, FICLONE, source_fd) == 0)
+    {
+        ip->mode = e_inplace_clone;
+        return e_success;
+    }
+#endif
+
+    // No reflinks here: rewrite the carrier itself when it is the target
+    if (stat(target, &dest) == 0 && dest.st_dev == src.st_dev && dest.st_ino == src.st_ino)
+    {
+        close(ip->fd);
+        unlink(ip->temp);
+        free(ip->temp);
+        ip->temp = NULL;
+        ip->mode = e_inplace_journal;
+        ip->fd = open(target, O_RDWR | O_CLOEXEC);
+        if (ip->fd < 0)
+        {
+            inplace_abort(ip);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+Status inplace_protect(InPlace *ip, uint64_t offset, uint64_t length)
+{
+    if (ip->mode != e_inplace_journal)
+        return e_success;
+    char *journal = journal_name(ip->target);
+    int fd = journal ? open(journal, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600) : -1;
+    if (fd < 0)
+    {
+        free(journal);
+        return e_failure;
+    }
+    ip->journal = journal;
+
+    // Saved bytes first, then the header that makes the journal valid, then on disk
+    unsigned char header[JOURNAL_HEADER_SIZE];
+    uint32_t crc;
+    Status status = copy_span(ip->fd, offset, fd, JOURNAL_HEADER_SIZE, length, &crc);
+    memcpy(header, JOURNAL_MAGIC, 8);
+    put_le(header + 8, offset, 8);
+    put_le(header + 16, length, 8);
+    put_le(header + 24, crc, 4);
+    if (status == e_success && (pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fsync(fd) != 0 ||
+                                sync_directory(journal) == e_failure))
+        status = e_failure;
+    close(fd);
+    return status;
+}
+
+Status inplace_commit(InPlace *ip)
+{
+    if (fsync(ip->fd) != 0)
+        return e_failure;
+    close(ip->fd);
+    ip->fd = -1;
+    if (ip->mode == e_inplace_journal)
+    {
+        if (ip->journal != NULL && unlink(ip->journal) != 0)
+            return e_failure;
+    }
+    else if (rename(ip->temp, ip->target) != 0)
+    {
+        return e_failure;
+    }
+    Status status = sync_directory(ip->target);
+    free(ip->target);
+    free(ip->temp);
+    free(ip->journal);
+    memset(ip, 0, sizeof(*ip));
+    ip->fd = -1;
+    return status;
+}
+
+void inplace_abort(InPlace *ip)
+{
+    if (ip->target == NULL)
+        return;
+    if (ip->fd >= 0)
+        close(ip->fd);
+    if (ip->temp != NULL)
+    {
+        unlink(ip->temp);
+    }
+    else if (ip->journal != NULL)
+    {
+        int rolled_back;
+        if (inplace_recover(ip->target, &rolled_back) == e_failure)
+            fprintf(stderr, "Rolling back %s failed, its journal %s is kept for the next run\n", ip->target, ip->journal);
+    }
+    free(ip->target);
+    free(ip->temp);
+    free(ip->journal);
+    memset(ip, 0, sizeof(*ip));
+    ip->fd = -1;
+}
+
+const char *inplace_mode_name(InPlaceMode mode)
+{
+    return mode == e_inplace_clone ? "reflink clone" : mode == e_inplace_journal ? "journaled rewrite" : "full copy";
+}
@@ -0,0 +1,64 @@
+#ifndef INPLACE_H
+#define INPLACE_H
+
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * --in-place: produce the stego image by rewriting only the carrier
+ * bytes that take the header and payload, so the write volume follows
+ * the payload instead of the image. The file written into is, in order
+ * of preference:
+ *  - a reflink clone of the carrier (FICLONE), made in a temporary file
+ *    next to the target and renamed over it once the payload is in.
+ *    The clone shares the carrier's blocks, so only the rewritten ones
+ *    take new space
+ *  - the target itself, when it is the carrier and the filesystem can't
+ *    clone. The original bytes of the span about to be overwritten go
+ *    to <target>.steg-journal first. A failed run rolls back from it,
+ *    and the next run on the same target rolls back a crashed one
+ *  - a temporary file holding a full copy of the carrier, renamed over
+ *    the target, when the filesystem can't clone and the target is a
+ *    different file
+ * Every mode flushes the writes to disk before the result takes effect,
+ * so a failed or interrupted run never leaves a half-written image; the
+ * next run on the same target removes the temporary files of a crashed
+ * one.
+ */
+
+typedef enum
+{
+    e_inplace_clone,    // Reflink clone in temp, renamed over the target
+    e_inplace_journal,  // The target itself, guarded by the journal
+    e_inplace_copy      // temp, for the caller to fill with a full copy
+} InPlaceMode;
+
+typedef struct _InPlace
+{
+    InPlaceMode mode;
+    int fd;             // File the payload goes into
+    char *target;       // File the stego image ends up as, NULL when not set up
+    char *temp;         // Temporary file of the clone and copy modes
+    char *journal;      // Journal of the journal mode, once written
+    int rolled_back;    // inplace_open() rolled back an interrupted run first
+} InPlace;
+
+/* Remove the temp files of an interrupted run and roll target back from its journal, if there is one */
+Status inplace_recover(const char *target, int *rolled_back);
+
+/* Set up writing the stego image of the carrier open as source_fd to target */
+Status inplace_open(InPlace *ip, int source_fd, const char *target);
+
+/* Journal the bytes [offset, offset + length) before they are overwritten (journal mode only) */
+Status inplace_protect(InPlace *ip, uint64_t offset, uint64_t length);
+
+/* Flush the writes to disk and put the result in place of the target */
+Status inplace_commit(InPlace *ip);
+
+/* Leave the target as inplace_open() found it, nothing to do after inplace_commit() */
+void inplace_abort(InPlace *ip);
+
+/* Name of a mode for the progress output */
+const char *inplace_mode_name(InPlaceMode mode);
+
+#endif
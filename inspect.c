@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inspect.h"
+#include "bmp.h"
+#include "bmpio.h"
+
+/* Carrier bytes behind the longest possible stego header */
+#define INSPECT_CARRIER_BYTES (8 * STEG_MAX_HEADER)
+
+Status inspect_stream(FILE *fptr, InspectInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    unsigned char *header;
+    size_t header_size;
+    BmpInfo bmp;
+    if (bmp_read_header(fptr, &header, &header_size, &bmp) == e_failure)
+        return e_failure;
+
+    // Append just the raw span under the stego header to the BMP headers
+    uint64_t want = bmp.capacity < INSPECT_CARRIER_BYTES ? bmp.capacity : INSPECT_CARRIER_BYTES;
+    size_t raw_size = bmp_span_end(&bmp, 0, want) - bmp.pixel_offset;
+    unsigned char *image = realloc(header, header_size + raw_size);
+    if (image == NULL)
+    {
+        free(header);
+        return e_failure;
+    }
+    size_t got = fread(image + header_size, 1, raw_size, fptr);
+
+    // A short file still gets its capacity reported, it just holds no payload
+    info->header_status = steg_read_header(image, header_size + got, &info->steg);
+    free(image);
+    for (int i = 0; i < 3; i++)
+        info->max_payload[i] = steg_max_payload(&info->steg.bmp, 4, 1 << i);
+    return e_success;
+}
+
+Status inspect_image(const char *fname, InspectInfo *info)
+{
+    int stream = strcmp(fname, "-") == 0;
+    FILE *fptr = stream ? stdin : fopen(fname, "r");
+    if (fptr == NULL)
+    {
+        memset(info, 0, sizeof(*info));
+        perror(fname);
+        return e_failure;
+    }
+    Status status = inspect_stream(fptr, info);
+    if (!stream)
+        fclose(fptr);
+    return status;
+}
@@ -0,0 +1,28 @@
+#ifndef INSPECT_H
+#define INSPECT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "steg.h"
+
+/*
+ * Header-only probe of a carrier or stego image
+ * Reads the BMP headers and the few carrier bytes holding the stego
+ * header (magic, extension and payload size), never the payload, so the
+ * I/O done is the same for any image size.
+ */
+typedef struct _InspectInfo
+{
+    StegHeader steg;            // BMP geometry and, if found, the stego header
+    Status header_status;       // steg.error explains an e_failure
+    uint64_t max_payload[3];    // Largest .txt secret that fits at depth 1, 2, 4
+} InspectInfo;
+
+/* Probe fname ("-" reads stdin), e_failure if it is not a usable BMP */
+Status inspect_image(const char *fname, InspectInfo *info);
+
+/* Same, from the current position of an open stream */
+Status inspect_stream(FILE *fptr, InspectInfo *info);
+
+#endif
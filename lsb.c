@@ -0,0 +1,345 @@
+#include <stdint.h>
+#include <string.h>
+#include "lsb.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSB_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* LSB of every byte in a 64-bit word */
+#define LSB_MASK64 0x0101010101010101ULL
+
+/*
+ * Multiplier that moves bit (7 - i) of a byte to the LSB of byte i
+ * (spread), and gathers the LSB of byte i back into bit (7 - i) of the
+ * top byte (extract). The partial products never overlap, so no carries.
+ */
+#define LSB_SPREAD64 0x8040201008040201ULL
+
+/* Scalar kernels: one secret byte per 64-bit word */
+
+static inline uint64_t spread_byte(unsigned char data)
+{
+    return ((data * LSB_SPREAD64) >> 7) & LSB_MASK64;
+}
+
+static inline unsigned char gather_byte(uint64_t word)
+{
+    return (unsigned char)(((word & LSB_MASK64) * LSB_SPREAD64) >> 56);
+}
+
+static void embed_scalar(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t word;
+        memcpy(&word, carrier + i * 8, 8);
+        word = (word & ~LSB_MASK64) | spread_byte(secret[i]);
+        memcpy(carrier + i * 8, &word, 8);
+    }
+#else
+    for (size_t i = 0; i < n; i++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            carrier[i * 8 + bit] = (carrier[i * 8 + bit] & 0xFE) | ((secret[i] >> (7 - bit)) & 1);
+        }
+    }
+#endif
+}
+
+static void extract_scalar(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t word;
+        memcpy(&word, carrier + i * 8, 8);
+        secret[i] = gather_byte(word);
+    }
+#else
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char data = 0;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            data = (data << 1) | (carrier[i * 8 + bit] & 1);
+        }
+        secret[i] = data;
+    }
+#endif
+}
+
+#ifdef LSB_HAVE_X86
+
+/* Reverse the bit order inside every byte of a 32-bit mask */
+static inline uint32_t reverse_bits_in_bytes(uint32_t mask)
+{
+    mask = ((mask >> 1) & 0x55555555u) | ((mask & 0x55555555u) << 1);
+    mask = ((mask >> 2) & 0x33333333u) | ((mask & 0x33333333u) << 2);
+    mask = ((mask >> 4) & 0x0F0F0F0Fu) | ((mask & 0x0F0F0F0Fu) << 4);
+    return mask;
+}
+
+/* SSE2 kernels: two secret bytes per 16 carrier bytes */
+
+__attribute__((target("sse2")))
+static void embed_sse2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m128i keep = _mm_set1_epi8((char)0xFE);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i bits = _mm_set_epi64x((long long)spread_byte(secret[i + 1]),
+                                      (long long)spread_byte(secret[i]));
+        __m128i block = _mm_loadu_si128((const __m128i *)(carrier + i * 8));
+        block = _mm_or_si128(_mm_and_si128(block, keep), bits);
+        _mm_storeu_si128((__m128i *)(carrier + i * 8), block);
+    }
+    embed_scalar(secret + i, n - i, carrier + i * 8);
+}
+
+__attribute__((target("sse2")))
+static void extract_sse2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(carrier + i * 8));
+        // Move every LSB up to the sign bit and collect the 16 of them
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_slli_epi64(block, 7));
+        mask = reverse_bits_in_bytes(mask);
+        secret[i] = (unsigned char)mask;
+        secret[i + 1] = (unsigned char)(mask >> 8);
+    }
+    extract_scalar(carrier + i * 8, n - i, secret + i);
+}
+
+/* AVX2 kernels: four secret bytes per 32 carrier bytes */
+
+__attribute__((target("avx2")))
+static void embed_avx2(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    const __m256i keep = _mm256_set1_epi8((char)0xFE);
+    const __m256i one = _mm256_set1_epi8(1);
+    // Copy secret byte g into all 8 bytes of group g
+    const __m256i replicate = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                               2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    // Byte i of a group picks bit (7 - i)
+    const __m256i select = _mm256_set1_epi64x((long long)0x0102040810204080ULL);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        uint32_t word;
+        memcpy(&word, secret + i, 4);
+        __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32((int)word), replicate);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(bytes, select), select), one);
+        __m256i block = _mm256_loadu_si256((const __m256i *)(carrier + i * 8));
+        block = _mm256_or_si256(_mm256_and_si256(block, keep), bits);
+        _mm256_storeu_si256((__m256i *)(carrier + i * 8), block);
+    }
+    embed_sse2(secret + i, n - i, carrier + i * 8);
+}
+
+__attribute__((target("avx2")))
+static void extract_avx2(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    // Reverse every 8-byte group so movemask yields MSB-first bytes
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(carrier + i * 8));
+        block = _mm256_shuffle_epi8(block, reverse);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi64(block, 7));
+        memcpy(secret + i, &mask, 4);
+    }
+    extract_sse2(carrier + i * 8, n - i, secret + i);
+}
+
+#endif /* LSB_HAVE_X86 */
+
+/* Runtime dispatch, the kernels best first */
+
+typedef struct
+{
+    const char *name;
+    int (*supported)(void);
+    void (*embed)(const unsigned char *secret, size_t n, unsigned char *carrier);
+    void (*extract)(const unsigned char *carrier, size_t n, unsigned char *secret);
+} LsbKernel;
+
+#ifdef LSB_HAVE_X86
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static int have_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+#endif
+
+static int have_scalar(void)
+{
+    return 1;
+}
+
+static const LsbKernel kernels[] = {
+#ifdef LSB_HAVE_X86
+    {"avx2", have_avx2, embed_avx2, extract_avx2},
+    {"sse2", have_sse2, embed_sse2, extract_sse2},
+#endif
+    {"scalar", have_scalar, embed_scalar, extract_scalar},
+};
+
+#define LSB_KERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+/* Picked on first use; threads racing on that all store the same kernel */
+static const LsbKernel *selected;
+
+static const LsbKernel *select_kernel(void)
+{
+    const LsbKernel *kernel = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (kernel == NULL)
+    {
+        kernel = &kernels[0];
+        while (!kernel->supported())
+            kernel++;
+        __atomic_store_n(&selected, kernel, __ATOMIC_RELEASE);
+    }
+    return kernel;
+}
+
+void lsb_embed(const unsigned char *secret, size_t n, unsigned char *carrier)
+{
+    select_kernel()->embed(secret, n, carrier);
+}
+
+void lsb_extract(const unsigned char *carrier, size_t n, unsigned char *secret)
+{
+    select_kernel()->extract(carrier, n, secret);
+}
+
+/* Depth 2 and 4 kernels, depth is a constant after inlining */
+
+static inline void embed_depth(const unsigned char *secret, size_t n, unsigned char *carrier, int depth)
+{
+    const int per_byte = 8 / depth;
+    const unsigned char mask = (1 << depth) - 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        for (int j = 0; j < per_byte; j++)
+        {
+            unsigned char bits = (secret[i] >> (8 - depth * (j + 1))) & mask;
+            carrier[j] = (carrier[j] & ~mask) | bits;
+        }
+        carrier += per_byte;
+    }
+}
+
+static inline void extract_depth(const unsigned char *carrier, size_t n, unsigned char *secret, int depth)
+{
+    const int per_byte = 8 / depth;
+    const unsigned char mask = (1 << depth) - 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char data = 0;
+        for (int j = 0; j < per_byte; j++)
+        {
+            data = (data << depth) | (carrier[j] & mask);
+        }
+        secret[i] = data;
+        carrier += per_byte;
+    }
+}
+
+void lsb_embed_bits(const unsigned char *secret, size_t n, unsigned char *carrier, int depth)
+{
+    if (depth == 2)
+        embed_depth(secret, n, carrier, 2);
+    else if (depth == 4)
+        embed_depth(secret, n, carrier, 4);
+    else
+        lsb_embed(secret, n, carrier);
+}
+
+void lsb_extract_bits(const unsigned char *carrier, size_t n, unsigned char *secret, int depth)
+{
+    if (depth == 2)
+        extract_depth(carrier, n, secret, 2);
+    else if (depth == 4)
+        extract_depth(carrier, n, secret, 4);
+    else
+        lsb_extract(carrier, n, secret);
+}
+
+const char *lsb_kernel_name(void)
+{
+    return select_kernel()->name;
+}
+
+/* xorshift64*, for the check data */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void fill_random(unsigned char *buffer, size_t n, uint64_t *state)
+{
+    for (size_t i = 0; i < n; i++)
+        buffer[i] = (unsigned char)(next_random(state) >> 56);
+}
+
+/* Embed and extract random data at random lengths and alignments, and compare with the scalar kernel */
+static int same_as_scalar(const LsbKernel *kernel)
+{
+    enum { MAX_BYTES = 300, GUARD = 32, ROUNDS = 2000 };
+    unsigned char secret[MAX_BYTES + GUARD], expected[8 * MAX_BYTES + 2 * GUARD], actual[8 * MAX_BYTES + 2 * GUARD];
+    unsigned char expected_secret[MAX_BYTES], actual_secret[MAX_BYTES];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        size_t n = next_random(&state) % (MAX_BYTES + 1);
+        size_t at = next_random(&state) % GUARD, from = next_random(&state) % GUARD;
+        fill_random(secret, sizeof(secret), &state);
+        fill_random(expected, sizeof(expected), &state);
+        memcpy(actual, expected, sizeof(actual));
+
+        // The bytes around the span must come out untouched as well
+        embed_scalar(secret + from, n, expected + at);
+        kernel->embed(secret + from, n, actual + at);
+        if (memcmp(expected, actual, sizeof(actual)) != 0)
+            return 0;
+        extract_scalar(expected + from, n, expected_secret);
+        kernel->extract(expected + from, n, actual_secret);
+        if (memcmp(expected_secret, actual_secret, n) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+int lsb_check_kernels(LsbKernelResult *results, int max)
+{
+    int count = 0;
+    for (int i = 0; i < LSB_KERNELS && count < max; i++)
+    {
+        const LsbKernel *kernel = &kernels[i];
+        if (!kernel->supported())
+            continue;
+        LsbKernelResult *result = &results[count++];
+        result->name = kernel->name;
+        result->selected = kernel == select_kernel();
+        result->matches = same_as_scalar(kernel);
+        result->embed = kernel->embed;
+        result->extract = kernel->extract;
+    }
+    return count;
+}
@@ -0,0 +1,47 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+
+/*
+ * Bulk LSB kernels
+ * Every secret byte is spread MSB first over the least significant
+ * bits of 8 consecutive carrier bytes. The best kernel for the running
+ * CPU (AVX2, SSE2 or portable scalar) is picked at runtime.
+ */
+
+/* Embed n secret bytes into the LSBs of 8 * n carrier bytes */
+void lsb_embed(const unsigned char *secret, size_t n, unsigned char *carrier);
+
+/* Extract n secret bytes from the LSBs of 8 * n carrier bytes */
+void lsb_extract(const unsigned char *carrier, size_t n, unsigned char *secret);
+
+/*
+ * Multi-bit variants: every secret byte goes MSB first into the low
+ * depth bits of 8 / depth carrier bytes (depth 1, 2 or 4)
+ */
+void lsb_embed_bits(const unsigned char *secret, size_t n, unsigned char *carrier, int depth);
+void lsb_extract_bits(const unsigned char *carrier, size_t n, unsigned char *secret, int depth);
+
+/* Name of the kernel selected for this CPU */
+const char *lsb_kernel_name(void);
+
+/* How one kernel fared in lsb_check_kernels() */
+typedef struct _LsbKernelResult
+{
+    const char *name;
+    int selected;           // The kernel lsb_embed() and lsb_extract() use
+    int matches;            // Same output as the scalar kernel on every check
+    void (*embed)(const unsigned char *secret, size_t n, unsigned char *carrier);
+    void (*extract)(const unsigned char *carrier, size_t n, unsigned char *secret);
+} LsbKernelResult;
+
+/*
+ * Check every kernel this CPU can run against the scalar one on random
+ * data, lengths and alignments. Fills up to max results, best kernel
+ * first, and returns how many; the kernels themselves come along so a
+ * caller can time them (see bench.c).
+ */
+int lsb_check_kernels(LsbKernelResult *results, int max);
+
+#endif
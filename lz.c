@@ -0,0 +1,227 @@
+#include <string.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_CHAIN 32         // Candidates tried per position
+#define LZ_RAW_FLAG 0x80000000u
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static uint32_t hash4(const unsigned char *p)
+{
+    return (read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Length nibble of a token plus its 255-run extension bytes */
+static unsigned char *put_length(unsigned char *op, size_t length)
+{
+    for (length -= 15; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *literals, size_t nliterals,
+                                   size_t offset, size_t match)
+{
+    unsigned char *token = op++;
+    size_t match_code = match ? match - LZ_MIN_MATCH : 0;
+    *token = (unsigned char)(((nliterals < 15 ? nliterals : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (nliterals >= 15)
+        op = put_length(op, nliterals);
+    memcpy(op, literals, nliterals);
+    op += nliterals;
+    if (match)
+    {
+        *op++ = (unsigned char)offset;
+        *op++ = (unsigned char)(offset >> 8);
+        if (match_code >= 15)
+            op = put_length(op, match_code);
+    }
+    return op;
+}
+
+static void put_header(unsigned char *out, uint32_t header)
+{
+    out[0] = header >> 24;
+    out[1] = header >> 16;
+    out[2] = header >> 8;
+    out[3] = header;
+}
+
+size_t lz_compress_block(LzEncoder *enc, const unsigned char *in, size_t n, unsigned char *out)
+{
+    // Sequences may briefly run past a raw copy, so build them in place
+    // only while they stay shorter than the input
+    unsigned char *body = out + 4;
+    unsigned char *op = body;
+    unsigned char *op_limit = body + n;
+    size_t anchor = 0;
+
+    memset(enc->head, 0xFF, sizeof(enc->head));
+    if (n >= LZ_MIN_MATCH)
+    {
+        size_t last = n - LZ_MIN_MATCH;
+        for (size_t ip = 0; ip <= last; )
+        {
+            uint32_t h = hash4(in + ip);
+            size_t best_len = 0, best_pos = 0;
+            int32_t candidate = enc->head[h];
+            for (int tries = LZ_MAX_CHAIN; candidate >= 0 && tries > 0; tries--)
+            {
+                if (read32(in + candidate) == read32(in + ip))
+                {
+                    size_t len = LZ_MIN_MATCH;
+                    while (ip + len < n && in[candidate + len] == in[ip + len])
+                        len++;
+                    if (len > best_len)
+                    {
+                        best_len = len;
+                        best_pos = candidate;
+                    }
+                }
+                candidate = enc->prev[candidate];
+            }
+            enc->prev[ip] = enc->head[h];
+            enc->head[h] = ip;
+
+            if (best_len < LZ_MIN_MATCH)
+            {
+                ip++;
+                continue;
+            }
+            // Worst case sequence: token, length bytes, literals, offset
+            if (op + (ip - anchor) + (ip - anchor) / 255 + best_len / 255 + 8 > op_limit)
+                break;
+            op = put_sequence(op, in + anchor, ip - anchor, ip - best_pos, best_len);
+            for (size_t p = ip + 1; p < ip + best_len && p <= last; p++)
+            {
+                uint32_t hp = hash4(in + p);
+                enc->prev[p] = enc->head[hp];
+                enc->head[hp] = p;
+            }
+            ip += best_len;
+            anchor = ip;
+        }
+    }
+
+    size_t tail = n - anchor;
+    if (op + 1 + tail + tail / 255 + 1 < op_limit)
+    {
+        op = put_sequence(op, in + anchor, tail, 0, 0);
+        put_header(out, op - body);
+        return op - out;
+    }
+
+    // Incompressible: store the block as is
+    memcpy(body, in, n);
+    put_header(out, LZ_RAW_FLAG | n);
+    return 4 + n;
+}
+
+/* Read a 255-run length extension, e_failure when it runs off the end */
+static Status get_length(const unsigned char **ip, const unsigned char *end, size_t *length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*ip >= end)
+            return e_failure;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return e_success;
+}
+
+static Status decompress_body(const unsigned char *ip, size_t n, unsigned char *out, size_t *out_n)
+{
+    const unsigned char *end = ip + n;
+    unsigned char *op = out;
+    unsigned char *op_end = out + LZ_BLOCK_SIZE;
+    for (;;)
+    {
+        if (ip >= end)
+            return e_failure;
+        unsigned char token = *ip++;
+        size_t nliterals = token >> 4;
+        if (nliterals == 15 && get_length(&ip, end, &nliterals) == e_failure)
+            return e_failure;
+        if (nliterals > (size_t)(end - ip) || nliterals > (size_t)(op_end - op))
+            return e_failure;
+        memcpy(op, ip, nliterals);
+        op += nliterals;
+        ip += nliterals;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return e_failure;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && get_length(&ip, end, &match) == e_failure)
+            return e_failure;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match > (size_t)(op_end - op))
+            return e_failure;
+        // Overlapping copies repeat the last offset bytes, so go byte by byte
+        const unsigned char *from = op - offset;
+        for (size_t i = 0; i < match; i++)
+            op[i] = from[i];
+        op += match;
+    }
+    *out_n = op - out;
+    return e_success;
+}
+
+void lz_decoder_init(LzDecoder *dec)
+{
+    dec->have = 0;
+}
+
+Status lz_decoder_feed(LzDecoder *dec, const unsigned char *in, size_t n, DataSink sink, void *ctx)
+{
+    while (n > 0)
+    {
+        size_t need = 4;
+        uint32_t header = 0;
+        if (dec->have >= 4)
+        {
+            header = ((uint32_t)dec->frame[0] << 24) | (dec->frame[1] << 16) | (dec->frame[2] << 8) | dec->frame[3];
+            size_t body = header & ~LZ_RAW_FLAG;
+            if (body > LZ_BLOCK_SIZE || body == 0)
+                return e_failure;
+            need = 4 + body;
+        }
+        size_t take = need - dec->have < n ? need - dec->have : n;
+        memcpy(dec->frame + dec->have, in, take);
+        dec->have += take;
+        in += take;
+        n -= take;
+        if (dec->have < need || need == 4)
+            continue;
+
+        size_t out_n = need - 4;
+        const unsigned char *block = dec->frame + 4;
+        if (!(header & LZ_RAW_FLAG))
+        {
+            if (decompress_body(dec->frame + 4, need - 4, dec->block, &out_n) == e_failure)
+                return e_failure;
+            block = dec->block;
+        }
+        dec->have = 0;
+        if (sink(ctx, block, out_n) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+Status lz_decoder_finish(const LzDecoder *dec)
+{
+    return dec->have == 0 ? e_success : e_failure;
+}
@@ -0,0 +1,53 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Bundled LZ77 compressor for --compress
+ * Input is cut into independent blocks of up to LZ_BLOCK_SIZE bytes.
+ * Every block becomes a frame: a 4 byte big endian header (bit 31 set
+ * for a block stored raw, bits 0-30 the body length) and the body.
+ * The body is a run of LZ4 style sequences: a token byte (literal count
+ * in the high nibble, match length - 4 in the low one, 15 meaning more
+ * length bytes follow), the literals, a 2 byte little endian offset and
+ * the extra match length bytes. The last sequence of a block has no
+ * match. Decoding needs only one frame and one block of memory.
+ */
+
+#define LZ_BLOCK_SIZE (64 * 1024)
+
+/* Largest frame lz_compress_block() produces */
+#define LZ_FRAME_MAX (4 + LZ_BLOCK_SIZE)
+
+#define LZ_HASH_BITS 15
+
+/* Match finder state, about 384 KiB, reused across blocks */
+typedef struct _LzEncoder
+{
+    int32_t head[1 << LZ_HASH_BITS];    // Latest position per hash
+    int32_t prev[LZ_BLOCK_SIZE];        // Older position with the same hash
+} LzEncoder;
+
+/* Compress n <= LZ_BLOCK_SIZE bytes into one frame in out, returns its size */
+size_t lz_compress_block(LzEncoder *enc, const unsigned char *in, size_t n, unsigned char *out);
+
+/* Incremental frame decoder, the compressed stream may arrive in any pieces */
+typedef struct _LzDecoder
+{
+    unsigned char frame[LZ_FRAME_MAX];
+    size_t have;                        // Bytes of the current frame buffered
+    unsigned char block[LZ_BLOCK_SIZE];
+} LzDecoder;
+
+void lz_decoder_init(LzDecoder *dec);
+
+/* Decode what is complete in n more bytes, e_failure on corrupt input or a sink error */
+Status lz_decoder_feed(LzDecoder *dec, const unsigned char *in, size_t n, DataSink sink, void *ctx);
+
+/* e_failure if the stream stopped inside a frame */
+Status lz_decoder_finish(const LzDecoder *dec);
+
+#endif
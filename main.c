@@ -20,51 +20,199 @@ and demonstrates secure data concealment through simple yet effective bit-level
 
 */
 
+#define _FILE_OFFSET_BITS 64
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include "encode.h"
 #include "decode.h"
+#include "batch.h"
+#include "psnr.h"
+#include "inspect.h"
+#include "daemon.h"
+#include "bench.h"
+#include "stats.h"
 #include "types.h"
+#include "common.h"
+#include "ecc.h"
+#include "cache.h"
+
+/* Options given as --name=value (or -j N) anywhere after the operation */
+typedef struct _CliOptions
+{
+    IoMode io_mode;     // --io=stdio|mmap|async
+    int threads;        // -j N / --jobs=N
+    long long secret_size;  // --secret-size=N, needed for a streamed secret
+    char *secret_extn;  // --secret-ext=.txt, extension for an fd:N secret
+    int depth;          // --depth=1|2|4, payload bits per carrier byte
+    int compress;       // --compress, embed the secret LZ compressed
+    int encrypt;        // --encrypt, seal the secret with a passphrase
+    char *passphrase_file;  // --passphrase-file=PATH, else $STEG_PASSPHRASE
+    int scatter;        // --scatter, spread the payload tiles by the passphrase
+    int checksum;       // --checksum / --no-checksum, store a CRC32C of the payload (-1: unless --legacy-header)
+    int ecc;            // --ecc[=N], N Reed-Solomon parity bytes per 255 byte codeword
+    int range;          // --range=OFFSET:LENGTH, decode only that slice
+    unsigned long long range_offset;
+    unsigned long long range_length;
+    int repeat;         // --repeat=N, send a -C request N times (-B: benchmark runs)
+    int stats;          // --stats (1) or --stats=json (2), per-stage timings after the run
+    char *bench_dir;    // --bench-dir=PATH, -B files on disk/tmpfs instead of memfds
+    int legacy_header;  // --legacy-header, write the header older builds can read
+    size_t carrier_cache;   // --carrier-cache=MiB, memory for the -b carrier cache (0 turns it off)
+    int in_place;       // --in-place, rewrite only the payload bytes of the stego file
+    int reference;      // --reference, -B also times the per-byte path
+    int io_given;       // --io= was given, so it is honoured or refused, never swapped for mmap
+} CliOptions;
 
 OperationType check_operation_type(char *symbol);
+Status parse_option(char *option, CliOptions *options);
+Status parse_count(const char *text, int *count);
+const char *load_passphrase(const CliOptions *options);
+void report_stats(Stats *stats, FILE *out, const char *operation, unsigned long long payload_bytes, int format);
 
 int main(int argc, char *argv[])
 {
+    // Pull the --options out so the positional arguments keep their places
+    CliOptions options = {e_io_stdio, 1, -1, NULL, 1, 0, 0, NULL, 0, -1, 0, 0, 0, 0, 1, 0, NULL, 0, CARRIER_CACHE_DEFAULT_BUDGET, 0, 0, 0};
+    Stats stats;
+    char *args[argc + 1];
+    int nargs = 0;
+    for(int i = 0; i < argc; i++)
+    {
+        if(i > 1 && strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            if(parse_count(argv[++i], &options.threads) == e_failure)
+            {
+                printf("Invalid thread count: %s\n", argv[i]);
+                return e_failure;
+            }
+            continue;
+        }
+        if(i > 1 && strncmp(argv[i], "--", 2) == 0)
+        {
+            if(parse_option(argv[i], &options) == e_failure)
+            {
+                printf("Invalid option: %s\n", argv[i]);
+                return e_failure;
+            }
+            continue;
+        }
+        args[nargs++] = argv[i];
+    }
+    args[nargs] = NULL;
+    argc = nargs;
+    argv = args;
+
+    // When the stego image or payload is streamed to stdout, talk on stderr
+    FILE *console = stdout;
+    if((argc == 5 && strcmp(argv[1], "-e") == 0 && strcmp(argv[4], "-") == 0) ||
+       (argc == 4 && strcmp(argv[1], "-d") == 0 && strcmp(argv[3], "-") == 0) ||
+       (argc == 4 && strcmp(argv[1], "-m") == 0 && strcmp(argv[3], "-") == 0) ||
+       (argc == 5 && strcmp(argv[1], "-x") == 0 && strcmp(argv[4], "-") == 0))
+    {
+        console = stderr;
+    }
+
     // Check minimum args
     if(argc < 3)
     {
-        printf("  Enter valid Argument:\n");
-        printf("  To Encode : ./a.out -e <source.bmp> <secret.txt> [output.bmp]\n");
-        printf("  To Decode : ./a.out -d <stego.bmp> [output.txt]\n");
+        fprintf(console, "  Enter valid Argument:\n");
+        fprintf(console, "  To Encode : ./a.out -e <source.bmp> <secret.txt> [output.bmp] [--io=stdio|mmap|async] [-j N] [--depth=1|2|4] [--compress] [--encrypt] [--scatter] [--no-checksum] [--ecc[=N]] [--legacy-header] [--in-place] [--stats[=json]]\n");
+        fprintf(console, "  To Decode : ./a.out -d <stego.bmp> [output.txt] [--io=stdio|mmap|async] [-j N] [--range=OFFSET:LENGTH] [--stats[=json]]\n");
+        fprintf(console, "  Container : ./a.out -m <source.bmp> <output.bmp> <secret>... | -l <stego.bmp> | -x <stego.bmp> <name> [output]\n");
+        fprintf(console, "  Streaming : use - for stdin/stdout, fd:N [--secret-size=N] [--secret-ext=.txt] for the secret\n");
+        fprintf(console, "  Passphrase: --passphrase-file=PATH (first line) or $STEG_PASSPHRASE, for --encrypt, --scatter and -d\n");
+        fprintf(console, "  Batch     : ./a.out -b <manifest.txt> [--io=stdio|mmap|async] [-j N] [--carrier-cache=MiB] (lines sharing a file run in order)\n");
+        fprintf(console, "  PSNR      : ./a.out -p <cover.bmp> <stego.bmp>\n");
+        fprintf(console, "  Inspect   : ./a.out -i <image.bmp>\n");
+        fprintf(console, "  Verify    : ./a.out -v <stego.bmp> [--io=stdio|mmap|async] [-j N]\n");
+        fprintf(console, "  Daemon    : ./a.out -S <socket> [-j N] [--io=stdio|mmap|async]\n");
+        fprintf(console, "  Client    : ./a.out -C <socket> e <source.bmp> <secret.txt> <output.bmp> | d <stego.bmp> <output> | i <image.bmp> | stats | stop [--repeat=N]\n");
+        fprintf(console, "  Benchmark : ./a.out -B <width>x<height> [--repeat=N] [--bench-dir=PATH] [--stats=json] [--reference] [encode options]\n");
         return e_failure;
     }
 
     OperationType operation = check_operation_type(argv[1]);
+
+    // Threads split the mapped pixel array, so -j implies mmap I/O
+    // (batch and daemon mode use them as job workers instead)
+    IoMode io_requested = options.io_mode;
+    if(options.threads > 1 && operation != e_batch && operation != e_serve)
+    {
+        options.io_mode = e_io_mmap;
+    }
+    // Scattered tiles are written out of order, so they need the mapping too
+    if(options.scatter && (operation == e_encode || operation == e_bundle))
+    {
+        options.io_mode = e_io_mmap;
+    }
+    // As does --in-place, which only writes the pages the payload lands on
+    if(options.in_place && operation == e_encode)
+    {
+        options.io_mode = e_io_mmap;
+    }
+    // An --io mode given outright is not swapped for mmap behind the user's back
+    if(options.io_given && options.io_mode != io_requested)
+    {
+        fprintf(console, "--io=%s can't be used with -j N above 1, --scatter or --in-place, which need --io=mmap.\n",
+                io_requested == e_io_async ? "async" : "stdio");
+        return e_failure;
+    }
+    // Version 2 headers carry a payload checksum by default, older readers know no flags
+    if(options.checksum < 0)
+    {
+        options.checksum = !options.legacy_header;
+    }
     
     if (operation == e_encode)
     {
         // Encoding requires at least 4 args: ./a.out -e <source.bmp> <secret.txt> [output.bmp]
         if (argc < 4 || argc > 5)
         {
-            printf("Invalid number of arguments for encoding.\n");
-            printf("Usage: ./a.out -e <source.bmp> <secret.txt> [output.bmp]\n");
+            fprintf(console, "Invalid number of arguments for encoding.\n");
+            fprintf(console, "Usage: ./a.out -e <source.bmp> <secret.txt> [output.bmp]\n");
             return e_failure;
         }
 
-        printf("\n<----------- ENCODING MODE ----------->\n");
-        EncodeInfo encInfo;
+        fprintf(console, "\n<----------- ENCODING MODE ----------->\n");
+        EncodeInfo encInfo = {0};
+        encInfo.io_mode = options.io_mode;
+        encInfo.threads = options.threads;
+        encInfo.secret_extn = options.secret_extn;
+        encInfo.depth = options.depth;
+        encInfo.compress = options.compress;
+        encInfo.encrypt = options.encrypt;
+        encInfo.passphrase = load_passphrase(&options);
+        encInfo.scatter = options.scatter;
+        encInfo.checksum = options.checksum;
+        encInfo.ecc = options.ecc;
+        encInfo.legacy_header = options.legacy_header;
+        encInfo.in_place = options.in_place;
+        if(options.secret_size >= 0)
+        {
+            encInfo.size_secret_file = options.secret_size;
+            encInfo.secret_size_known = 1;
+        }
+        if(options.stats && stats_start(&stats) == e_success)
+        {
+            encInfo.stats = &stats;
+        }
 
         if(read_and_validate_encode_args(argv, &encInfo) == e_success)
         {
-            printf("Validation successful.\n");
+            fprintf(console, "Validation successful.\n");
             if (do_encoding(&encInfo) == e_success)
-                printf("Encoding Completed Successfully.\n");
+                fprintf(console, "Encoding Completed Successfully.\n");
             else
-                printf("Encoding Failed.\n");
+                fprintf(console, "Encoding Failed.\n");
+            close_files(&encInfo);
+            report_stats(encInfo.stats, console, "encode", encInfo.size_secret_file, options.stats);
         }
         else
         {
-            printf("Validation Failed.\n");
+            fprintf(console, "Validation Failed.\n");
             return e_failure;
         }
     }
@@ -73,37 +221,330 @@ int main(int argc, char *argv[])
         // Decoding allows 3 or 4 arguments only
         if (argc < 3 || argc > 4)
         {
-            printf("Invalid number of arguments for decoding.\n");
-            printf("Usage: ./a.out -d <stego.bmp> [output.txt]\n");
+            fprintf(console, "Invalid number of arguments for decoding.\n");
+            fprintf(console, "Usage: ./a.out -d <stego.bmp> [output.txt]\n");
             return e_failure;
         }
 
-        printf("\n<----------- DECODING MODE ----------->\n");
-        DecodeInfo decInfo;
+        fprintf(console, "\n<----------- DECODING MODE ----------->\n");
+        DecodeInfo decInfo = {0};
+        decInfo.io_mode = options.io_mode;
+        decInfo.threads = options.threads;
+        decInfo.passphrase = load_passphrase(&options);
+        decInfo.range = options.range;
+        decInfo.range_offset = options.range_offset;
+        decInfo.range_length = options.range_length;
+        if(options.stats && stats_start(&stats) == e_success)
+        {
+            decInfo.stats = &stats;
+        }
 
         if(read_and_validate_decode_args(argv, &decInfo) == e_success)
         {
-            printf("Validation successful.\n");
+            fprintf(console, "Validation successful.\n");
             if(do_decoding(&decInfo) == e_success)
             {
-                printf("Decoding Completed Successfully.\n");
+                fprintf(console, "Decoding Completed Successfully.\n");
             }
             else
             {
-                printf("Decoding Failed.\n");
+                fprintf(console, "Decoding Failed.\n");
+            }
+            close_decode_files(&decInfo);
+            report_stats(decInfo.stats, console, "decode", decInfo.size_secret_file, options.stats);
+        }
+        else
+        {
+            fprintf(console, "Validation Failed.\n");
+            return e_failure;
+        }
+    }
+    else if(operation == e_bundle)
+    {
+        if (argc < 5)
+        {
+            fprintf(console, "Invalid number of arguments for container mode.\n");
+            fprintf(console, "Usage: ./a.out -m <source.bmp> <output.bmp> <secret>...\n");
+            return e_failure;
+        }
+
+        fprintf(console, "\n<----------- CONTAINER MODE ----------->\n");
+        EncodeInfo encInfo = {0};
+        encInfo.io_mode = options.io_mode;
+        encInfo.threads = options.threads;
+        encInfo.depth = options.depth;
+        encInfo.compress = options.compress;
+        encInfo.encrypt = options.encrypt;
+        encInfo.passphrase = load_passphrase(&options);
+        encInfo.scatter = options.scatter;
+        encInfo.checksum = options.checksum;
+        encInfo.ecc = options.ecc;
+        encInfo.legacy_header = options.legacy_header;
+        if(options.stats && stats_start(&stats) == e_success)
+        {
+            encInfo.stats = &stats;
+        }
+
+        if(read_and_validate_bundle_args(argc, argv, &encInfo) == e_failure)
+        {
+            fprintf(console, "Validation Failed.\n");
+            return e_failure;
+        }
+        Status status = do_encoding(&encInfo);
+        close_files(&encInfo);
+        report_stats(encInfo.stats, console, "bundle", encInfo.size_secret_file, options.stats);
+        if(status == e_failure)
+        {
+            fprintf(console, "Encoding Failed.\n");
+            return e_failure;
+        }
+        fprintf(console, "Encoding Completed Successfully.\n");
+    }
+    else if(operation == e_list || operation == e_extract)
+    {
+        // -l <stego.bmp> or -x <stego.bmp> <name> [output], the output defaults to the entry name
+        if ((operation == e_list && argc != 3) || (operation == e_extract && (argc < 4 || argc > 5)))
+        {
+            fprintf(console, "Invalid number of arguments for container mode.\n");
+            fprintf(console, "Usage: ./a.out -l <stego.bmp> | ./a.out -x <stego.bmp> <name> [output]\n");
+            return e_failure;
+        }
+        if (strstr(argv[2], ".bmp") == NULL && strcmp(argv[2], "-") != 0)
+        {
+            fprintf(console, "INVALID: Stego image must have a .bmp extension.\n");
+            return e_failure;
+        }
+
+        DecodeInfo decInfo = {0};
+        decInfo.io_mode = options.io_mode;
+        decInfo.passphrase = load_passphrase(&options);
+        decInfo.stego_image_fname = argv[2];
+        decInfo.list = operation == e_list;
+        if(options.stats && stats_start(&stats) == e_success)
+        {
+            decInfo.stats = &stats;
+        }
+        if(operation == e_extract)
+        {
+            const char *output = argc == 5 ? argv[4] : argv[3];
+            if(strlen(output) >= sizeof(decInfo.output_fname))
+            {
+                fprintf(console, "INVALID: Output file name is too long.\n");
+                return e_failure;
             }
+            decInfo.entry_name = argv[3];
+            strcpy(decInfo.output_fname, output);
+        }
+        Status status = do_decoding(&decInfo);
+        close_decode_files(&decInfo);
+        report_stats(decInfo.stats, console, operation == e_list ? "list" : "extract", decInfo.size_secret_file,
+                     options.stats);
+        if(status == e_failure)
+        {
+            fprintf(console, "%s Failed.\n", operation == e_list ? "Listing" : "Extraction");
+            return e_failure;
+        }
+    }
+    else if(operation == e_verify)
+    {
+        // Runs the whole decode, checksum included, but writes nothing
+        if (argc != 3)
+        {
+            fprintf(console, "Invalid number of arguments for verify mode.\n");
+            fprintf(console, "Usage: ./a.out -v <stego.bmp>\n");
+            return e_failure;
+        }
+
+        fprintf(console, "\n<----------- VERIFY MODE ----------->\n");
+        DecodeInfo decInfo = {0};
+        decInfo.io_mode = options.io_mode;
+        decInfo.threads = options.threads;
+        decInfo.passphrase = load_passphrase(&options);
+        decInfo.verify = 1;
+        if(options.stats && stats_start(&stats) == e_success)
+        {
+            decInfo.stats = &stats;
+        }
+
+        if(read_and_validate_decode_args(argv, &decInfo) == e_failure)
+        {
+            fprintf(console, "Validation Failed.\n");
+            return e_failure;
+        }
+        Status status = do_decoding(&decInfo);
+        close_decode_files(&decInfo);
+        report_stats(decInfo.stats, console, "verify", decInfo.size_secret_file, options.stats);
+        if(status == e_failure)
+        {
+            fprintf(console, "Verification Failed.\n");
+            return e_failure;
+        }
+        fprintf(console, "Verification Passed.\n");
+    }
+    else if(operation == e_batch)
+    {
+        if (argc != 3)
+        {
+            fprintf(console, "Invalid number of arguments for batch mode.\n");
+            fprintf(console, "Usage: ./a.out -b <manifest.txt> [--io=stdio|mmap|async] [-j N] [--carrier-cache=MiB]\n");
+            return e_failure;
+        }
+
+        fprintf(console, "\n<----------- BATCH MODE ----------->\n");
+        if(run_batch(argv[2], options.threads, options.io_mode, options.carrier_cache, options.checksum) == e_success)
+        {
+            fprintf(console, "Batch Completed Successfully.\n");
         }
         else
         {
-            printf("Validation Failed.\n");
+            fprintf(console, "Batch Completed With Failures.\n");
+            return e_failure;
+        }
+    }
+    else if(operation == e_serve)
+    {
+        if (argc != 3)
+        {
+            fprintf(console, "Invalid number of arguments for daemon mode.\n");
+            fprintf(console, "Usage: ./a.out -S <socket> [-j N] [--io=stdio|mmap|async]\n");
             return e_failure;
         }
+        if(run_daemon(argv[2], options.threads, options.io_mode, load_passphrase(&options)) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else if(operation == e_client)
+    {
+        if (argc < 4)
+        {
+            fprintf(console, "Invalid number of arguments for client mode.\n");
+            fprintf(console, "Usage: ./a.out -C <socket> e|d|i|stats|stop [files...] [--repeat=N]\n");
+            return e_failure;
+        }
+        if(options.ecc)
+        {
+            fprintf(console, "--ecc is not supported in client mode.\n");
+            return e_failure;
+        }
+        int flags = (options.compress ? STEG_FLAG_COMPRESSED : 0) | (options.encrypt ? STEG_FLAG_ENCRYPTED : 0) |
+                    (options.scatter ? STEG_FLAG_SCATTERED : 0) | (options.checksum ? STEG_FLAG_CHECKSUM : 0);
+        if(run_client(argv[2], argc - 3, argv + 3, options.depth, flags, options.repeat) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else if(operation == e_bench)
+    {
+        BenchConfig config = {0};
+        char extra;
+        if (argc != 3 || sscanf(argv[2], "%ux%u%c", &config.width, &config.height, &extra) != 2)
+        {
+            fprintf(console, "Invalid arguments for benchmark mode.\n");
+            fprintf(console, "Usage: ./a.out -B <width>x<height> [--repeat=N] [--bench-dir=PATH] [--stats=json] [--reference]\n");
+            return e_failure;
+        }
+        if (options.reference && (options.depth != 1 || options.compress || options.encrypt || options.ecc))
+        {
+            fprintf(console, "--reference runs at depth 1, without --compress, --encrypt or --ecc.\n");
+            return e_failure;
+        }
+        config.secret_size = options.secret_size;
+        config.depth = options.depth;
+        config.io_mode = options.io_mode;
+        config.threads = options.threads;
+        config.compress = options.compress;
+        config.encrypt = options.encrypt;
+        config.checksum = options.checksum;
+        config.ecc = options.ecc;
+        config.passphrase = load_passphrase(&options);
+        config.dir = options.bench_dir;
+        config.runs = options.repeat;
+        config.json = options.stats == 2;
+        config.reference = options.reference;
+        if(run_bench(&config) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else if(operation == e_psnr)
+    {
+        if (argc != 4)
+        {
+            fprintf(console, "Invalid number of arguments for PSNR mode.\n");
+            fprintf(console, "Usage: ./a.out -p <cover.bmp> <stego.bmp>\n");
+            return e_failure;
+        }
+
+        PsnrReport report;
+        if(measure_psnr(argv[2], argv[3], &report) == e_failure)
+        {
+            fprintf(console, "PSNR Measurement Failed.\n");
+            return e_failure;
+        }
+        fprintf(console, "Colour bytes compared : %llu\n", (unsigned long long)report.compared);
+        fprintf(console, "Colour bytes changed  : %llu (max error %llu)\n",
+                (unsigned long long)report.changed, (unsigned long long)report.max_error);
+        fprintf(console, "MSE                   : %.6f\n", report.mse);
+        if(report.mse > 0)
+            fprintf(console, "PSNR                  : %.2f dB\n", report.psnr);
+        else
+            fprintf(console, "PSNR                  : inf (images identical)\n");
+    }
+    else if(operation == e_inspect)
+    {
+        if (argc != 3)
+        {
+            fprintf(console, "Invalid number of arguments for inspect mode.\n");
+            fprintf(console, "Usage: ./a.out -i <image.bmp>\n");
+            return e_failure;
+        }
+
+        InspectInfo info;
+        if(inspect_image(argv[2], &info) == e_failure)
+        {
+            fprintf(console, "%s: not a 24/32 bpp uncompressed BMP\n", argv[2]);
+            return e_failure;
+        }
+        const BmpInfo *bmp = &info.steg.bmp;
+        fprintf(console, "Image       : %ux%u, %u bpp, %s\n", bmp->width, bmp->height,
+                bmp->bits_per_pixel, bmp->top_down ? "top-down" : "bottom-up");
+        fprintf(console, "Capacity    : %llu carrier bytes\n", (unsigned long long)bmp->capacity);
+        fprintf(console, "Max payload : %llu / %llu / %llu bytes at depth 1 / 2 / 4\n",
+                (unsigned long long)info.max_payload[0], (unsigned long long)info.max_payload[1],
+                (unsigned long long)info.max_payload[2]);
+        if(info.header_status == e_success)
+        {
+            fprintf(console, "Payload     : %llu bytes, extension %s, depth %d, header v%d%s%s%s%s%s",
+                    (unsigned long long)info.steg.payload_size, info.steg.extn, info.steg.depth, info.steg.version,
+                    info.steg.flags & STEG_FLAG_COMPRESSED ? ", compressed" : "",
+                    info.steg.flags & STEG_FLAG_ENCRYPTED ? ", encrypted" : "",
+                    info.steg.flags & STEG_FLAG_SCATTERED ? ", scattered" : "",
+                    info.steg.flags & STEG_FLAG_CHECKSUM ? ", checksum" : "",
+                    info.steg.flags & STEG_FLAG_DIRECTORY ? ", directory" : "");
+            if(info.steg.flags & STEG_FLAG_ECC)
+            {
+                fprintf(console, ", ecc %d", info.steg.ecc_parity);
+            }
+            fprintf(console, "\n");
+        }
+        else
+        {
+            fprintf(console, "Payload     : none (%s)\n", info.steg.error);
+        }
     }
     else
     {
-        printf("Unsupported Operation! Use:\n");
-        printf("  -e for Encoding\n");
-        printf("  -d for Decoding\n");
+        fprintf(console, "Unsupported Operation! Use:\n");
+        fprintf(console, "  -e for Encoding\n");
+        fprintf(console, "  -d for Decoding\n");
+        fprintf(console, "  -b for Batch mode\n");
+        fprintf(console, "  -p for PSNR of a stego image against its cover\n");
+        fprintf(console, "  -i for Inspecting capacity and payload header\n");
+        fprintf(console, "  -v for Verifying a stego image without writing the payload\n");
+        fprintf(console, "  -m, -l, -x for Packing, listing and extracting a container of files\n");
+        fprintf(console, "  -S, -C for Serving requests on a local socket and sending them\n");
+        fprintf(console, "  -B for Benchmarking encode and decode on a synthetic carrier\n");
         return e_failure;
     }
 
@@ -121,8 +562,244 @@ OperationType check_operation_type(char *symbol)
     {
         return e_decode;
     }
+    else if (strcmp(symbol, "-b") == 0)
+    {
+        return e_batch;
+    }
+    else if (strcmp(symbol, "-p") == 0)
+    {
+        return e_psnr;
+    }
+    else if (strcmp(symbol, "-i") == 0 || strcmp(symbol, "--inspect") == 0)
+    {
+        return e_inspect;
+    }
+    else if (strcmp(symbol, "-v") == 0 || strcmp(symbol, "--verify") == 0)
+    {
+        return e_verify;
+    }
+    else if (strcmp(symbol, "-m") == 0)
+    {
+        return e_bundle;
+    }
+    else if (strcmp(symbol, "-l") == 0)
+    {
+        return e_list;
+    }
+    else if (strcmp(symbol, "-x") == 0)
+    {
+        return e_extract;
+    }
+    else if (strcmp(symbol, "-S") == 0)
+    {
+        return e_serve;
+    }
+    else if (strcmp(symbol, "-C") == 0)
+    {
+        return e_client;
+    }
+    else if (strcmp(symbol, "-B") == 0)
+    {
+        return e_bench;
+    }
     else
     {
         return e_unsupported;
     }
 }
+
+// Parse a single --name=value option
+Status parse_option(char *option, CliOptions *options)
+{
+    if(strcmp(option, "--io=stdio") == 0)
+    {
+        options->io_mode = e_io_stdio;
+        options->io_given = 1;
+    }
+    else if(strcmp(option, "--io=mmap") == 0)
+    {
+        options->io_mode = e_io_mmap;
+        options->io_given = 1;
+    }
+    else if(strcmp(option, "--io=async") == 0)
+    {
+        options->io_mode = e_io_async;
+        options->io_given = 1;
+    }
+    else if(strncmp(option, "--secret-size=", 14) == 0)
+    {
+        char *end;
+        options->secret_size = strtoll(option + 14, &end, 10);
+        if(*end != '\0' || options->secret_size < 0)
+        {
+            return e_failure;
+        }
+    }
+    else if(strncmp(option, "--secret-ext=", 13) == 0)
+    {
+        options->secret_extn = option + 13;
+    }
+    else if(strcmp(option, "--compress") == 0)
+    {
+        options->compress = 1;
+    }
+    else if(strcmp(option, "--encrypt") == 0)
+    {
+        options->encrypt = 1;
+    }
+    else if(strcmp(option, "--scatter") == 0)
+    {
+        options->scatter = 1;
+    }
+    else if(strcmp(option, "--checksum") == 0)
+    {
+        options->checksum = 1;
+    }
+    else if(strcmp(option, "--no-checksum") == 0)
+    {
+        options->checksum = 0;
+    }
+    else if(strcmp(option, "--ecc") == 0)
+    {
+        options->ecc = ECC_DEFAULT_PARITY;
+    }
+    else if(strncmp(option, "--ecc=", 6) == 0)
+    {
+        char *end;
+        options->ecc = strtol(option + 6, &end, 10);
+        if(end == option + 6 || *end != '\0' || ecc_check_parity(options->ecc) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else if(strncmp(option, "--range=", 8) == 0)
+    {
+        // OFFSET:LENGTH in bytes, an empty LENGTH runs to the end of the payload
+        char *end;
+        options->range_offset = strtoull(option + 8, &end, 10);
+        if(end == option + 8 || *end != ':' || option[8] == '-')
+        {
+            return e_failure;
+        }
+        char *length = end + 1;
+        options->range_length = *length ? strtoull(length, &end, 10) : ~0ULL;
+        if(*length == '-' || (*length && *end != '\0'))
+        {
+            return e_failure;
+        }
+        options->range = 1;
+    }
+    else if(strncmp(option, "--passphrase-file=", 18) == 0)
+    {
+        options->passphrase_file = option + 18;
+    }
+    else if(strncmp(option, "--depth=", 8) == 0)
+    {
+        // Exactly "1", "2" or "4", not "02" or "+4"
+        const char *depth = option + 8;
+        if(strcmp(depth, "1") != 0 && strcmp(depth, "2") != 0 && strcmp(depth, "4") != 0)
+        {
+            return e_failure;
+        }
+        options->depth = depth[0] - '0';
+    }
+    else if(strncmp(option, "--repeat=", 9) == 0)
+    {
+        return parse_count(option + 9, &options->repeat);
+    }
+    else if(strcmp(option, "--stats") == 0 || strcmp(option, "--stats=json") == 0)
+    {
+        options->stats = option[7] ? 2 : 1;
+    }
+    else if(strcmp(option, "--in-place") == 0)
+    {
+        options->in_place = 1;
+    }
+    else if(strcmp(option, "--legacy-header") == 0)
+    {
+        options->legacy_header = 1;
+    }
+    else if(strncmp(option, "--carrier-cache=", 16) == 0)
+    {
+        char *end;
+        unsigned long long mib = strtoull(option + 16, &end, 10);
+        if(end == option + 16 || *end != '\0' || option[16] == '-' || mib > SIZE_MAX >> 20)
+        {
+            return e_failure;
+        }
+        options->carrier_cache = (size_t)mib << 20;
+    }
+    else if(strncmp(option, "--bench-dir=", 12) == 0)
+    {
+        options->bench_dir = option + 12;
+    }
+    else if(strcmp(option, "--reference") == 0)
+    {
+        options->reference = 1;
+    }
+    else if(strncmp(option, "--jobs=", 7) == 0)
+    {
+        return parse_count(option + 7, &options->threads);
+    }
+    else
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+// A whole string count of 1 or more, for -j N, --jobs=N and --repeat=N
+Status parse_count(const char *text, int *count)
+{
+    // strtol() would also take leading blanks and a sign
+    if(text[0] < '0' || text[0] > '9')
+    {
+        return e_failure;
+    }
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || errno != 0 || value < 1 || value > INT_MAX)
+    {
+        return e_failure;
+    }
+    *count = (int)value;
+    return e_success;
+}
+
+// Passphrase for --encrypt / encrypted payloads: first line of
+// --passphrase-file, else $STEG_PASSPHRASE, NULL when neither is set
+const char *load_passphrase(const CliOptions *options)
+{
+    static char passphrase[1024];
+    if(options->passphrase_file == NULL)
+    {
+        return getenv("STEG_PASSPHRASE");
+    }
+    FILE *fptr = fopen(options->passphrase_file, "r");
+    if(fptr == NULL)
+    {
+        perror(options->passphrase_file);
+        return NULL;
+    }
+    if(fgets(passphrase, sizeof(passphrase), fptr) == NULL)
+    {
+        passphrase[0] = '\0';
+    }
+    fclose(fptr);
+    passphrase[strcspn(passphrase, "\r\n")] = '\0';
+    return passphrase;
+}
+
+
+// --stats: close the last stage and print the table, or JSON for --stats=json
+void report_stats(Stats *stats, FILE *out, const char *operation, unsigned long long payload_bytes, int format)
+{
+    if(stats == NULL)
+    {
+        return;
+    }
+    stats_mark(stats, "close");
+    stats_stop(stats);
+    stats_print(stats, out, operation, payload_bytes, format == 2);
+}
@@ -0,0 +1,83 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include "parallel.h"
+
+typedef struct _ParallelWorker
+{
+    ParallelFn fn;
+    void *ctx;
+    int index;
+    int nthreads;
+} ParallelWorker;
+
+static void *parallel_entry(void *arg)
+{
+    ParallelWorker *worker = arg;
+    worker->fn(worker->ctx, worker->index, worker->nthreads);
+    return NULL;
+}
+
+Status parallel_run(int nthreads, ParallelFn fn, void *ctx)
+{
+    if (nthreads <= 1)
+    {
+        fn(ctx, 0, 1);
+        return e_success;
+    }
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * nthreads);
+    ParallelWorker *workers = malloc(sizeof(ParallelWorker) * nthreads);
+    if (threads == NULL || workers == NULL)
+    {
+        free(threads);
+        free(workers);
+        return e_failure;
+    }
+
+    // Start workers 1..n-1, then do worker 0 on the calling thread
+    int started = 1;
+    for (int i = 0; i < nthreads; i++)
+    {
+        workers[i] = (ParallelWorker){fn, ctx, i, nthreads};
+    }
+    for (int i = 1; i < nthreads; i++, started++)
+    {
+        if (pthread_create(&threads[i], NULL, parallel_entry, &workers[i]) != 0)
+            break;
+    }
+    // Ranges of workers that failed to start are picked up here
+    for (int i = started; i < nthreads; i++)
+    {
+        fn(ctx, i, nthreads);
+    }
+    fn(ctx, 0, nthreads);
+
+    for (int i = 1; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(workers);
+    return e_success;
+}
+
+void parallel_range(size_t total, size_t align, int index, int nthreads,
+                    size_t *begin, size_t *end)
+{
+    size_t units = (total + align - 1) / align;
+    size_t per_worker = units / nthreads;
+    size_t extra = units % nthreads;
+
+    size_t worker = (size_t)index;
+
+    // The first 'extra' workers take one more unit each
+    size_t first = worker * per_worker + (worker < extra ? worker : extra);
+    size_t count = per_worker + (worker < extra ? 1 : 0);
+
+    *begin = first * align;
+    *end = (first + count) * align;
+    if (*begin > total)
+        *begin = total;
+    if (*end > total)
+        *end = total;
+}
@@ -0,0 +1,23 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Minimal fork/join helper on top of pthreads
+ * fn is called once per worker with its index in [0, nthreads)
+ */
+typedef void (*ParallelFn)(void *ctx, int index, int nthreads);
+
+/* Run fn on nthreads threads (the caller is worker 0) and wait for all */
+Status parallel_run(int nthreads, ParallelFn fn, void *ctx);
+
+/*
+ * Split [0, total) into nthreads ranges whose boundaries are multiples of
+ * align and return the range of worker index
+ */
+void parallel_range(size_t total, size_t align, int index, int nthreads,
+                    size_t *begin, size_t *end);
+
+#endif
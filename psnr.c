@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "psnr.h"
+#include "bmp.h"
+#include "bmpio.h"
+
+/* Open a BMP and leave it positioned at the first pixel byte */
+static FILE *open_bmp(const char *fname, BmpInfo *bmp)
+{
+    FILE *fptr = fopen(fname, "r");
+    if (fptr == NULL)
+    {
+        perror(fname);
+        return NULL;
+    }
+    unsigned char *header;
+    size_t header_size;
+    if (bmp_read_header(fptr, &header, &header_size, bmp) == e_failure)
+    {
+        fprintf(stderr, "%s: not a 24/32 bpp uncompressed BMP\n", fname);
+        fclose(fptr);
+        return NULL;
+    }
+    free(header);
+    return fptr;
+}
+
+Status measure_psnr(const char *cover_fname, const char *stego_fname, PsnrReport *report)
+{
+    memset(report, 0, sizeof(*report));
+    BmpInfo cover_bmp, stego_bmp;
+    FILE *cover = open_bmp(cover_fname, &cover_bmp);
+    FILE *stego = cover ? open_bmp(stego_fname, &stego_bmp) : NULL;
+    if (stego == NULL)
+    {
+        if (cover != NULL)
+            fclose(cover);
+        return e_failure;
+    }
+    if (cover_bmp.width != stego_bmp.width || cover_bmp.height != stego_bmp.height ||
+        cover_bmp.bytes_per_pixel != stego_bmp.bytes_per_pixel)
+    {
+        fprintf(stderr, "Images differ in size or pixel format\n");
+        fclose(cover);
+        fclose(stego);
+        return e_failure;
+    }
+
+    // Walk both pixel arrays a row at a time, skipping padding and alpha
+    size_t stride = cover_bmp.row_stride;
+    unsigned char *cover_row = malloc(stride);
+    unsigned char *stego_row = malloc(stride);
+    Status status = cover_row && stego_row ? e_success : e_failure;
+    uint64_t squared_error = 0;
+    for (uint row = 0; status == e_success && row < cover_bmp.height; row++)
+    {
+        if (fread(cover_row, 1, stride, cover) != stride || fread(stego_row, 1, stride, stego) != stride)
+        {
+            fprintf(stderr, "Pixel array ended early\n");
+            status = e_failure;
+            break;
+        }
+        for (uint64_t i = 0; i < cover_bmp.row_bytes; i++)
+        {
+            if (cover_bmp.bytes_per_pixel == 4 && i % 4 == 3)
+                continue;
+            int diff = cover_row[i] - stego_row[i];
+            uint64_t error = diff < 0 ? -diff : diff;
+            squared_error += error * error;
+            report->changed += error != 0;
+            if (error > report->max_error)
+                report->max_error = error;
+        }
+    }
+    free(cover_row);
+    free(stego_row);
+    fclose(cover);
+    fclose(stego);
+
+    if (status == e_success)
+    {
+        report->compared = cover_bmp.capacity;
+        report->mse = (double)squared_error / report->compared;
+        report->psnr = report->mse > 0 ? 10.0 * log10(255.0 * 255.0 / report->mse) : INFINITY;
+    }
+    return status;
+}
@@ -0,0 +1,24 @@
+#ifndef PSNR_H
+#define PSNR_H
+
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Distortion of a stego image against its cover
+ * Only the colour bytes that can carry payload are compared, so row
+ * padding and alpha bytes don't dilute the figures.
+ */
+typedef struct _PsnrReport
+{
+    uint64_t compared;      // Colour bytes compared
+    uint64_t changed;       // Colour bytes that differ
+    uint64_t max_error;     // Largest absolute difference of a byte
+    double mse;             // Mean squared error per colour byte
+    double psnr;            // 10 * log10(255^2 / mse) in dB, INFINITY when identical
+} PsnrReport;
+
+/* Compare two BMP images of the same geometry */
+Status measure_psnr(const char *cover_fname, const char *stego_fname, PsnrReport *report);
+
+#endif
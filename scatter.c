@@ -0,0 +1,85 @@
+#include <string.h>
+#include "scatter.h"
+#include "crypto.h"
+
+/* Round function: splitmix64 finaliser of the keyed half */
+static uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+Status scatter_init(ScatterMap *map, const char *passphrase, const BmpInfo *bmp, uint64_t header_end)
+{
+    static const char domain[] = "LSB tile scatter";
+    unsigned char digest[SHA256_SIZE];
+    unsigned char seed[sizeof(domain) + 1024];
+
+    memset(map, 0, sizeof(*map));
+    if (passphrase == NULL || passphrase[0] == '\0')
+        return e_failure;
+
+    // Line the tiles up with the pages of the file where carrier bytes are contiguous
+    map->base = header_end;
+    if (bmp->contiguous)
+        map->base += (SCATTER_TILE_SIZE - (bmp->pixel_offset + header_end) % SCATTER_TILE_SIZE) % SCATTER_TILE_SIZE;
+    map->tiles = bmp->capacity > map->base ? (bmp->capacity - map->base) / SCATTER_TILE_SIZE : 0;
+    // Smallest even bit width covering every tile index
+    int bits = 2;
+    while (bits < 64 && (1ULL << bits) < map->tiles)
+        bits += 2;
+    map->half_bits = bits / 2;
+
+    // The round keys are SHA-256 of the domain and the passphrase
+    size_t len = sizeof(domain) + strlen(passphrase);
+    if (len > sizeof(seed))
+        return e_failure;
+    memcpy(seed, domain, sizeof(domain));
+    memcpy(seed + sizeof(domain), passphrase, len - sizeof(domain));
+    sha256(seed, len, digest);
+    for (int r = 0; r < 4; r++)
+    {
+        uint64_t key = 0;
+        for (int i = 0; i < 8; i++)
+            key = (key << 8) | digest[8 * r + i];
+        map->round_key[r] = key;
+    }
+    secure_wipe(seed, len);
+    secure_wipe(digest, sizeof(digest));
+    return e_success;
+}
+
+uint64_t scatter_capacity(const ScatterMap *map)
+{
+    return map->tiles * SCATTER_TILE_SIZE;
+}
+
+static uint64_t permute(const ScatterMap *map, uint64_t tile)
+{
+    const int half = map->half_bits;
+    const uint64_t mask = (1ULL << half) - 1;
+    // Cycle walk: the Feistel domain is at most 4x the tile count
+    do
+    {
+        uint64_t left = tile >> half, right = tile & mask;
+        for (int r = 0; r < 4; r++)
+        {
+            uint64_t next = left ^ (mix64(right ^ map->round_key[r]) & mask);
+            left = right;
+            right = next;
+        }
+        tile = (left << half) | right;
+    } while (tile >= map->tiles);
+    return tile;
+}
+
+uint64_t scatter_index(const ScatterMap *map, uint64_t offset)
+{
+    return map->base + permute(map, offset / SCATTER_TILE_SIZE) * SCATTER_TILE_SIZE + offset % SCATTER_TILE_SIZE;
+}
+
+uint64_t scatter_run(uint64_t offset)
+{
+    return SCATTER_TILE_SIZE - offset % SCATTER_TILE_SIZE;
+}
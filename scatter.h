@@ -0,0 +1,43 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Keyed tile scatter for --scatter
+ * The carrier bytes behind the stego header are cut into tiles of
+ * SCATTER_TILE_SIZE bytes. Payload tile i goes to tile perm(i), where
+ * perm is a 4 round Feistel bijection keyed from the passphrase (cycle
+ * walking keeps it inside the tile count). Inside a tile the payload
+ * stays sequential, so every access is a page-sized streaming run and
+ * the payload is spread over the whole image. On a contiguous 24 bpp
+ * image the tiles start on a page boundary of the file, so each tile
+ * is exactly one page. Partial tiles at either end are never used.
+ */
+
+/* Carrier bytes per tile, one page of a contiguous 24 bpp image */
+#define SCATTER_TILE_SIZE 4096
+
+typedef struct _ScatterMap
+{
+    uint64_t base;          // Carrier index of the first tile
+    uint64_t tiles;         // Whole tiles between base and the end of the image
+    int half_bits;          // Feistel half width, 2 * half_bits covers tiles
+    uint64_t round_key[4];
+} ScatterMap;
+
+/* Key the permutation and lay tiles over the carrier bytes from header_end on */
+Status scatter_init(ScatterMap *map, const char *passphrase, const BmpInfo *bmp, uint64_t header_end);
+
+/* Carrier bytes a scattered payload can use */
+uint64_t scatter_capacity(const ScatterMap *map);
+
+/* Carrier index of the payload carrier byte at offset from the start of the payload */
+uint64_t scatter_index(const ScatterMap *map, uint64_t offset);
+
+/* Carrier bytes from offset to the end of its tile */
+uint64_t scatter_run(uint64_t offset);
+
+#endif
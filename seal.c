@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include "seal.h"
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (24 - 8 * i);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Salt from the kernel, /dev/urandom where getrandom() is missing */
+static Status random_bytes(unsigned char *out, size_t n)
+{
+#ifdef __linux__
+    while (n > 0)
+    {
+        ssize_t got = getrandom(out, n, 0);
+        if (got <= 0)
+            break;
+        out += got;
+        n -= got;
+    }
+    if (n == 0)
+        return e_success;
+#endif
+    FILE *fptr = fopen("/dev/urandom", "rb");
+    if (fptr == NULL)
+        return e_failure;
+    size_t got = fread(out, 1, n, fptr);
+    fclose(fptr);
+    return got == n ? e_success : e_failure;
+}
+
+static void derive_key(const char *passphrase, const unsigned char *header, unsigned char *key)
+{
+    pbkdf2_hmac_sha256((const unsigned char *)passphrase, strlen(passphrase), header, SEAL_SALT_SIZE,
+                       get_be32(header + SEAL_SALT_SIZE), key, CHACHA20_KEY_SIZE);
+}
+
+static void make_nonce(unsigned char *nonce, uint64_t segment, int last)
+{
+    memset(nonce, 0, CHACHA20_NONCE_SIZE);
+    nonce[0] = last ? 1 : 0;
+    for (int i = 0; i < 8; i++)
+        nonce[4 + i] = segment >> (56 - 8 * i);
+}
+
+uint64_t seal_sealed_size(uint64_t plain_size)
+{
+    uint64_t segments = plain_size == 0 ? 1 : (plain_size + SEAL_SEGMENT_SIZE - 1) / SEAL_SEGMENT_SIZE;
+    return SEAL_HEADER_SIZE + plain_size + segments * POLY1305_TAG_SIZE;
+}
+
+Status seal_encoder_init(SealEncoder *enc, const char *passphrase, uint32_t iterations)
+{
+    memset(enc, 0, sizeof(*enc));
+    if (iterations == 0 || iterations > SEAL_MAX_ITERATIONS)
+        return e_failure;
+    if (random_bytes(enc->header, SEAL_SALT_SIZE) == e_failure)
+        return e_failure;
+    put_be32(enc->header + SEAL_SALT_SIZE, iterations);
+    derive_key(passphrase, enc->header, enc->key);
+    return e_success;
+}
+
+size_t seal_segment(SealEncoder *enc, const unsigned char *in, size_t n, int last, unsigned char *out)
+{
+    unsigned char nonce[CHACHA20_NONCE_SIZE];
+    make_nonce(nonce, enc->segment++, last);
+    aead_seal(enc->key, nonce, enc->header, SEAL_HEADER_SIZE, in, n, out, out + n);
+    return n + POLY1305_TAG_SIZE;
+}
+
+void seal_encoder_clear(SealEncoder *enc)
+{
+    secure_wipe(enc->key, sizeof(enc->key));
+}
+
+Status seal_decoder_init(SealDecoder *dec, const char *passphrase, uint64_t sealed_size)
+{
+    dec->passphrase = passphrase;
+    dec->remaining = sealed_size;
+    dec->segment = 0;
+    dec->have = 0;
+    dec->keyed = 0;
+    if (passphrase == NULL || sealed_size < SEAL_HEADER_SIZE + POLY1305_TAG_SIZE)
+        return e_failure;
+    return e_success;
+}
+
+Status seal_decoder_feed(SealDecoder *dec, const unsigned char *in, size_t n, DataSink sink, void *ctx)
+{
+    if (n > dec->remaining)
+        return e_failure;
+
+    while (n > 0)
+    {
+        if (!dec->keyed)
+        {
+            size_t take = SEAL_HEADER_SIZE - dec->have < n ? SEAL_HEADER_SIZE - dec->have : n;
+            memcpy(dec->header + dec->have, in, take);
+            dec->have += take;
+            dec->remaining -= take;
+            in += take;
+            n -= take;
+            if (dec->have < SEAL_HEADER_SIZE)
+                break;
+            uint32_t iterations = get_be32(dec->header + SEAL_SALT_SIZE);
+            if (iterations == 0 || iterations > SEAL_MAX_ITERATIONS)
+                return e_failure;
+            derive_key(dec->passphrase, dec->header, dec->key);
+            dec->keyed = 1;
+            dec->have = 0;
+            continue;
+        }
+
+        // The segment ends at SEAL_FRAME_MAX bytes or at the end of the stream
+        size_t left = dec->remaining + dec->have;
+        size_t need = left < SEAL_FRAME_MAX ? left : SEAL_FRAME_MAX;
+        size_t take = need - dec->have < n ? need - dec->have : n;
+        memcpy(dec->frame + dec->have, in, take);
+        dec->have += take;
+        dec->remaining -= take;
+        in += take;
+        n -= take;
+        if (dec->have < need)
+            break;
+
+        if (need < POLY1305_TAG_SIZE)
+            return e_failure;
+        unsigned char nonce[CHACHA20_NONCE_SIZE];
+        size_t body = need - POLY1305_TAG_SIZE;
+        make_nonce(nonce, dec->segment++, dec->remaining == 0);
+        if (aead_open(dec->key, nonce, dec->header, SEAL_HEADER_SIZE, dec->frame, body,
+                      dec->frame + body, dec->frame) != 0)
+            return e_failure;
+        dec->have = 0;
+        if (sink(ctx, dec->frame, body) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+Status seal_decoder_finish(SealDecoder *dec)
+{
+    secure_wipe(dec->key, sizeof(dec->key));
+    secure_wipe(dec->frame, sizeof(dec->frame));
+    return dec->keyed && dec->remaining == 0 && dec->have == 0 ? e_success : e_failure;
+}
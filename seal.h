@@ -0,0 +1,74 @@
+#ifndef SEAL_H
+#define SEAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "crypto.h"
+
+/*
+ * Passphrase sealed stream for --encrypt
+ * A 20 byte header (16 byte random salt, 4 byte big endian PBKDF2
+ * iteration count) is followed by the payload cut into segments of
+ * SEAL_SEGMENT_SIZE bytes, each sealed with ChaCha20-Poly1305 under
+ * the PBKDF2-HMAC-SHA256 key and stored as ciphertext plus a 16 byte
+ * tag. The nonce is the segment index (big endian in bytes 4-11) with
+ * byte 0 set on the last segment, and the header is the associated
+ * data, so segments can't be reordered, dropped or cut off. An empty
+ * payload still has one empty segment. The decoder hands a segment on
+ * only after its tag checks out.
+ */
+
+#define SEAL_SALT_SIZE 16
+#define SEAL_HEADER_SIZE (SEAL_SALT_SIZE + 4)
+#define SEAL_SEGMENT_SIZE (64 * 1024)
+
+/* Largest sealed segment */
+#define SEAL_FRAME_MAX (SEAL_SEGMENT_SIZE + POLY1305_TAG_SIZE)
+
+/* PBKDF2 work factor written by this build, and the most a decoder accepts */
+#define SEAL_ITERATIONS 600000
+#define SEAL_MAX_ITERATIONS 10000000
+
+typedef struct _SealEncoder
+{
+    unsigned char key[CHACHA20_KEY_SIZE];
+    unsigned char header[SEAL_HEADER_SIZE];
+    uint64_t segment;                   // Index of the next segment
+} SealEncoder;
+
+/* Size of the sealed stream for a payload of plain_size bytes */
+uint64_t seal_sealed_size(uint64_t plain_size);
+
+/* Pick a fresh salt and derive the key, the header is ready in enc->header */
+Status seal_encoder_init(SealEncoder *enc, const char *passphrase, uint32_t iterations);
+
+/* Seal n <= SEAL_SEGMENT_SIZE bytes into out (n + 16 bytes), returns the size written */
+size_t seal_segment(SealEncoder *enc, const unsigned char *in, size_t n, int last, unsigned char *out);
+
+/* Forget the key */
+void seal_encoder_clear(SealEncoder *enc);
+
+/* Incremental opener, the sealed stream may arrive in any pieces */
+typedef struct _SealDecoder
+{
+    const char *passphrase;
+    unsigned char key[CHACHA20_KEY_SIZE];
+    unsigned char header[SEAL_HEADER_SIZE];
+    uint64_t remaining;                 // Sealed bytes not yet fed
+    uint64_t segment;
+    size_t have;                        // Bytes of the header or current segment buffered
+    int keyed;                          // Header read and key derived
+    unsigned char frame[SEAL_FRAME_MAX];
+} SealDecoder;
+
+/* e_failure if sealed_size can't be a sealed stream */
+Status seal_decoder_init(SealDecoder *dec, const char *passphrase, uint64_t sealed_size);
+
+/* Open what is complete in n more bytes, e_failure on a bad tag, bad header or a sink error */
+Status seal_decoder_feed(SealDecoder *dec, const unsigned char *in, size_t n, DataSink sink, void *ctx);
+
+/* Forget the key, e_failure if the stream stopped early */
+Status seal_decoder_finish(SealDecoder *dec);
+
+#endif
@@ -0,0 +1,153 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stats.h"
+
+static double now_millis(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * rchar, wchar, syscr and syscw of the process. The pread that fetches
+ * them is itself counted by the next sample, so its share is returned
+ * in self_bytes for the caller to take off.
+ */
+static void read_io(int fd, uint64_t io[4], uint64_t *self_bytes)
+{
+    static const char *keys[4] = {"rchar:", "wchar:", "syscr:", "syscw:"};
+    char text[1024];
+    memset(io, 0, 4 * sizeof(uint64_t));
+    *self_bytes = 0;
+    ssize_t n = fd >= 0 ? pread(fd, text, sizeof(text) - 1, 0) : -1;
+    if (n <= 0)
+        return;
+    text[n] = '\0';
+    *self_bytes = n;
+    for (int i = 0; i < 4; i++)
+    {
+        const char *field = strstr(text, keys[i]);
+        if (field != NULL)
+            io[i] = strtoull(field + strlen(keys[i]), NULL, 10);
+    }
+}
+
+Status stats_start(Stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->io_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+    uint64_t self_bytes;
+    read_io(stats->io_fd, stats->mark_io, &self_bytes);
+    stats->mark_io[0] += self_bytes;
+    stats->mark_io[2] += stats->io_fd >= 0;
+    stats->start_millis = stats->mark_millis = now_millis();
+    return e_success;
+}
+
+void stats_mark(Stats *stats, const char *name)
+{
+    if (stats == NULL)
+        return;
+    double now = now_millis();
+    uint64_t io[4], self_bytes;
+    read_io(stats->io_fd, io, &self_bytes);
+
+    StageStats *stage = NULL;
+    for (int i = 0; i < stats->count && stage == NULL; i++)
+    {
+        if (strcmp(stats->stages[i].name, name) == 0)
+            stage = &stats->stages[i];
+    }
+    if (stage == NULL && stats->count < STATS_MAX_STAGES)
+    {
+        stage = &stats->stages[stats->count++];
+        stage->name = name;
+    }
+    if (stage != NULL)
+    {
+        stage->millis += now - stats->mark_millis;
+        stage->read_bytes += io[0] - stats->mark_io[0];
+        stage->write_bytes += io[1] - stats->mark_io[1];
+        stage->read_calls += io[2] - stats->mark_io[2];
+        stage->write_calls += io[3] - stats->mark_io[3];
+    }
+
+    // Start the next stage after this sample's own read
+    memcpy(stats->mark_io, io, sizeof(io));
+    stats->mark_io[0] += self_bytes;
+    stats->mark_io[2] += stats->io_fd >= 0;
+    stats->mark_millis = now_millis();
+}
+
+void stats_stop(Stats *stats)
+{
+    if (stats->io_fd >= 0)
+        close(stats->io_fd);
+    stats->io_fd = -1;
+}
+
+double stats_total(const Stats *stats)
+{
+    return stats->mark_millis - stats->start_millis;
+}
+
+/* MB/s of n bytes in millis, 0 for a stage too short to time */
+static double rate(uint64_t n, double millis)
+{
+    return millis > 0 ? n / (millis * 1000.0) : 0;
+}
+
+void stats_print(const Stats *stats, FILE *out, const char *operation, uint64_t payload_bytes, int json)
+{
+    double total = stats_total(stats);
+    uint64_t read_bytes = 0, write_bytes = 0, read_calls = 0, write_calls = 0;
+    for (int i = 0; i < stats->count; i++)
+    {
+        read_bytes += stats->stages[i].read_bytes;
+        write_bytes += stats->stages[i].write_bytes;
+        read_calls += stats->stages[i].read_calls;
+        write_calls += stats->stages[i].write_calls;
+    }
+
+    if (json)
+    {
+        fprintf(out, "{\"operation\": \"%s\", \"total_ms\": %.3f, \"payload_bytes\": %llu, \"payload_mbps\": %.1f, "
+                "\"read_bytes\": %llu, \"write_bytes\": %llu, \"read_calls\": %llu, \"write_calls\": %llu, \"stages\": [",
+                operation, total, (unsigned long long)payload_bytes, rate(payload_bytes, total),
+                (unsigned long long)read_bytes, (unsigned long long)write_bytes, (unsigned long long)read_calls,
+                (unsigned long long)write_calls);
+        for (int i = 0; i < stats->count; i++)
+        {
+            const StageStats *stage = &stats->stages[i];
+            fprintf(out, "%s{\"name\": \"%s\", \"ms\": %.3f, \"read_bytes\": %llu, \"write_bytes\": %llu, "
+                    "\"read_calls\": %llu, \"write_calls\": %llu, \"mbps\": %.1f}",
+                    i ? ", " : "", stage->name, stage->millis, (unsigned long long)stage->read_bytes,
+                    (unsigned long long)stage->write_bytes, (unsigned long long)stage->read_calls,
+                    (unsigned long long)stage->write_calls,
+                    rate(stage->read_bytes + stage->write_bytes, stage->millis));
+        }
+        fprintf(out, "]}\n");
+        return;
+    }
+
+    fprintf(out, "%-12s %10s %12s %12s %8s %8s %9s\n", "Stage", "ms", "read", "written", "reads", "writes", "MB/s");
+    for (int i = 0; i < stats->count; i++)
+    {
+        const StageStats *stage = &stats->stages[i];
+        fprintf(out, "%-12s %10.3f %12llu %12llu %8llu %8llu %9.1f\n", stage->name, stage->millis,
+                (unsigned long long)stage->read_bytes, (unsigned long long)stage->write_bytes,
+                (unsigned long long)stage->read_calls, (unsigned long long)stage->write_calls,
+                rate(stage->read_bytes + stage->write_bytes, stage->millis));
+    }
+    fprintf(out, "%-12s %10.3f %12llu %12llu %8llu %8llu %9.1f\n", "total", total, (unsigned long long)read_bytes,
+            (unsigned long long)write_bytes, (unsigned long long)read_calls, (unsigned long long)write_calls,
+            rate(read_bytes + write_bytes, total));
+    fprintf(out, "Payload     : %llu bytes in %.3f ms, %.1f MB/s\n", (unsigned long long)payload_bytes, total,
+            rate(payload_bytes, total));
+}
@@ -0,0 +1,54 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Per-stage timers for --stats and the -B benchmark
+ * A stage runs from one stats_mark() to the next and records its wall
+ * time on the monotonic clock and the bytes and read/write syscalls the
+ * process made meanwhile (from /proc/self/io, so stdio buffering, mmap
+ * and I/O threads are all seen as the kernel saw them; zero where the
+ * file is missing). Marks that repeat a name add to the same stage.
+ */
+
+#define STATS_MAX_STAGES 24
+
+typedef struct _StageStats
+{
+    const char *name;
+    double millis;
+    uint64_t read_bytes;        // rchar: read(2), pread(2), ... including the page cache
+    uint64_t write_bytes;       // wchar
+    uint64_t read_calls;        // syscr
+    uint64_t write_calls;       // syscw
+} StageStats;
+
+typedef struct _Stats
+{
+    StageStats stages[STATS_MAX_STAGES];
+    int count;
+    double start_millis;        // stats_start()
+    double mark_millis;         // Last mark
+    uint64_t mark_io[4];        // Counters at the last mark
+    int io_fd;                  // /proc/self/io, -1 without one
+} Stats;
+
+/* Start the clock, the first stage begins here */
+Status stats_start(Stats *stats);
+
+/* Close the stage running since the last mark under name (stats may be NULL) */
+void stats_mark(Stats *stats, const char *name);
+
+/* Release the counters file, the figures stay readable */
+void stats_stop(Stats *stats);
+
+/* Milliseconds from stats_start() to the last mark */
+double stats_total(const Stats *stats);
+
+/* Stage table, or one JSON object when json is set; payload bytes give the overall MB/s */
+void stats_print(const Stats *stats, FILE *out, const char *operation, uint64_t payload_bytes, int json);
+
+#endif
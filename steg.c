@@ -0,0 +1,525 @@
+#include <string.h>
+#include "steg.h"
+#include "common.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "ecc.h"
+
+/* Carrier bytes gathered per step when padding or alpha split the pixels */
+#define STEG_SCRATCH_SIZE 4096
+
+/* Longest varints of the version 2 fields */
+#define STEG_V2_WORD_BYTES 5
+#define STEG_V2_ECC_BYTES 2
+#define STEG_V2_EXTN_LEN_BYTES 2
+#define STEG_V2_SIZE_BYTES 10
+
+uint steg_pack_extn_word(int extn_len, int depth, int flags, int version)
+{
+    // Depth 1 in a version 0 header keeps the legacy word, which is just the length
+    uint word = extn_len;
+    if (depth > 1)
+        word |= (uint)depth << STEG_DEPTH_SHIFT;
+    word |= (uint)flags << STEG_FLAGS_SHIFT;
+    word |= (uint)version << STEG_VERSION_SHIFT;
+    return word;
+}
+
+Status steg_unpack_extn_word(uint word, int *extn_len, int *depth, int *flags, int *version)
+{
+    *extn_len = word & STEG_EXTN_LEN_MASK;
+    *depth = (word >> STEG_DEPTH_SHIFT) & STEG_DEPTH_MASK;
+    *flags = (word >> STEG_FLAGS_SHIFT) & STEG_FLAGS_MASK;
+    *version = (word >> STEG_VERSION_SHIFT) & STEG_VERSION_MASK;
+    if (*depth == 0)
+        *depth = 1;
+    uint known = STEG_EXTN_LEN_MASK | (STEG_DEPTH_MASK << STEG_DEPTH_SHIFT) |
+                 (STEG_FLAGS_MASK << STEG_FLAGS_SHIFT) | ((uint)STEG_VERSION_MASK << STEG_VERSION_SHIFT);
+    // A legacy word has no room for the parity count of STEG_FLAG_ECC
+    if ((word & ~known) != 0 || *version > STEG_HEADER_V1 || (*flags & ~(STEG_KNOWN_FLAGS & ~STEG_FLAG_ECC)) != 0 ||
+        *extn_len > STEG_MAX_EXTN || (*depth != 1 && *depth != 2 && *depth != 4))
+        return e_failure;
+    return e_success;
+}
+
+int steg_header_version(uint64_t payload_size)
+{
+    return payload_size > 0xFFFFFFFFULL ? STEG_HEADER_V1 : STEG_HEADER_V0;
+}
+
+/* Bytes of the payload size field in a legacy header of version */
+static size_t size_field_bytes(int version)
+{
+    return version == STEG_HEADER_V0 ? 4 : 8;
+}
+
+/* Sizes are stored MSB first */
+static void put_be(unsigned char *out, uint64_t value, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = (unsigned char)(value >> (8 * (n - 1 - i)));
+}
+
+static uint64_t get_be(const unsigned char *in, size_t n)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; i++)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+static size_t varint_size(uint64_t value)
+{
+    size_t n = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+/*
+ * Bytes of the varint at in, 0 when it runs on past available, -1 when
+ * it is longer than max bytes or doesn't fit 64 bits
+ */
+static int get_varint(const unsigned char *in, size_t available, int max, uint64_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < max; i++)
+    {
+        if ((size_t)i == available)
+            return 0;
+        uint64_t group = in[i] & 0x7F;
+        if (i == 9 && group > 1)
+            return -1;
+        *value |= group << (7 * i);
+        if (!(in[i] & 0x80))
+            return i + 1;
+    }
+    return -1;
+}
+
+static int depth_code(int depth)
+{
+    return depth == 4 ? 2 : depth == 2 ? 1 : 0;
+}
+
+/* Header check of version 2: low 16 bits of the CRC32C of the bytes in front of it */
+static uint32_t header_check(const unsigned char *fields, size_t n)
+{
+    return crc32c_update(0, fields, n) & 0xFFFF;
+}
+
+size_t steg_write_header(unsigned char *out, int version, const char *extn, int depth, int flags, int ecc_parity,
+                         uint64_t payload_size)
+{
+    size_t extn_len = strlen(extn);
+    size_t n = strlen(MAGIC_STRING);
+    memcpy(out, MAGIC_STRING, n);
+    if (version != STEG_HEADER_V2)
+    {
+        put_be(out + n, steg_pack_extn_word(extn_len, depth, flags, version), 4);
+        n += 4;
+        memcpy(out + n, extn, extn_len);
+        n += extn_len;
+        put_be(out + n, payload_size, size_field_bytes(version));
+        return n + size_field_bytes(version);
+    }
+    out[n++] = STEG_HEADER_V2;
+    n += put_varint(out + n, depth_code(depth) | (uint64_t)flags << STEG_V2_FLAGS_SHIFT);
+    if (flags & STEG_FLAG_ECC)
+        n += put_varint(out + n, ecc_parity);
+    n += put_varint(out + n, extn_len);
+    memcpy(out + n, extn, extn_len);
+    n += extn_len;
+    n += put_varint(out + n, payload_size);
+    put_be(out + n, header_check(out, n), STEG_V2_CHECK_SIZE);
+    return n + STEG_V2_CHECK_SIZE;
+}
+
+int steg_probe_version(const unsigned char *fields)
+{
+    size_t magic_len = strlen(MAGIC_STRING);
+    return memcmp(fields, MAGIC_STRING, magic_len) == 0 ? fields[magic_len] : -1;
+}
+
+/* At least one more byte than available, and no less than the total so far */
+static size_t need_more(size_t available, size_t total)
+{
+    return total > available ? total : available + 1;
+}
+
+size_t steg_header_need(const unsigned char *fields, size_t available)
+{
+    size_t magic_len = strlen(MAGIC_STRING);
+    if (memcmp(fields, MAGIC_STRING, available < magic_len ? available : magic_len) != 0)
+        return 0;
+    if (available <= magic_len)
+        return magic_len + 1;
+
+    int version = fields[magic_len];
+    if (version == STEG_HEADER_V0 || version == STEG_HEADER_V1)
+    {
+        // The version byte is the top of the big endian extension size word,
+        // its bottom byte the extension length
+        if (available < magic_len + 4)
+            return magic_len + 4;
+        return magic_len + 4 + fields[magic_len + 3] + size_field_bytes(version);
+    }
+    if (version != STEG_HEADER_V2)
+        return 0;
+
+    // Walk the varints, a missing one counts as a single byte
+    size_t pos = magic_len + 1;
+    uint64_t word, extn_len, size;
+    int n = get_varint(fields + pos, available - pos, STEG_V2_WORD_BYTES, &word);
+    if (n <= 0)
+        return n < 0 ? 0 : need_more(available, pos + 3 + STEG_V2_CHECK_SIZE);
+    pos += n;
+    if ((word >> STEG_V2_FLAGS_SHIFT) & STEG_FLAG_ECC)
+    {
+        uint64_t parity;
+        n = get_varint(fields + pos, available - pos, STEG_V2_ECC_BYTES, &parity);
+        if (n <= 0)
+            return n < 0 ? 0 : need_more(available, pos + 3 + STEG_V2_CHECK_SIZE);
+        pos += n;
+    }
+    n = get_varint(fields + pos, available - pos, STEG_V2_EXTN_LEN_BYTES, &extn_len);
+    if (n < 0 || extn_len > STEG_MAX_EXTN)
+        return 0;
+    if (n == 0)
+        return need_more(available, pos + 2 + STEG_V2_CHECK_SIZE);
+    pos += n + extn_len;
+    if (available <= pos)
+        return pos + 1 + STEG_V2_CHECK_SIZE;
+    n = get_varint(fields + pos, available - pos, STEG_V2_SIZE_BYTES, &size);
+    if (n <= 0)
+        return n < 0 ? 0 : need_more(available, pos + 1 + STEG_V2_CHECK_SIZE);
+    return pos + n + STEG_V2_CHECK_SIZE;
+}
+
+Status steg_parse_header(const unsigned char *fields, size_t size, StegHeader *header)
+{
+    size_t magic_len = strlen(MAGIC_STRING);
+    header->has_magic = size >= magic_len && memcmp(fields, MAGIC_STRING, magic_len) == 0;
+    if (!header->has_magic)
+    {
+        header->error = "no magic string";
+        return e_failure;
+    }
+    if (steg_header_need(fields, size) != size)
+    {
+        header->error = "corrupt stego header";
+        return e_failure;
+    }
+
+    int extn_len;
+    size_t pos = magic_len;
+    if (fields[pos] != STEG_HEADER_V2)
+    {
+        if (steg_unpack_extn_word(get_be(fields + pos, 4), &extn_len, &header->depth, &header->flags,
+                                  &header->version) == e_failure)
+        {
+            header->error = "corrupt stego header";
+            return e_failure;
+        }
+        pos += 4;
+        header->ecc_parity = 0;
+        memcpy(header->extn, fields + pos, extn_len);
+        pos += extn_len;
+        header->payload_size = get_be(fields + pos, size_field_bytes(header->version));
+    }
+    else
+    {
+        uint64_t word, value = 0;
+        pos++;
+        pos += get_varint(fields + pos, size - pos, STEG_V2_WORD_BYTES, &word);
+        if ((word >> STEG_V2_FLAGS_SHIFT) & STEG_FLAG_ECC)
+            pos += get_varint(fields + pos, size - pos, STEG_V2_ECC_BYTES, &value);
+        header->ecc_parity = value;
+        pos += get_varint(fields + pos, size - pos, STEG_V2_EXTN_LEN_BYTES, &value);
+        extn_len = value;
+        memcpy(header->extn, fields + pos, extn_len);
+        pos += extn_len;
+        pos += get_varint(fields + pos, size - pos, STEG_V2_SIZE_BYTES, &header->payload_size);
+        if (get_be(fields + pos, STEG_V2_CHECK_SIZE) != header_check(fields, pos))
+        {
+            header->error = "stego header check mismatch";
+            return e_failure;
+        }
+        header->version = STEG_HEADER_V2;
+        header->depth = 1 << (word & STEG_V2_DEPTH_MASK);
+        if ((word & STEG_V2_DEPTH_MASK) == STEG_V2_DEPTH_MASK || (word >> STEG_V2_FLAGS_SHIFT) & ~(uint64_t)STEG_KNOWN_FLAGS)
+        {
+            header->error = "unsupported depth or payload flags";
+            return e_failure;
+        }
+        header->flags = word >> STEG_V2_FLAGS_SHIFT;
+        uint64_t data_size;
+        if ((header->flags & STEG_FLAG_ECC) &&
+            (ecc_check_parity(header->ecc_parity) == e_failure ||
+             ecc_data_size(header->payload_size, header->ecc_parity, &data_size) == e_failure))
+        {
+            header->error = "unsupported error correction parity or payload size";
+            return e_failure;
+        }
+    }
+    header->extn[extn_len] = '\0';
+    if (header->payload_size > (uint64_t)INT64_MAX / 8)
+    {
+        header->error = "corrupt payload size";
+        return e_failure;
+    }
+    header->data_index = 8 * (uint64_t)size;
+    header->error = NULL;
+    return e_success;
+}
+
+uint64_t steg_max_payload(const BmpInfo *bmp, int extn_len, int depth)
+{
+    // Same rule as check_capacity(): the capacity must exceed the total.
+    // The size varint grows with the payload, try each width in turn.
+    const uint64_t per_byte = 8 / depth;
+    size_t fixed = strlen(MAGIC_STRING) + 1 + 1 + varint_size(extn_len) + extn_len + STEG_V2_CHECK_SIZE;
+    uint64_t narrower = 0;
+    for (int width = 1; width <= STEG_V2_SIZE_BYTES; width++)
+    {
+        uint64_t header = 8 * (fixed + width);
+        if (bmp->capacity <= header)
+            return narrower;
+        uint64_t max = (bmp->capacity - header - 1) / per_byte;
+        uint64_t limit = width < STEG_V2_SIZE_BYTES ? (1ULL << (7 * width)) - 1 : UINT64_MAX;
+        if (max <= limit)
+            return max > narrower ? max : narrower;
+        narrower = limit;
+    }
+    return narrower;
+}
+
+/*
+ * Embed or extract n bytes at depth starting at carrier index, through
+ * a stack scratch buffer when padding or alpha split the carrier bytes
+ */
+static void embed_span(const BmpInfo *bmp, unsigned char *image, uint64_t index,
+                       const unsigned char *data, size_t n, int depth)
+{
+    const size_t per_byte = 8 / depth;
+    if (bmp->contiguous)
+    {
+        lsb_embed_bits(data, n, image + bmp_carrier_offset(bmp, index), depth);
+        return;
+    }
+    unsigned char scratch[STEG_SCRATCH_SIZE];
+    const size_t step = STEG_SCRATCH_SIZE / per_byte;
+    for (size_t done = 0; done < n; )
+    {
+        size_t chunk = n - done < step ? n - done : step;
+        bmp_gather(bmp, image, 0, index, chunk * per_byte, scratch);
+        lsb_embed_bits(data + done, chunk, scratch, depth);
+        bmp_scatter(bmp, image, 0, index, chunk * per_byte, scratch);
+        index += chunk * per_byte;
+        done += chunk;
+    }
+}
+
+static void extract_span(const BmpInfo *bmp, const unsigned char *image, uint64_t index,
+                         unsigned char *data, size_t n, int depth)
+{
+    const size_t per_byte = 8 / depth;
+    if (bmp->contiguous)
+    {
+        lsb_extract_bits(image + bmp_carrier_offset(bmp, index), n, data, depth);
+        return;
+    }
+    unsigned char scratch[STEG_SCRATCH_SIZE];
+    const size_t step = STEG_SCRATCH_SIZE / per_byte;
+    for (size_t done = 0; done < n; )
+    {
+        size_t chunk = n - done < step ? n - done : step;
+        bmp_gather(bmp, image, 0, index, chunk * per_byte, scratch);
+        lsb_extract_bits(scratch, chunk, data + done, depth);
+        index += chunk * per_byte;
+        done += chunk;
+    }
+}
+
+static Status parse_image(const unsigned char *image, size_t image_size, StegHeader *header)
+{
+    memset(header, 0, sizeof(*header));
+    if (bmp_parse_header(image, image_size, &header->bmp) == e_failure)
+    {
+        header->error = "not a 24/32 bpp uncompressed BMP";
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* count carrier bytes starting at index lie inside an image_size buffer */
+static int span_in_buffer(const BmpInfo *bmp, size_t image_size, uint64_t index, uint64_t count)
+{
+    return index + count <= bmp->capacity && bmp_span_end(bmp, index, count) <= image_size;
+}
+
+Status steg_embed(unsigned char *image, size_t image_size, const unsigned char *payload,
+                  size_t payload_size, const char *extn, int depth, StegHeader *header)
+{
+    if (parse_image(image, image_size, header) == e_failure)
+        return e_failure;
+    int extn_len = strlen(extn);
+    if (extn_len > STEG_MAX_EXTN || (depth != 1 && depth != 2 && depth != 4))
+    {
+        header->error = "extension too long or unsupported depth";
+        return e_failure;
+    }
+    if (payload_size > steg_max_payload(&header->bmp, extn_len, depth))
+    {
+        header->error = "payload does not fit the image";
+        return e_failure;
+    }
+    // Header fields, always 1 bit per carrier byte
+    unsigned char fields[STEG_MAX_HEADER];
+    size_t n = steg_write_header(fields, STEG_HEADER_V2, extn, depth, 0, 0, payload_size);
+    uint64_t data_index = 8 * (uint64_t)n;
+    if (!span_in_buffer(&header->bmp, image_size, data_index, (uint64_t)payload_size * 8 / depth))
+    {
+        header->error = "image buffer ends inside the pixel array";
+        return e_failure;
+    }
+    embed_span(&header->bmp, image, 0, fields, n, 1);
+
+    header->has_magic = 1;
+    header->version = STEG_HEADER_V2;
+    header->depth = depth;
+    memcpy(header->extn, extn, extn_len + 1);
+    header->payload_size = payload_size;
+    header->data_index = data_index;
+    embed_span(&header->bmp, image, header->data_index, payload, payload_size, depth);
+    return e_success;
+}
+
+/* Header bytes the buffer holds in the layout of bmp, up to STEG_MAX_HEADER */
+static size_t read_fields(const BmpInfo *bmp, const unsigned char *image, size_t image_size, unsigned char *fields)
+{
+    // The buffer may hold just the front of the pixel array (see inspect_image())
+    size_t available = STEG_MAX_HEADER;
+    while (available > 0 && !span_in_buffer(bmp, image_size, 0, 8 * available))
+        available--;
+    extract_span(bmp, image, 0, fields, available, 1);
+    return available;
+}
+
+Status steg_read_header(const unsigned char *image, size_t image_size, StegHeader *header)
+{
+    if (parse_image(image, image_size, header) == e_failure)
+        return e_failure;
+
+    // Anything but a version 2 header may be a legacy one in the raw layout
+    unsigned char fields[STEG_MAX_HEADER];
+    size_t available = read_fields(&header->bmp, image, image_size, fields);
+    if (available < STEG_PROBE_SIZE || steg_probe_version(fields) != STEG_HEADER_V2)
+    {
+        BmpInfo legacy = header->bmp;
+        bmp_use_legacy_layout(&legacy);
+        unsigned char legacy_fields[STEG_MAX_HEADER];
+        size_t legacy_available = read_fields(&legacy, image, image_size, legacy_fields);
+        int version = legacy_available >= STEG_PROBE_SIZE ? steg_probe_version(legacy_fields) : -1;
+        if (version == STEG_HEADER_V0 || version == STEG_HEADER_V1)
+        {
+            header->bmp = legacy;
+            memcpy(fields, legacy_fields, legacy_available);
+            available = legacy_available;
+        }
+    }
+
+    // Settle the header length, then parse it (a short buffer fails the parse)
+    size_t size = 0, need = 1;
+    while (need > size && need <= available)
+    {
+        size = need;
+        need = steg_header_need(fields, size);
+    }
+    if (steg_parse_header(fields, need > size ? available : size, header) == e_failure)
+        return e_failure;
+
+    uint64_t trailer = header->flags & STEG_FLAG_CHECKSUM ? STEG_CHECKSUM_SIZE : 0;
+    if (header->payload_size + trailer > (header->bmp.capacity - header->data_index) / (8 / header->depth))
+    {
+        header->error = "payload runs past the pixel array";
+        return e_failure;
+    }
+    return e_success;
+}
+
+Status steg_extract(const unsigned char *image, size_t image_size, StegHeader *header,
+                    unsigned char *payload, size_t payload_capacity)
+{
+    if (header->payload_size > payload_capacity)
+    {
+        header->error = "payload buffer too small";
+        return e_failure;
+    }
+    if (header->flags & STEG_FLAG_SCATTERED)
+    {
+        header->error = "payload is scattered, its tile order needs the passphrase";
+        return e_failure;
+    }
+    uint64_t trailer = header->flags & STEG_FLAG_CHECKSUM ? STEG_CHECKSUM_SIZE : 0;
+    if (!span_in_buffer(&header->bmp, image_size, header->data_index,
+                        (header->payload_size + trailer) * 8 / header->depth))
+    {
+        header->error = "image buffer ends inside the pixel array";
+        return e_failure;
+    }
+    extract_span(&header->bmp, image, header->data_index, payload, header->payload_size, header->depth);
+    if (trailer)
+    {
+        unsigned char stored[STEG_CHECKSUM_SIZE];
+        extract_span(&header->bmp, image, header->data_index + header->payload_size * 8 / header->depth,
+                     stored, STEG_CHECKSUM_SIZE, header->depth);
+        if (get_be(stored, STEG_CHECKSUM_SIZE) != crc32c_update(0, payload, header->payload_size))
+        {
+            header->error = "payload checksum mismatch";
+            return e_failure;
+        }
+    }
+    header->error = NULL;
+    return e_success;
+}
+
+Status steg_extract_range(const unsigned char *image, size_t image_size, StegHeader *header,
+                          uint64_t offset, unsigned char *out, size_t length)
+{
+    if (offset > header->payload_size || length > header->payload_size - offset)
+    {
+        header->error = "range runs past the payload";
+        return e_failure;
+    }
+    if (header->flags & STEG_FLAG_SCATTERED)
+    {
+        header->error = "payload is scattered, its tile order needs the passphrase";
+        return e_failure;
+    }
+    // Payload byte n starts 8 / depth * n carrier bytes behind the header
+    uint64_t first = header->data_index + offset * 8 / header->depth;
+    if (!span_in_buffer(&header->bmp, image_size, first, (uint64_t)length * 8 / header->depth))
+    {
+        header->error = "image buffer ends inside the pixel array";
+        return e_failure;
+    }
+    extract_span(&header->bmp, image, first, out, length, header->depth);
+    header->error = NULL;
+    return e_success;
+}
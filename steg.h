@@ -0,0 +1,109 @@
+#ifndef STEG_H
+#define STEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * libsteg: in-memory embedding and extraction
+ * Every call works on a complete BMP file image owned by the caller.
+ * The library allocates nothing, prints nothing, does no file I/O and
+ * keeps no global state, so separate images can be processed from any
+ * number of threads at once. On failure the reason is left in
+ * StegHeader.error.
+ */
+
+/* Longest extension the stego header can carry (its length is one byte of the extn word) */
+#define STEG_MAX_EXTN 255
+
+/*
+ * Longest header of any version in bytes (version 2: magic, version,
+ * format word, parity count, extension length, extension, size and
+ * check), each byte stored in 8 carrier bytes
+ */
+#define STEG_MAX_HEADER (2 + 1 + 5 + 2 + 2 + STEG_MAX_EXTN + 10 + 2)
+
+/* Fields stored in front of the payload */
+typedef struct _StegHeader
+{
+    BmpInfo bmp;                    // Parsed BMP header of the image
+    int has_magic;                  // Magic string present
+    int version;                    // Header version (STEG_HEADER_V0/V1/V2)
+    int depth;                      // Payload bits per carrier byte (1, 2 or 4)
+    int flags;                      // STEG_FLAG_* bits, a compressed, encrypted, error-corrected or directory payload is extracted as stored, a checksummed one is verified
+    int ecc_parity;                 // Parity bytes per ecc.h codeword with STEG_FLAG_ECC, else 0
+    char extn[STEG_MAX_EXTN + 1];   // Extension of the hidden file
+    uint64_t payload_size;          // Payload bytes
+    uint64_t data_index;            // Carrier index of payload byte 0
+    const char *error;              // Why the last call failed, NULL on success
+} StegHeader;
+
+/* Extension size word: extension length, depth, payload flags and header version */
+uint steg_pack_extn_word(int extn_len, int depth, int flags, int version);
+Status steg_unpack_extn_word(uint word, int *extn_len, int *depth, int *flags, int *version);
+
+/* Oldest legacy header version (V0 or V1) that can describe payload_size */
+int steg_header_version(uint64_t payload_size);
+
+/*
+ * Serialize the header stored in front of a payload (1 bit per carrier
+ * byte) into out, which holds STEG_MAX_HEADER bytes: the compact
+ * STEG_HEADER_V2 layout, or V0/V1 for readers older than it (which
+ * can't carry STEG_FLAG_ECC). ecc_parity is only stored with
+ * STEG_FLAG_ECC. Returns its size in bytes.
+ */
+size_t steg_write_header(unsigned char *out, int version, const char *extn, int depth, int flags, int ecc_parity,
+                         uint64_t payload_size);
+
+/*
+ * Header bytes that settle its version: a version 2 header is stored
+ * in the carrier layout of bmp.h, a legacy one in the raw layout of
+ * bmp_use_legacy_layout(), so a reader probes both
+ */
+#define STEG_PROBE_SIZE 3
+
+/* Version of the header starting with fields (STEG_PROBE_SIZE bytes), -1 without the magic string */
+int steg_probe_version(const unsigned char *fields);
+
+/*
+ * Header bytes that the first available bytes of a header call for in
+ * total: more than available while fields are still missing, exactly
+ * available once it is complete, 0 when they can't start a header.
+ * Never more than STEG_MAX_HEADER, so a reader fetches the header in a
+ * few in-order steps without running into the payload.
+ */
+size_t steg_header_need(const unsigned char *fields, size_t available);
+
+/*
+ * Parse a complete header of any version (size bytes, as settled by
+ * steg_header_need()) into header, leaving header->bmp alone
+ */
+Status steg_parse_header(const unsigned char *fields, size_t size, StegHeader *header);
+
+/* Largest payload with an extension of extn_len bytes that fits at depth (version 2 header) */
+uint64_t steg_max_payload(const BmpInfo *bmp, int extn_len, int depth);
+
+/* Embed payload into image in place, header describes the result */
+Status steg_embed(unsigned char *image, size_t image_size, const unsigned char *payload,
+                  size_t payload_size, const char *extn, int depth, StegHeader *header);
+
+/*
+ * Parse the stego header of image. header->payload_size tells the caller
+ * how large a buffer steg_extract() needs.
+ */
+Status steg_read_header(const unsigned char *image, size_t image_size, StegHeader *header);
+
+/* Copy the payload found by steg_read_header() into payload (not for scattered payloads) */
+Status steg_extract(const unsigned char *image, size_t image_size, StegHeader *header,
+                    unsigned char *payload, size_t payload_capacity);
+
+/*
+ * Copy payload bytes [offset, offset + length) into out, touching only
+ * the carrier bytes that hold them (stored bytes, no checksum check)
+ */
+Status steg_extract_range(const unsigned char *image, size_t image_size, StegHeader *header,
+                          uint64_t offset, unsigned char *out, size_t length);
+
+#endif
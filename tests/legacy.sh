@@ -0,0 +1,48 @@
+#!/bin/sh
+# Decode images written by the original encoder (legacy "#*" header, raw
+# pixel array) and compare the payload with the secret they were given.
+# legacy_pad24.bmp is 101x30 at 24 bpp (one padding byte per row),
+# legacy_alpha32.bmp is 64x40 at 32 bpp. -i must report the same
+# header from the in-memory API.
+#
+# Usage: tests/legacy.sh [path/to/steg]    (default ./a.out)
+
+STEG=${1:-./a.out}
+DIR=$(dirname "$0")/legacy
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+
+check()
+{
+    if cmp -s "$TMP/out.txt" "$DIR/secret.txt"
+    then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        failed=1
+    fi
+    rm -f "$TMP/out.txt"
+}
+
+for image in legacy_pad24 legacy_alpha32
+do
+    for io in stdio mmap async
+    do
+        "$STEG" -d "$DIR/$image.bmp" "$TMP/out.txt" --io=$io > /dev/null 2>&1
+        check "$image --io=$io"
+    done
+    "$STEG" -d - "$TMP/out.txt" < "$DIR/$image.bmp" > /dev/null 2>&1
+    check "$image from stdin"
+
+    # -i reads the header through steg_read_header()
+    if "$STEG" -i "$DIR/$image.bmp" 2>&1 | grep -q "Payload *: $(($(wc -c < "$DIR/secret.txt"))) bytes, extension .txt, depth 1, header v0"
+    then
+        echo "ok   $image -i"
+    else
+        echo "FAIL $image -i"
+        failed=1
+    fi
+done
+
+exit $failed
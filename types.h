@@ -1,6 +1,8 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stddef.h>
+
 /* User defined types */
 typedef unsigned int uint;
 
@@ -16,7 +18,28 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_psnr,
+    e_inspect,
+    e_verify,
+    e_bundle,
+    e_list,
+    e_extract,
+    e_serve,
+    e_client,
+    e_bench,
     e_unsupported
 } OperationType;
 
+/* How the carrier image is read and written */
+typedef enum
+{
+    e_io_stdio,
+    e_io_mmap,
+    e_io_async      // stdio stages over overlapped block I/O (aio.h)
+} IoMode;
+
+/* Receives a decoded payload piece by piece (see lz.h, seal.h) */
+typedef Status (*DataSink)(void *ctx, const unsigned char *data, size_t n);
+
 #endif